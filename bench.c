@@ -0,0 +1,85 @@
+// Read throughput of concurrent CSON_get_by_key calls on one shared document,
+// run with an increasing number of threads. Build with `make bench`.
+#define CSON_IMPLEMENTATION
+#include "cson.h"
+
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+
+#define BENCH_RECORDS 1024
+#define BENCH_KEYS 32
+#define BENCH_LOOKUPS 4000000
+
+typedef struct {
+  CSON *records;
+  size_t seed;
+  size_t hits;
+} Bench_Reader;
+
+static void *bench_reader(void *arg) {
+  Bench_Reader *reader = arg;
+  char key[16];
+  size_t x = reader->seed;
+  for (size_t i = 0; i < BENCH_LOOKUPS; i++) {
+    x = x * 6364136223846793005u + 1442695040888963407u;
+    snprintf(key, sizeof(key), "field_%zu", (x >> 33) % BENCH_KEYS);
+    CSON *record = CSON_get_by_index(reader->records, (x >> 13) % BENCH_RECORDS);
+    reader->hits += CSON_get_by_key(record, key) != NULL;
+  }
+  return NULL;
+}
+
+static double bench_now(void) {
+  struct timespec ts;
+  clock_gettime(CLOCK_MONOTONIC, &ts);
+  return ts.tv_sec + ts.tv_nsec * 1e-9;
+}
+
+int main(void) {
+  CVec json;
+  CVec_init(&json, sizeof(char), 0);
+  CSON_write_raw(&json, "[");
+  for (size_t r = 0; r < BENCH_RECORDS; r++) {
+    CSON_write_raw(&json, r ? ",{" : "{");
+    for (size_t k = 0; k < BENCH_KEYS; k++) {
+      char member[64];
+      snprintf(member, sizeof(member), "%s\"field_%zu\":%zu", k ? "," : "", k,
+               r * k);
+      CSON_write_raw(&json, member);
+    }
+    CSON_write_raw(&json, "}");
+  }
+  CSON_write_raw(&json, "]");
+  char nul = '\0';
+  CVec_push_back(&json, &nul);
+
+  CSON *records;
+  if (CSON_parse(&records, json.data) == CSON_ERROR) {
+    fprintf(stderr, "bench: parse failed\n");
+    return 1;
+  }
+  CVec_free(&json);
+
+  long cores = sysconf(_SC_NPROCESSORS_ONLN);
+  size_t max_threads = cores > 0 ? (size_t)cores : 1;
+  double single = 0;
+  for (size_t threads = 1; threads <= max_threads; threads *= 2) {
+    pthread_t ids[threads];
+    Bench_Reader readers[threads];
+    double start = bench_now();
+    for (size_t t = 0; t < threads; t++) {
+      readers[t] = (Bench_Reader){.records = records, .seed = t + 1};
+      pthread_create(&ids[t], NULL, bench_reader, &readers[t]);
+    }
+    for (size_t t = 0; t < threads; t++) {
+      pthread_join(ids[t], NULL);
+    }
+    double rate = threads * (double)BENCH_LOOKUPS / (bench_now() - start);
+    single = threads == 1 ? rate : single;
+    printf("%3zu threads: %8.1f M lookups/s (%.2fx)\n", threads, rate / 1e6,
+           rate / single);
+  }
+  CSON_free(records);
+  return 0;
+}
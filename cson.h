@@ -1,11 +1,17 @@
 #ifndef CSON_H
 #define CSON_H
 
+// cson.h needs a C11 compiler: documents share nodes through _Atomic
+// refcounts from <stdatomic.h>, so the header does not build as C++.
+
 #ifndef CVEC_IMPLEMENTATION
 #define CVEC_IMPLEMENTATION
 #endif
 
 #include <assert.h>
+#include <errno.h>
+#include <math.h>
+#include <stdatomic.h>
 #include <stdbool.h>
 #include <stddef.h>
 #include <stdint.h>
@@ -26,6 +32,9 @@ void CVec_grow(CVec* vec);
 void CVec_push_back(CVec* vec, void* element);
 bool CVec_get(const CVec* vec, size_t index, void* element);
 bool CVec_pop_back(CVec* vec, void* element);
+void CVec_append(CVec* vec, const void* elements, size_t count);
+void CVec_reserve(CVec* vec, size_t element_capacity);
+void CVec_shrink_to_fit(CVec* vec);
 void CVec_free(CVec* vec);
 
 // CVEC implementation
@@ -34,6 +43,10 @@ void CVec_init(CVec* vec, size_t element_size, size_t element_capacity) {
     vec->element_count = 0;
     vec->element_size = element_size;
     vec->element_capacity = element_capacity;
+    vec->data = NULL;
+    if (element_capacity == 0) {
+        return; // allocate lazily on the first push
+    }
     vec->data = (char*) malloc(element_size * element_capacity);
 
     if (vec->data == NULL) {
@@ -43,7 +56,7 @@ void CVec_init(CVec* vec, size_t element_size, size_t element_capacity) {
 }
 
 void CVec_grow(CVec* vec) {
-    size_t new_capacity = vec->element_capacity * 2;
+    size_t new_capacity = vec->element_capacity ? vec->element_capacity * 2 : 1;
     char* new_data = (char*) realloc(vec->data, vec->element_size * new_capacity);
 
     if (new_data == NULL) {
@@ -107,6 +120,57 @@ bool CVec_pop_back(CVec* vec, void* element) {
     return true; // Pop back was successful
 }
 
+// Function to copy count consecutive elements to the back of the CVec
+void CVec_append(CVec* vec, const void* elements, size_t count) {
+    while (vec->element_count + count > vec->element_capacity) {
+        CVec_grow(vec);
+    }
+
+    memcpy(vec->data + vec->element_count * vec->element_size, elements,
+           vec->element_size * count);
+    vec->element_count += count;
+}
+
+// Function to grow the capacity to at least element_capacity in one step
+void CVec_reserve(CVec* vec, size_t element_capacity) {
+    if (element_capacity <= vec->element_capacity) {
+        return;
+    }
+
+    char* new_data = (char*) realloc(vec->data, vec->element_size * element_capacity);
+
+    if (new_data == NULL) {
+        fprintf(stderr, "Memory reallocation failed in CVec_reserve\n");
+        exit(1);
+    }
+
+    vec->data = new_data;
+    vec->element_capacity = element_capacity;
+}
+
+// Function to release unused capacity so the CVec holds exactly its elements
+void CVec_shrink_to_fit(CVec* vec) {
+    if (vec->element_count == vec->element_capacity) {
+        return;
+    }
+    if (vec->element_count == 0) {
+        free(vec->data);
+        vec->data = NULL;
+        vec->element_capacity = 0;
+        return;
+    }
+
+    char* new_data = (char*) realloc(vec->data, vec->element_size * vec->element_count);
+
+    if (new_data == NULL) {
+        fprintf(stderr, "Memory reallocation failed in CVec_shrink_to_fit\n");
+        exit(1);
+    }
+
+    vec->data = new_data;
+    vec->element_capacity = vec->element_count;
+}
+
 // Function to free the memory used by a CVec
 void CVec_free(CVec* vec) {
     free(vec->data);
@@ -121,6 +185,7 @@ void CVec_free(CVec* vec) {
 
 // CSON
 #define CSON_DEFAULT_MEMBLOCK_SIZE 16
+#define CSON_MAX_DEPTH 1024
 
 // string view
 typedef struct {
@@ -163,6 +228,14 @@ CSON_TokenType CSON_Tokenizer_identify_token_type(char c);
 bool CSON_Tokenizer_is_char_valid_given_token(char c, CSON_TokenType type);
 CSON_Token CSON_Tokenizer_consume(CSON_Tokenizer *tokenizer);
 CSON_Token CSON_Tokenizer_peek(CSON_Tokenizer *tokenizer);
+void CSON_Tokenizer_skip_ws(CSON_Tokenizer *tokenizer);
+
+// value skipping
+// Returns the position just past the value starting at p, after optional
+// whitespace, or NULL when no complete value ends before end. Strings honour
+// escapes and containers are skipped by counting brackets outside strings,
+// eight bytes at a time, so their contents are not validated.
+const char *CSON_skip_value(const char *p, const char *end);
 
 // parsing
 typedef enum {
@@ -180,19 +253,164 @@ typedef enum {
   CSON_NULL = 6,
 } CSON_Type;
 
+typedef struct CSON_String CSON_String;
+typedef struct CSON_Array CSON_Array;
+typedef struct CSON_Object CSON_Object;
+typedef struct CSON_ShapeTable CSON_ShapeTable;
+typedef struct CSON_StringTable CSON_StringTable;
+typedef struct CSON_SubtreeTable CSON_SubtreeTable;
+
+// A tagged value. Literals and numbers live directly in the value, strings
+// and containers point to their payload. Containers store their elements as
+// values, so a CSON* returned by a getter points into its container and stays
+// valid until that container is modified or freed.
+// Strings of up to CSON_SMALL_STRING_MAX bytes are stored inline, starting at
+// small and running on into as, with small_len holding their length.
+#define CSON_SMALL_STRING_MAX 13
+#define CSON_LARGE_STRING 0xff
+
 typedef struct {
-  CSON_Type type;
+  uint8_t type; // CSON_Type
+  uint8_t small_len;
+  char small[6];
+  union {
+    double number;
+    CSON_String *string;
+    CSON_Array *array;
+    CSON_Object *object;
+  } as;
 } CSON;
 
+typedef struct {
+  // count the elements of every container in a structural pre-pass so each
+  // one is allocated with its exact capacity up front
+  bool prescan;
+  // intern the key sequence of every object into this table, objects with
+  // identical keys then share one shape
+  CSON_ShapeTable *shapes;
+  // share one copy of every string too long to be stored inline, keys and
+  // values alike
+  CSON_StringTable *strings;
+  // replace every container by an identical one already in this table, the
+  // resulting documents share subtrees and must be treated as read-only
+  CSON_SubtreeTable *subtrees;
+} CSON_ParseOptions;
+
+typedef struct {
+  CSON_Tokenizer tokenizer;
+  CSON_ParseOptions options;
+  CVec counts; // uint32_t element counts in container open order
+  size_t next_count;
+} CSON_Parser;
+
 CSON_Result CSON_parse(CSON **cson, char *cstr);
-CSON_Result CSON_parse_element(CSON **element, CSON_Tokenizer *tokenizer);
-CSON_Result CSON_parse_object(CSON **element, CSON_Tokenizer *tokenizer);
-CSON_Result CSON_parse_array(CSON **element, CSON_Tokenizer *tokenizer);
-CSON_Result CSON_parse_string(CSON **element, CSON_Tokenizer *tokenizer);
-CSON_Result CSON_parse_number(CSON **element, CSON_Tokenizer *tokenizer);
-CSON_Result CSON_parse_literal(CSON **element, CSON_Tokenizer *tokenizer);
+CSON_Result CSON_parse_ex(CSON **cson, char *cstr,
+                          const CSON_ParseOptions *options);
+CSON_Result CSON_parse_element(CSON *element, CSON_Parser *parser);
+CSON_Result CSON_parse_object(CSON *element, CSON_Parser *parser);
+CSON_Result CSON_parse_array(CSON *element, CSON_Parser *parser);
+void CSON_prescan(const char *cstr, CVec *counts);
+
+// validation
+// CSON_validate checks that buf holds exactly one RFC 8259 value, surrounded
+// by optional whitespace, without allocating. Strings are not checked for
+// valid UTF-8. info may be NULL. Every buffer that validates is accepted by
+// CSON_parse, CSON_Tape_parse and CSON_json_to_msgpack, which share its
+// number grammar and decode string escapes. They are more lenient in turn, a
+// successful parse does not imply the buffer validates.
+typedef struct {
+  size_t length;        // bytes scanned, up to the error when invalid
+  size_t max_depth;     // deepest container nesting
+  size_t element_count; // values including containers, keys excluded
+  size_t error_offset;  // offset of the first error, SIZE_MAX when valid
+} CSON_ValidateInfo;
 
+CSON_Result CSON_validate(const char *buf, size_t len,
+                          CSON_ValidateInfo *info);
+
+// CSON_free releases a document returned by one of the parse or decode
+// functions, CSON_clear releases the payload of a value and leaves null behind
 void CSON_free(CSON *cson);
+void CSON_clear(CSON *cson);
+// moves a value out of its slot without copying it, the slot is left null
+CSON CSON_take(CSON *cson);
+// Clears the cached hashes of container and of the containers enclosing it.
+// Call it after changing a value inside container in place, through the
+// setters or CSON_take: a value cannot reach the container holding it.
+// Container functions such as CSON_Array_set and CSON_Object_set clear the
+// hashes themselves.
+void CSON_touch(CSON *container);
+
+// CSON_freeze moves a document into one contiguous block laid out depth
+// first and returns its new root, the old root is released. Every object
+// gets its own shape with a hash index from CSON_INDEX_THRESHOLD keys on,
+// shared subtrees are copied per use. The result is read only, CSON_free
+// releases the whole block at once.
+CSON *CSON_freeze(CSON *root);
+
+// A region allocator: allocations are carved out of large blocks and only
+// released all at once. Reset keeps the newest block for reuse, so a
+// per-request arena stops allocating once it has grown to its working size.
+typedef struct CSON_ArenaBlock CSON_ArenaBlock;
+
+typedef struct {
+  CSON_ArenaBlock *blocks; // newest first
+  size_t block_size;       // CSON_ARENA_BLOCK_SIZE when zero
+} CSON_Arena;
+
+#define CSON_ARENA_BLOCK_SIZE (64 * 1024)
+
+void CSON_Arena_init(CSON_Arena *arena, size_t block_size);
+void *CSON_Arena_alloc(CSON_Arena *arena, size_t size);
+void CSON_Arena_reset(CSON_Arena *arena);
+void CSON_Arena_free(CSON_Arena *arena);
+
+// CSON_clone returns a deep copy of a value that shares nothing with it, so
+// it may be taken while other threads read the source and outlives it.
+// Without an arena the copy is a modifiable document released by CSON_free,
+// built without recursion with every container sized exactly. With an arena
+// the copy is a frozen document laid out in one allocation from it and is
+// released with the arena, never by CSON_free; a frozen source is copied
+// with a single memcpy of its block. Persistent updates derive modified
+// versions of an arena copy, they must be freed before the arena.
+CSON *CSON_clone(CSON *root, CSON_Arena *arena);
+
+// Persistent updates return a new root that differs from the old document in
+// one place and shares every untouched subtree with it, so only the
+// containers on the path are copied. value is moved in. Both versions stay
+// valid and are freed independently. Shared subtrees must not be modified,
+// not even once the other versions are gone.
+// Reference counts are atomic: threads may derive versions from one document
+// and free them concurrently. Versions derived from a frozen document must
+// be freed before it.
+CSON *CSON_with_key(CSON *object, const char *key, CSON *value);
+CSON *CSON_with_index(CSON *array, size_t index, CSON *value);
+CSON *CSON_with_pointer(CSON *root, const char *pointer, CSON *value);
+
+// patches
+// CSON_apply_patch applies an RFC 6902 JSON Patch, an array of operations, to
+// target in place. Either every operation applies or target is left as it
+// was: each change keeps what it replaced until the patch is done and a
+// failing operation rolls the earlier ones back. move relocates the subtree
+// itself. CSON_merge_patch applies an RFC 7386 merge patch in place. Values
+// are copied out of the patch, which is not modified. Removing a member keeps
+// the order of the remaining ones. Cached hashes are
+// cleared on the changed paths and above target, a target that is not a
+// container needs CSON_touch on its container like the setters.
+CSON_Result CSON_apply_patch(CSON *target, CSON *patch);
+void CSON_merge_patch(CSON *target, CSON *patch);
+
+// structural hashing
+// CSON_hash returns a 64 bit hash of the structure of a value in which object
+// members count in any order, as CSON_equal compares them. Containers cache
+// their hash until they or a value below them change, only the containers on
+// the path of a change lose theirs. CSON_equal is exact
+// and returns early when the hashes differ. CSON_diff returns an RFC 6902
+// patch turning from into to; it skips subtrees that are shared or hash
+// alike and compare equal, a hash match alone is never trusted.
+uint64_t CSON_hash(CSON *cson);
+bool CSON_equal(CSON *a, CSON *b);
+CSON *CSON_diff(CSON *from, CSON *to);
 
 // checkers
 bool CSON_is_null(CSON *cson);
@@ -202,93 +420,725 @@ bool CSON_is_number(CSON *cson);
 bool CSON_is_array(CSON *cson);
 bool CSON_is_object(CSON *cson);
 bool CSON_is_container(CSON *cson);
+bool CSON_is_frozen(CSON *cson);
 
 // getters
 bool CSON_get_bool(CSON *cson);
 const char *CSON_get_string(CSON *cson);
 double CSON_get_double(CSON *cson);
+double CSON_get_number(CSON *cson);
 CSON *CSON_get_by_index(CSON *cson, size_t index);
 CSON *CSON_get_by_key(CSON *cson, const char *key);
 
-// setters
+// setters, the old payload is released. The value must not live inside a
+// shared or frozen container, see CSON_touch for one inside a container.
 void CSON_set_null(CSON *cson);
 void CSON_set_bool(CSON *cson, bool b);
+void CSON_set_number(CSON *cson, double value);
 void CSON_set_string(CSON *cson, const char *cstr);
 
+CSON CSON_Literal_new(CSON_Type type);
+CSON CSON_Number_new(double value);
+
+// Heap strings are reference counted so interned strings can be shared.
+struct CSON_String {
+  _Atomic size_t refcount;
+  size_t len;
+  uint32_t hash; // only set for interned strings
+  char str[];    // zero terminated
+};
+
+struct CSON_StringTable {
+  CSON_String **slots;
+  size_t capacity;
+  size_t count;
+};
+
+CSON CSON_String_from_sv(CSON_SV sv);
+CSON CSON_String_intern(CSON_StringTable *table, CSON_SV sv);
+void CSON_String_free(CSON_String *string);
+
+void CSON_StringTable_init(CSON_StringTable *table);
+void CSON_StringTable_free(CSON_StringTable *table);
+
+// Nodes of frozen documents carry this reference count and are never
+// released on their own.
+#define CSON_REFCOUNT_FROZEN SIZE_MAX
+
+// Structural hash of a container cached by CSON_hash. parent links to the
+// cache of the enclosing container so a change clears the hashes on its way
+// up to the root and nowhere else. Links are made when the enclosing
+// container is hashed, which is the only time a hash above can come to
+// depend on this one, and are cut when the container is moved out. A
+// container that gets shared has more than one owner and is linked to none:
+// it stays read only for good, as does everything below it. Frozen
+// containers keep their hash.
+typedef struct CSON_HashCache CSON_HashCache;
+
+struct CSON_HashCache {
+  _Atomic uint64_t value; // zero when not computed
+  _Atomic(CSON_HashCache *) parent;
+};
+
+// Containers are reference counted so identical subtrees can be shared, a
+// shared container (refcount above one) must not be modified, nor anything
+// below it. Reference counts are atomic, so versions sharing subtrees may be
+// derived and freed from different threads.
+//
+// Documents that are not being modified may be read from many threads at
+// once: every function that only reads a document is thread safe. Caches
+// filled in by reads (the hash, the lookup index of objects) are published
+// atomically and need no locks. Caller owned state such as a CSON_FieldCache
+// or a CSON_TapeCursor must not be shared between threads.
+struct CSON_Array {
+  _Atomic size_t refcount;
+  CSON_HashCache hash;
+  CVec data; // CSON
+};
+
+CSON CSON_Array_new(void);
+void CSON_Array_free(CSON_Array *array);
+void CSON_Array_reserve(CSON_Array *array, size_t capacity);
+void CSON_Array_append(CSON_Array *array, CSON *value);
+void CSON_Array_insert(CSON_Array *array, size_t index, CSON *value);
+void CSON_Array_set(CSON_Array *array, size_t index, CSON *value);
+// Removal moves the element to out, or releases it when out is NULL. remove
+// keeps the order of the remaining elements, swap_remove moves the last
+// element into the gap instead.
+void CSON_Array_remove(CSON_Array *array, size_t index, CSON *out);
+void CSON_Array_swap_remove(CSON_Array *array, size_t index, CSON *out);
+
+// An object key with its length and hash cached next to it.
 typedef struct {
-  CSON cson;
-} CSON_Literal;
-CSON_Literal *CSON_Literal_new();
-void CSON_Literal_free(CSON_Literal *literal);
+  uint32_t hash;
+  uint32_t len;
+  CSON string;
+} CSON_Key;
 
+// Members keep the key and the value next to each other, so a lookup or an
+// iteration is a single sequential walk.
 typedef struct {
-  CSON cson;
-  double value;
-} CSON_Number;
+  CSON_Key key;
+  CSON value;
+} CSON_Member;
 
-CSON_Number *CSON_Number_new(double value);
-void CSON_Number_free(CSON_Number *number);
+// Open addressing hash index over an array of keys, each slot holds the
+// position of a key plus one, zero marks an empty slot. Only built for key
+// sequences of at least CSON_INDEX_THRESHOLD keys.
+#define CSON_INDEX_THRESHOLD 8
 
 typedef struct {
-  CSON cson;
-  CSON_SV sv;
-} CSON_String;
+  uint32_t *slots;
+  size_t mask;
+} CSON_Index;
 
-CSON_String *CSON_String_from_sv(CSON_SV sv);
-void CSON_String_free(CSON_String *string);
+// A shape describes the key sequence of an object. Objects interned through a
+// CSON_ShapeTable share one reference counted shape per distinct key sequence
+// and only store their values.
+typedef struct {
+  _Atomic size_t refcount;
+  uint32_t hash; // of the whole key sequence
+  CSON_Index index;
+  size_t count;
+  CSON_Key keys[];
+} CSON_Shape;
+
+struct CSON_ShapeTable {
+  CSON_Shape **slots;
+  size_t capacity;
+  size_t count;
+};
+
+struct CSON_Object {
+  _Atomic size_t refcount;
+  CSON_HashCache hash;
+  CSON_Shape *shape; // NULL unless the object shares its keys
+  union {
+    CVec members; // CSON_Member, when shape is NULL
+    CVec values;  // CSON, when shape is set
+  };
+  // built by the first lookup in members of at least CSON_INDEX_THRESHOLD
+  // keys, the slots follow the CSON_Index in the same allocation
+  _Atomic(CSON_Index *) index;
+};
 
+CSON CSON_Object_new(void);
+void CSON_Object_free(CSON_Object *object);
+void CSON_Object_reserve(CSON_Object *object, size_t capacity);
+void CSON_Object_insert(CSON_Object *object, CSON *key, CSON *value);
+void CSON_Object_set(CSON_Object *object, CSON *key, CSON *value);
+void CSON_Object_remove_at(CSON_Object *object, size_t index, CSON *out);
+void CSON_Object_swap_remove_at(CSON_Object *object, size_t index, CSON *out);
+CSON_Result CSON_Object_remove(CSON_Object *object, const char *key,
+                               CSON *out);
+size_t CSON_Object_count(CSON_Object *object);
+CSON_Key *CSON_Object_key_at(CSON_Object *object, size_t index);
+CSON *CSON_Object_value_at(CSON_Object *object, size_t index);
+size_t CSON_Object_find(CSON_Object *object, const char *key, size_t len,
+                        uint32_t hash);
+void CSON_Object_intern_shape(CSON_Object *object, CSON_ShapeTable *table);
+
+// Lookup cache kept by the caller at a call site that reads the same key from
+// many objects. The position the key was last found at is checked first, so
+// objects sharing a layout resolve the key with a single key compare.
 typedef struct {
-  CSON cson;
-  CVec data;
-} CSON_Array;
+  const char *key;
+  size_t len;
+  uint32_t hash;
+  size_t position;
+} CSON_FieldCache;
 
-CSON_Array *CSON_Array_new();
-void CSON_Array_free(CSON_Array *array);
-void CSON_Array_append(CSON_Array *array, CSON *value);
+void CSON_FieldCache_init(CSON_FieldCache *cache, const char *key);
+CSON *CSON_get_by_key_cached(CSON *cson, CSON_FieldCache *cache);
+
+uint32_t CSON_hash_string(const char *str, size_t len);
+
+void CSON_ShapeTable_init(CSON_ShapeTable *table);
+void CSON_ShapeTable_free(CSON_ShapeTable *table);
+void CSON_Shape_release(CSON_Shape *shape);
+
+struct CSON_SubtreeTable {
+  CSON *slots; // containers, empty slots hold a NULL payload
+  size_t capacity;
+  size_t count;
+};
+
+void CSON_SubtreeTable_init(CSON_SubtreeTable *table);
+void CSON_SubtreeTable_free(CSON_SubtreeTable *table);
+void CSON_SubtreeTable_intern(CSON_SubtreeTable *table, CSON *value);
+
+// Minimal perfect hash over a key set fixed ahead of time, for reading the
+// same known fields from many objects. Every key hashes to its own slot, so
+// a member resolves with the hash already stored in its CSON_Key and one
+// compare. Distinct keys whose hashes collide share a slot and are chained.
+// Compiling tries up to CSON_KEYSET_MAX_SEEDS seeds with a bounded number of
+// displacements each and fails with NULL when none of them places every key.
+// The key strings are borrowed and must outlive the key set.
+#define CSON_KEYSET_MAX_SEEDS 8
 
 typedef struct {
-  CSON cson;
-  CVec keys;
-  CVec data;
-} CSON_Object;
+  const char *key;
+  uint32_t len;
+  uint32_t hash;
+  uint32_t next; // next entry with the same hash, UINT32_MAX ends the chain
+} CSON_KeySetEntry;
 
-CSON_Object *CSON_Object_new();
-void CSON_Object_free(CSON_Object *object);
-void CSON_Object_insert(CSON_Object *object, CSON_String *key, CSON *value);
+typedef struct {
+  size_t count;
+  size_t bucket_count;
+  uint64_t seed;
+  uint32_t *displacements; // per bucket
+  uint32_t *slots;         // slot to key set index, UINT32_MAX when empty
+  CSON_KeySetEntry entries[];
+} CSON_KeySet;
+
+CSON_KeySet *CSON_KeySet_compile(const char **keys, size_t n);
+void CSON_KeySet_free(CSON_KeySet *keyset);
+size_t CSON_KeySet_lookup(const CSON_KeySet *keyset, const CSON_Key *key);
+CSON *CSON_get_by_keyset(CSON *cson, const CSON_KeySet *keyset, size_t idx);
+size_t CSON_extract(CSON *cson, const CSON_KeySet *keyset, CSON **out);
+size_t CSON_get_many(CSON *cson, const char **keys, size_t n, CSON **out);
+
+// binary formats
+// Encoders append to out, which must be a CVec initialized with an element
+// size of 1. Decoders expect exactly one complete value in buf.
+typedef struct {
+  const uint8_t *buf;
+  size_t len;
+  size_t pos;
+  size_t depth;
+} CSON_Reader;
+
+CSON_Result CSON_to_msgpack(CSON *cson, CVec *out);
+CSON_Result CSON_from_msgpack(CSON **cson, const uint8_t *buf, size_t len);
+CSON_Result CSON_to_cbor(CSON *cson, CVec *out);
+CSON_Result CSON_from_cbor(CSON **cson, const uint8_t *buf, size_t len);
+CSON_Result CSON_json_to_msgpack(char *cstr, CVec *out);
+
+// struct binding
+// Descriptors map JSON object members onto the fields of a C struct, so
+// CSON_decode can write values straight into caller provided memory without
+// building a DOM. A descriptor array is terminated by an entry without name.
+//  - CSON_FIELD_INT and CSON_FIELD_DOUBLE use size to pick the C type
+//    (int8_t..int64_t, float or double)
+//  - CSON_FIELD_STRING fills a char[size] buffer, CSON_FIELD_STRING_DUP
+//    stores a malloc'd char* released by CSON_decode_free
+//  - CSON_FIELD_OBJECT decodes a nested struct described by fields
+//  - CSON_FIELD_ARRAY fills an inline array of size bytes whose element is
+//    described by fields[0] and stores the element count as a size_t at
+//    count_offset
+// Fields are required unless flagged CSON_FIELD_OPTIONAL, missing optional
+// fields and fields set to null keep their previous value. Every descriptor,
+// nested ones included, may hold at most CSON_MAX_FIELDS fields, decoding an
+// object described by a larger one fails.
+typedef enum {
+  CSON_FIELD_BOOL,
+  CSON_FIELD_INT,
+  CSON_FIELD_DOUBLE,
+  CSON_FIELD_STRING,
+  CSON_FIELD_STRING_DUP,
+  CSON_FIELD_OBJECT,
+  CSON_FIELD_ARRAY,
+} CSON_FieldType;
+
+#define CSON_FIELD_OPTIONAL 1
+#define CSON_MAX_FIELDS 64
+
+typedef struct CSON_FieldDesc {
+  const char *name;
+  CSON_FieldType type;
+  size_t offset;
+  size_t size;
+  int flags;
+  const struct CSON_FieldDesc *fields;
+  size_t count_offset;
+} CSON_FieldDesc;
+
+#define CSON_FIELD_DESC(struct_type, member, field_type)                       \
+  .name = #member, .type = field_type,                                         \
+  .offset = offsetof(struct_type, member),                                     \
+  .size = sizeof(((struct_type *)0)->member)
+
+CSON_Result CSON_decode(char *cstr, const CSON_FieldDesc *fields, void *out);
+void CSON_decode_free(const CSON_FieldDesc *fields, void *out);
+
+// generated struct binding
+// CSON_STRUCT declares a struct from an X-macro field list and generates
+// name_decode, name_decode_tokens, name_encode and name_free for it. The
+// decoder is specialized per struct: keys are matched against compile time
+// constant lengths and first characters instead of walking a descriptor.
+//
+//   #define USER_FIELDS(FIELD) FIELD(int64, id) FIELD(string, name)
+//   CSON_STRUCT(User, USER_FIELDS)
+//
+// Field kinds are bool, int32, int64, double and string (a malloc'd char*
+// released by name_free). Unknown members are skipped, missing members and
+// members set to null keep their previous value.
+#define CSON_CTYPE_bool bool
+#define CSON_CTYPE_int32 int32_t
+#define CSON_CTYPE_int64 int64_t
+#define CSON_CTYPE_double double
+#define CSON_CTYPE_string char *
+
+#define CSON_FIELD_FREE_bool(field) ((void)(field))
+#define CSON_FIELD_FREE_int32(field) ((void)(field))
+#define CSON_FIELD_FREE_int64(field) ((void)(field))
+#define CSON_FIELD_FREE_double(field) ((void)(field))
+#define CSON_FIELD_FREE_string(field) (free(*(field)), *(field) = NULL)
+
+#define CSON_X_MEMBER(kind, member) CSON_CTYPE_##kind member;
+
+#define CSON_X_DECODE(kind, member)                                            \
+  else if (key.sv.len == sizeof(#member) - 1 &&                                \
+           key.sv.str[0] == #member[0] &&                                      \
+           memcmp(key.sv.str, #member, sizeof(#member) - 1) == 0) {            \
+    res = CSON_read_##kind(tokenizer, &out->member);                           \
+  }
+
+#define CSON_X_ENCODE(kind, member)                                            \
+  CSON_write_raw(out, sep);                                                    \
+  sep = ",";                                                                   \
+  CSON_write_raw(out, "\"" #member "\":");                                     \
+  CSON_write_##kind(out, in->member);
+
+#define CSON_X_FREE(kind, member) CSON_FIELD_FREE_##kind(&value->member);
+
+#define CSON_STRUCT(name, FIELDS)                                              \
+  typedef struct {                                                             \
+    FIELDS(CSON_X_MEMBER)                                                      \
+  } name;                                                                      \
+                                                                               \
+  static inline CSON_Result name##_decode_tokens(CSON_Tokenizer *tokenizer,    \
+                                                 name *out) {                  \
+    if (CSON_Tokenizer_consume(tokenizer).type != CSON_TOKENTYPE_CURLY_OPEN) { \
+      return CSON_ERROR;                                                       \
+    }                                                                          \
+    CSON_Token token = CSON_Tokenizer_peek(tokenizer);                         \
+    if (token.type == CSON_TOKENTYPE_CURLY_CLOSE) {                            \
+      CSON_Tokenizer_consume(tokenizer);                                       \
+    }                                                                          \
+    while (token.type != CSON_TOKENTYPE_CURLY_CLOSE) {                         \
+      CSON_Token key = CSON_Tokenizer_consume(tokenizer);                      \
+      if (key.type != CSON_TOKENTYPE_STRING ||                                 \
+          CSON_Tokenizer_consume(tokenizer).type != CSON_TOKENTYPE_COLON) {    \
+        return CSON_ERROR;                                                     \
+      }                                                                        \
+      CSON_Result res;                                                         \
+      if (key.sv.len == 0) {                                                   \
+        res = CSON_Tokenizer_skip_value(tokenizer);                            \
+      }                                                                        \
+      FIELDS(CSON_X_DECODE)                                                    \
+      else {                                                                   \
+        res = CSON_Tokenizer_skip_value(tokenizer);                            \
+      }                                                                        \
+      if (res == CSON_ERROR) {                                                 \
+        return CSON_ERROR;                                                     \
+      }                                                                        \
+      token = CSON_Tokenizer_consume(tokenizer);                               \
+      if (token.type != CSON_TOKENTYPE_COMMA &&                                \
+          token.type != CSON_TOKENTYPE_CURLY_CLOSE) {                          \
+        return CSON_ERROR;                                                     \
+      }                                                                        \
+    }                                                                          \
+    return CSON_SUCCES;                                                        \
+  }                                                                            \
+                                                                               \
+  static inline CSON_Result name##_decode(char *cstr, name *out) {             \
+    CSON_Tokenizer tokenizer;                                                  \
+    CSON_SV_init(&tokenizer.sv, cstr);                                         \
+    return name##_decode_tokens(&tokenizer, out);                              \
+  }                                                                            \
+                                                                               \
+  static inline void name##_encode(const name *in, CVec *out) {                \
+    const char *sep = "{";                                                     \
+    FIELDS(CSON_X_ENCODE)                                                      \
+    CSON_write_raw(out, sep[0] == '{' ? "{}" : "}");                           \
+  }                                                                            \
+                                                                               \
+  static inline void name##_free(name *value) { FIELDS(CSON_X_FREE) }
+
+// primitives used by the generated code, readers leave *out untouched when
+// the value is null, writers append JSON text to a CVec of char
+CSON_Result CSON_Tokenizer_skip_value(CSON_Tokenizer *tokenizer);
+CSON_Result CSON_read_bool(CSON_Tokenizer *tokenizer, bool *out);
+CSON_Result CSON_read_int32(CSON_Tokenizer *tokenizer, int32_t *out);
+CSON_Result CSON_read_int64(CSON_Tokenizer *tokenizer, int64_t *out);
+CSON_Result CSON_read_double(CSON_Tokenizer *tokenizer, double *out);
+CSON_Result CSON_read_string(CSON_Tokenizer *tokenizer, char **out);
+void CSON_write_raw(CVec *out, const char *str);
+void CSON_write_bool(CVec *out, bool value);
+void CSON_write_int32(CVec *out, int32_t value);
+void CSON_write_int64(CVec *out, int64_t value);
+void CSON_write_double(CVec *out, double value);
+void CSON_write_string(CVec *out, const char *str);
+
+// paths
+// CSON_Path_compile accepts two syntaxes:
+//  - RFC 6901 JSON Pointers such as "" or "/a/0/m~1n", a token selects an
+//    object member or, when it spells an array index, an array element
+//  - a JSONPath subset starting with $: .name, ['name'], [3], [-1], .*, [*],
+//    slices [start:end:step] with a positive step and recursive descent ..
+// A compiled path can be evaluated any number of times, against a DOM or
+// against raw JSON text.
+typedef enum {
+  CSON_PATH_KEY,
+  CSON_PATH_INDEX,
+  CSON_PATH_WILDCARD,
+  CSON_PATH_SLICE,
+  CSON_PATH_DESCEND, // the next step applies at any depth
+} CSON_PathOp;
+
+#define CSON_PATH_MAX_STEPS 63
+#define CSON_PATH_NO_BOUND INT64_MIN
+
+typedef struct {
+  CSON_PathOp op;
+  char *key; // CSON_PATH_KEY, zero terminated
+  size_t len;
+  uint32_t hash;
+  int64_t index; // CSON_PATH_INDEX, for keys the array index the token
+                 // spells when it comes from a pointer, -1 otherwise
+  int64_t start; // CSON_PATH_SLICE bounds, CSON_PATH_NO_BOUND when omitted
+  int64_t end;
+  int64_t step;
+} CSON_PathStep;
+
+typedef struct {
+  size_t count;
+  CSON_PathStep steps[];
+} CSON_Path;
+
+CSON_Path *CSON_Path_compile(const char *expr);
+void CSON_Path_free(CSON_Path *path);
+CSON *CSON_Path_get(const CSON_Path *path, CSON *root);
+size_t CSON_Path_eval(const CSON_Path *path, CSON *root, CVec *out);
+CSON_Result CSON_Path_eval_raw(const CSON_Path *path, char *cstr, CVec *out);
+
+// handles
+// A CSON_Handle publishes the current version of a document that is replaced
+// while other threads read it, such as a reloaded config. Readers bracket
+// their use of the root with acquire and release and never block or see a
+// freed tree. CSON_Handle_publish swaps in a new root, waits until every
+// reader that may still see the old one has released it, then retires it.
+// Readers are counted per epoch: publish flips the epoch, so only readers
+// from before the flip are waited for. Writers are serialized and back off
+// to yielding while they wait. Published versions
+// may share subtrees, as persistent updates do: a reader keeps a subtree past
+// its release by deriving its own version of it, whose atomic references
+// outlive the retired root.
+typedef struct {
+  _Atomic(CSON *) current;
+  atomic_size_t epoch;
+  atomic_size_t readers[2]; // by epoch parity
+  atomic_flag writing;
+  // called for every replaced root, CSON_free when NULL
+  void (*retire)(CSON *root, void *context);
+  void *context;
+} CSON_Handle;
+
+void CSON_Handle_init(CSON_Handle *handle, CSON *root);
+void CSON_Handle_free(CSON_Handle *handle);
+CSON *CSON_Handle_acquire(CSON_Handle *handle, size_t *ticket);
+void CSON_Handle_release(CSON_Handle *handle, size_t ticket);
+// Never publish from a thread that holds an acquired root of the same handle:
+// publish waits for that reader to release and deadlocks.
+void CSON_Handle_publish(CSON_Handle *handle, CSON *root);
+
+// tape
+// A flat representation of a document: one array of 64 bit words in document
+// order plus one string buffer. The top byte of every word is a CSON_TapeTag,
+// the lower 56 bits are its payload:
+//  - container opens store the index of their matching close in the low 32
+//    bits and their element count (saturated at 2^24-1) in the next 24 bits
+//  - container closes store the index of their matching open
+//  - strings store the offset of a 32 bit length followed by the zero
+//    terminated bytes in the string buffer
+// Documents needing more than 2^32 words or holding strings longer than
+// 2^32-1 bytes fail to parse. Counts of larger containers are found by walking
+// them, so CSON_TapeCursor_count is O(1) only below the saturation point.
+// CSON_TapeCursor_get_by_index steps through the elements with next and is
+// O(index), CSON_TapeCursor_get_by_key is linear in the member count.
+//  - numbers are followed by one word holding the raw double
+typedef enum {
+  CSON_TAPE_ARRAY_OPEN = '[',
+  CSON_TAPE_ARRAY_CLOSE = ']',
+  CSON_TAPE_OBJECT_OPEN = '{',
+  CSON_TAPE_OBJECT_CLOSE = '}',
+  CSON_TAPE_STRING = '"',
+  CSON_TAPE_NUMBER = 'd',
+  CSON_TAPE_TRUE = 't',
+  CSON_TAPE_FALSE = 'f',
+  CSON_TAPE_NULL = 'n',
+} CSON_TapeTag;
+
+#define CSON_TAPE_PAYLOAD_MASK ((UINT64_C(1) << 56) - 1)
+#define CSON_TAPE_MAX_COUNT ((UINT64_C(1) << 24) - 1)
+
+typedef struct {
+  uint64_t *words;
+  size_t word_count;
+  char *strings;
+  size_t string_size;
+} CSON_Tape;
+
+typedef struct {
+  const CSON_Tape *tape;
+  size_t index;
+} CSON_TapeCursor;
+
+CSON_Result CSON_Tape_parse(CSON_Tape *tape, char *cstr);
+void CSON_Tape_free(CSON_Tape *tape);
+CSON_TapeCursor CSON_Tape_root(const CSON_Tape *tape);
+
+CSON_TapeTag CSON_TapeCursor_tag(CSON_TapeCursor cursor);
+CSON_Type CSON_TapeCursor_type(CSON_TapeCursor cursor);
+size_t CSON_TapeCursor_count(CSON_TapeCursor cursor);
+bool CSON_TapeCursor_child(CSON_TapeCursor *cursor);
+bool CSON_TapeCursor_next(CSON_TapeCursor *cursor);
+bool CSON_TapeCursor_get_bool(CSON_TapeCursor cursor);
+double CSON_TapeCursor_get_double(CSON_TapeCursor cursor);
+const char *CSON_TapeCursor_get_string(CSON_TapeCursor cursor, size_t *len);
+bool CSON_TapeCursor_get_by_index(CSON_TapeCursor *cursor, size_t index);
+bool CSON_TapeCursor_get_by_key(CSON_TapeCursor *cursor, const char *key);
 
 #ifdef CSON_IMPLEMENTATION
 
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <sched.h>
+#endif
+
 // genralized
+// Reference counts, frozen nodes are never released. Taking a reference
+// needs no ordering, the last release synchronizes with every earlier one so
+// the node is freed after all uses of it.
+static void CSON_retain(_Atomic size_t *refcount) {
+  if (atomic_load_explicit(refcount, memory_order_relaxed) !=
+      CSON_REFCOUNT_FROZEN) {
+    atomic_fetch_add_explicit(refcount, 1, memory_order_relaxed);
+  }
+}
 
-void CSON_free(CSON *cson) {
-  switch (cson->type) {
-  case CSON_TRUE:
-  case CSON_FALSE:
-  case CSON_NULL: {
-    CSON_Literal_free((CSON_Literal *)cson);
-    return;
+// true once the last reference is gone
+static bool CSON_release(_Atomic size_t *refcount) {
+  return atomic_load_explicit(refcount, memory_order_relaxed) !=
+             CSON_REFCOUNT_FROZEN &&
+         atomic_fetch_sub_explicit(refcount, 1, memory_order_acq_rel) == 1;
+}
+
+// hash caches, see CSON_HashCache
+// stands in for the owners of a shared container, never dereferenced
+static CSON_HashCache CSON_shared_owner;
+
+static void CSON_HashCache_init(CSON_HashCache *cache) {
+  atomic_init(&cache->value, 0);
+  atomic_init(&cache->parent, NULL);
+}
+
+// the cached hash or zero when there is none
+static uint64_t CSON_HashCache_get(CSON_HashCache *cache) {
+  return atomic_load_explicit(&cache->value, memory_order_relaxed);
+}
+
+// racing readers store the same hash
+static void CSON_HashCache_set(CSON_HashCache *cache, uint64_t hash) {
+  atomic_store_explicit(&cache->value, hash, memory_order_relaxed);
+}
+
+// Forget the hash of a container whose enclosing containers had theirs
+// cleared already, such as every container on a path walked from the root.
+static void CSON_HashCache_drop(CSON_HashCache *cache) {
+  atomic_store_explicit(&cache->value, 0, memory_order_relaxed);
+}
+
+// The container changes, its hash and the hashes above it go. A container
+// only has a hash while the one it is linked to has none or a hash computed
+// over it, so the walk stops at the first container without one.
+static void CSON_HashCache_clear(CSON_HashCache *cache) {
+  assert(atomic_load_explicit(&cache->parent, memory_order_relaxed) !=
+             &CSON_shared_owner &&
+         "attempted to modify a shared container");
+  while (cache && CSON_HashCache_get(cache)) {
+    CSON_HashCache_drop(cache);
+    cache = atomic_load_explicit(&cache->parent, memory_order_relaxed);
+    assert(cache != &CSON_shared_owner &&
+           "attempted to modify a shared subtree");
   }
-  case CSON_STRING: {
-    CSON_String_free((CSON_String *)cson);
-    return;
+}
+
+// the cache of a container value, NULL for anything else
+static CSON_HashCache *CSON_hash_cache(CSON *value) {
+  switch (value->type) {
+  case CSON_ARRAY:
+    return value->as.array->refcount == CSON_REFCOUNT_FROZEN
+               ? NULL
+               : &value->as.array->hash;
+  case CSON_OBJECT:
+    return value->as.object->refcount == CSON_REFCOUNT_FROZEN
+               ? NULL
+               : &value->as.object->hash;
+  default:
+    return NULL;
   }
-  case CSON_ARRAY: {
-    CSON_Array_free((CSON_Array *)cson);
-    return;
+}
+
+// link a child that is unlinked so far, shared children stay unlinked
+static void CSON_HashCache_adopt(CSON *child, CSON_HashCache *parent) {
+  CSON_HashCache *cache = CSON_hash_cache(child);
+  CSON_HashCache *unlinked = NULL;
+  if (cache) {
+    atomic_compare_exchange_strong_explicit(&cache->parent, &unlinked, parent,
+                                            memory_order_relaxed,
+                                            memory_order_relaxed);
   }
-  case CSON_OBJECT: {
-    CSON_Object_free((CSON_Object *)cson);
+}
+
+// the value leaves its container, which clears its own hash
+static void CSON_HashCache_detach(CSON *value) {
+  CSON_HashCache *cache = CSON_hash_cache(value);
+  if (cache && atomic_load_explicit(&cache->parent, memory_order_relaxed) !=
+                   &CSON_shared_owner) {
+    atomic_store_explicit(&cache->parent, NULL, memory_order_relaxed);
+  }
+}
+
+// a container value gets a second owner
+static void CSON_share_container(CSON *value) {
+  CSON_HashCache *cache = CSON_hash_cache(value);
+  if (!cache) {
     return;
   }
-  case CSON_NUMBER: {
-    CSON_Number_free((CSON_Number *)cson);
+  CSON_retain(value->type == CSON_ARRAY ? &value->as.array->refcount
+                                        : &value->as.object->refcount);
+  atomic_store_explicit(&cache->parent, &CSON_shared_owner,
+                        memory_order_relaxed);
+}
+
+// A container value about to be replaced in place or moved out of its slot
+// clears the hashes of the container holding it, through its link.
+static void CSON_HashCache_leave(CSON *value) {
+  CSON_HashCache *cache = CSON_hash_cache(value);
+  if (!cache) {
     return;
   }
+  CSON_HashCache *parent =
+      atomic_load_explicit(&cache->parent, memory_order_relaxed);
+  if (parent && parent != &CSON_shared_owner) {
+    CSON_HashCache_clear(parent);
+  }
+  CSON_HashCache_detach(value);
+}
+
+void CSON_clear(CSON *cson) {
+  switch (cson->type) {
+  case CSON_TRUE:
+  case CSON_FALSE:
+  case CSON_NULL:
+  case CSON_NUMBER:
+    break;
+  case CSON_STRING:
+    if (cson->small_len == CSON_LARGE_STRING) {
+      CSON_String_free(cson->as.string);
+    }
+    break;
+  case CSON_ARRAY:
+    CSON_Array_free(cson->as.array);
+    break;
+  case CSON_OBJECT:
+    CSON_Object_free(cson->as.object);
+    break;
   default: {
     fprintf(stderr, "CSON: attempt to free unkown CSON type %d", cson->type);
     exit(EXIT_FAILURE);
   }
   }
+  *cson = CSON_Literal_new(CSON_NULL);
+}
+
+void CSON_free(CSON *cson) {
+  CSON_clear(cson);
+  free(cson);
+}
+
+// the moved value is unlinked from the container it may have been in
+static CSON CSON_move(CSON *cson) {
+  CSON value = *cson;
+  *cson = CSON_Literal_new(CSON_NULL);
+  CSON_HashCache_detach(&value);
+  return value;
+}
+
+CSON CSON_take(CSON *cson) {
+  CSON_HashCache_leave(cson);
+  return CSON_move(cson);
+}
+
+void CSON_touch(CSON *container) {
+  CSON_HashCache *cache = CSON_hash_cache(container);
+  if (cache) {
+    CSON_HashCache_clear(cache);
+  }
+}
+
+// inline strings occupy the bytes of the value from small onwards
+static char *CSON_small_str(CSON *cson) {
+  return (char *)cson + offsetof(CSON, small);
+}
+
+static CSON_SV CSON_string_sv(CSON *cson) {
+  if (cson->small_len == CSON_LARGE_STRING) {
+    return (CSON_SV){.str = cson->as.string->str, .len = cson->as.string->len};
+  }
+  return (CSON_SV){.str = CSON_small_str(cson), .len = cson->small_len};
+}
+
+// allocate a document root holding value
+static CSON *CSON_root_new(CSON value) {
+  CSON *root = malloc(sizeof(CSON));
+  assert(root && "No ram?");
+  *root = value;
+  return root;
 }
 
 // checkers
@@ -317,6 +1167,22 @@ bool CSON_is_array(CSON *cson) {
   return cson->type == CSON_ARRAY;
 }
 
+// true for containers and heap strings living in a frozen block
+bool CSON_is_frozen(CSON *cson) {
+  assert(cson && "provided null pointer");
+  switch (cson->type) {
+  case CSON_ARRAY:
+    return cson->as.array->refcount == CSON_REFCOUNT_FROZEN;
+  case CSON_OBJECT:
+    return cson->as.object->refcount == CSON_REFCOUNT_FROZEN;
+  case CSON_STRING:
+    return cson->small_len == CSON_LARGE_STRING &&
+           cson->as.string->refcount == CSON_REFCOUNT_FROZEN;
+  default:
+    return false;
+  }
+}
+
 bool CSON_is_object(CSON *cson) {
   assert(cson && "provided null pointer");
   return cson->type == CSON_OBJECT;
@@ -331,15 +1197,17 @@ bool CSON_is_container(CSON *cson) {
 const char *CSON_get_string(CSON *cson) {
   assert(CSON_is_string(cson) &&
          "attempted to get string from non string type");
-  return ((CSON_String *)cson)->sv.str;
+  return CSON_string_sv(cson).str;
 }
 
 double CSON_get_number(CSON *cson) {
   assert(CSON_is_number(cson) &&
          "attempted to get number from non number type");
-  return ((CSON_Number *)cson)->value;
+  return cson->as.number;
 }
 
+double CSON_get_double(CSON *cson) { return CSON_get_number(cson); }
+
 bool CSON_get_bool(CSON *cson) {
   assert(CSON_is_bool(cson) && "attempted to get number from non number type");
   return cson->type == CSON_TRUE;
@@ -348,28 +1216,51 @@ bool CSON_get_bool(CSON *cson) {
 CSON *CSON_get_by_index(CSON *cson, size_t index) {
   assert(CSON_is_array(cson) &&
          "attempted to get by index from non array type");
-  CSON *element = NULL;
-  CVec_get(&((CSON_Array *)cson)->data, index, &element);
-  return element;
+  CVec *data = &cson->as.array->data;
+  if (index >= data->element_count) {
+    return NULL;
+  }
+  return (CSON *)data->data + index;
 }
 
 CSON *CSON_get_by_key(CSON *cson, const char *key) {
   assert(CSON_is_object(cson) &&
          "attempted to get by key from non object type");
-  CSON_Object *object = (CSON_Object *)cson;
-  CSON_SV *given_key = CSON_SV_new(key);
-  CSON_String *current_key;
-  CSON *value = NULL;
-  size_t i = 0;
-  while (i < object->keys.element_count) {
-    CVec_get(&((CSON_Object *)cson)->keys, i, &current_key);
-    if (CSON_SV_eq(given_key, &current_key->sv)) {
-      CVec_get(&((CSON_Object *)cson)->data, i, &value);
-      return value;
-    }
-    i++;
+  CSON_Object *object = cson->as.object;
+  size_t len = strlen(key);
+  size_t i = CSON_Object_find(object, key, len, CSON_hash_string(key, len));
+  if (i == SIZE_MAX) {
+    return NULL;
   }
-  return NULL;
+  return CSON_Object_value_at(object, i);
+}
+
+// setters
+void CSON_set_null(CSON *cson) {
+  CSON_HashCache_leave(cson);
+  CSON_clear(cson);
+}
+
+void CSON_set_bool(CSON *cson, bool b) {
+  CSON_HashCache_leave(cson);
+  CSON_clear(cson);
+  *cson = CSON_Literal_new(b ? CSON_TRUE : CSON_FALSE);
+}
+
+void CSON_set_number(CSON *cson, double value) {
+  CSON_HashCache_leave(cson);
+  CSON_clear(cson);
+  *cson = CSON_Number_new(value);
+}
+
+// the string is built before the old payload is released, cstr may point
+// into it
+void CSON_set_string(CSON *cson, const char *cstr) {
+  CSON string =
+      CSON_String_from_sv((CSON_SV){.str = (char *)cstr, .len = strlen(cstr)});
+  CSON_HashCache_leave(cson);
+  CSON_clear(cson);
+  *cson = string;
 }
 
 // string view
@@ -396,352 +1287,5157 @@ bool CSON_SV_eq(CSON_SV *A, CSON_SV *B) {
 }
 
 // literal
-CSON_Literal *CSON_Literal_new(CSON_Type type) {
-  CSON_Literal *literal = malloc(sizeof(CSON_Literal));
-  assert(literal && "No ram?");
-  literal->cson.type = type;
-  return literal;
+CSON CSON_Literal_new(CSON_Type type) {
+  assert((type == CSON_TRUE || type == CSON_FALSE || type == CSON_NULL) &&
+         "literal must be true, false or null");
+  return (CSON){.type = type};
 }
 
-void CSON_Literal_free(CSON_Literal *literal) { free(literal); }
-
 // number
-CSON_Number *CSON_Number_new(double value) {
-  CSON_Number *number = malloc(sizeof(CSON_Number));
-  assert(number && "No ram?");
-  number->cson.type = CSON_NUMBER;
-  number->value = value;
-  return number;
+CSON CSON_Number_new(double value) {
+  return (CSON){.type = CSON_NUMBER, .as.number = value};
 }
 
-void CSON_Number_free(CSON_Number *number) { free(number); }
-
 // string
-CSON_String *CSON_String_from_sv(CSON_SV sv) {
-  CSON_String *string = malloc(sizeof(CSON_String));
+CSON CSON_String_from_sv(CSON_SV sv) {
+  CSON value = {.type = CSON_STRING};
+  if (sv.len <= CSON_SMALL_STRING_MAX) {
+    value.small_len = (uint8_t)sv.len;
+    memcpy(CSON_small_str(&value), sv.str, sv.len);
+    CSON_small_str(&value)[sv.len] = '\0';
+    return value;
+  }
+  // allocate for header, string and zero termination in one block
+  CSON_String *string = malloc(sizeof(CSON_String) + sv.len + 1);
   assert(string && "No ram?");
-  string->sv.str =
-      malloc(sv.len + 1); // allocate for string and zero termination
-  assert(string->sv.str && "No ram?");
-  memcpy(string->sv.str, sv.str, sv.len);
-  string->sv.str[sv.len] = '\0';
-  string->sv.len = sv.len;
-  string->cson.type = CSON_STRING;
-  return string;
+  memcpy(string->str, sv.str, sv.len);
+  string->str[sv.len] = '\0';
+  atomic_init(&string->refcount, 1);
+  string->len = sv.len;
+  string->hash = 0;
+  value.small_len = CSON_LARGE_STRING;
+  value.as.string = string;
+  return value;
 }
 
+// releases one reference to the string
 void CSON_String_free(CSON_String *string) {
-  free(string->sv.str);
-  free(string);
+  if (CSON_release(&string->refcount)) {
+    free(string);
+  }
+}
+
+// a copy of a string value, heap strings are shared instead of duplicated
+static CSON CSON_string_copy(CSON *string) {
+  if (string->small_len == CSON_LARGE_STRING) {
+    CSON_retain(&string->as.string->refcount);
+  }
+  return *string;
+}
+
+// string table
+void CSON_StringTable_init(CSON_StringTable *table) {
+  *table = (CSON_StringTable){0};
+}
+
+void CSON_StringTable_free(CSON_StringTable *table) {
+  for (size_t i = 0; i < table->capacity; i++) {
+    if (table->slots[i]) {
+      CSON_String_free(table->slots[i]);
+    }
+  }
+  free(table->slots);
+  *table = (CSON_StringTable){0};
+}
+
+static void CSON_StringTable_place(CSON_String **slots, size_t capacity,
+                                   CSON_String *string) {
+  size_t slot = string->hash & (capacity - 1);
+  while (slots[slot]) {
+    slot = (slot + 1) & (capacity - 1);
+  }
+  slots[slot] = string;
+}
+
+// Strings short enough to be stored inline are never interned, they cost no
+// allocation to begin with.
+CSON CSON_String_intern(CSON_StringTable *table, CSON_SV sv) {
+  if (sv.len <= CSON_SMALL_STRING_MAX) {
+    return CSON_String_from_sv(sv);
+  }
+  uint32_t hash = CSON_hash_string(sv.str, sv.len);
+  if (table->capacity > 0) {
+    for (size_t slot = hash & (table->capacity - 1); table->slots[slot];
+         slot = (slot + 1) & (table->capacity - 1)) {
+      CSON_String *string = table->slots[slot];
+      if (string->hash == hash && string->len == sv.len &&
+          memcmp(string->str, sv.str, sv.len) == 0) {
+        CSON_retain(&string->refcount);
+        return (CSON){.type = CSON_STRING,
+                      .small_len = CSON_LARGE_STRING,
+                      .as.string = string};
+      }
+    }
+  }
+
+  if ((table->count + 1) * 2 > table->capacity) {
+    size_t capacity = table->capacity ? table->capacity * 2 : 64;
+    CSON_String **slots = calloc(capacity, sizeof(CSON_String *));
+    assert(slots && "No ram?");
+    for (size_t i = 0; i < table->capacity; i++) {
+      if (table->slots[i]) {
+        CSON_StringTable_place(slots, capacity, table->slots[i]);
+      }
+    }
+    free(table->slots);
+    table->slots = slots;
+    table->capacity = capacity;
+  }
+  CSON value = CSON_String_from_sv(sv);
+  value.as.string->hash = hash;
+  CSON_retain(&value.as.string->refcount); // the table keeps its own reference
+  CSON_StringTable_place(table->slots, table->capacity, value.as.string);
+  table->count++;
+  return value;
 }
 
 // array
-CSON_Array *CSON_Array_new() {
+CSON CSON_Array_new(void) {
   CSON_Array *array = malloc(sizeof(CSON_Array));
   assert(array && "No ram?");
-  array->cson.type = CSON_ARRAY;
-  CVec_init(&array->data, sizeof(CSON *), CSON_DEFAULT_MEMBLOCK_SIZE);
-  return array;
+  atomic_init(&array->refcount, 1);
+  CSON_HashCache_init(&array->hash);
+  CVec_init(&array->data, sizeof(CSON), 0);
+  return (CSON){.type = CSON_ARRAY, .as.array = array};
 }
 
+// releases one reference to the array
 void CSON_Array_free(CSON_Array *array) {
-  CSON *value;
-  CVec_pop_back(&array->data, &value);
-  while (array->data.element_count > 0) {
-    free(value);
-    CVec_pop_back(&array->data, &value);
+  if (!CSON_release(&array->refcount)) {
+    return;
   }
+  CSON *values = (CSON *)array->data.data;
+  for (size_t i = 0; i < array->data.element_count; i++) {
+    CSON_clear(&values[i]);
+  }
+  CVec_free(&array->data);
   free(array);
 }
 
+void CSON_Array_reserve(CSON_Array *array, size_t capacity) {
+  CVec_reserve(&array->data, capacity);
+}
+
+// moves value into the array, value is left null
 void CSON_Array_append(CSON_Array *array, CSON *value) {
-  CVec_push_back(&array->data, &value);
+  assert(array->refcount == 1 && "attempted to modify a shared array");
+  CSON_HashCache_clear(&array->hash);
+  CVec_push_back(&array->data, value);
+  *value = CSON_Literal_new(CSON_NULL);
 }
 
-// object
-CSON_Object *CSON_Object_new() {
-  CSON_Object *object = malloc(sizeof(CSON_Object));
-  assert(object && "No ram?");
-  object->cson.type = CSON_OBJECT;
-  CVec_init(&object->keys, sizeof(CSON_String *), CSON_DEFAULT_MEMBLOCK_SIZE);
-  CVec_init(&object->data, sizeof(CSON *), CSON_DEFAULT_MEMBLOCK_SIZE);
-  return object;
+// moves value in front of the element at index, index may equal the count
+void CSON_Array_insert(CSON_Array *array, size_t index, CSON *value) {
+  assert(array->refcount == 1 && "attempted to modify a shared array");
+  size_t count = array->data.element_count;
+  assert(index <= count && "index out of bounds");
+  CSON_HashCache_clear(&array->hash);
+  CVec_push_back(&array->data, value);
+  CSON *values = (CSON *)array->data.data;
+  memmove(values + index + 1, values + index, (count - index) * sizeof(CSON));
+  values[index] = *value;
+  *value = CSON_Literal_new(CSON_NULL);
 }
 
-void CSON_Object_free(CSON_Object *object) {
-  CSON *key;
-  CVec_pop_back(&object->keys, &key);
-  CSON *value;
-  CVec_pop_back(&object->data, &value);
-  while (object->data.element_count > 0) {
-    free(key);
-    free(value);
-    CVec_pop_back(&object->keys, &key);
-    CVec_pop_back(&object->data, &value);
+// moves value into the array in place of the element at index
+void CSON_Array_set(CSON_Array *array, size_t index, CSON *value) {
+  assert(array->refcount == 1 && "attempted to modify a shared array");
+  assert(index < array->data.element_count && "index out of bounds");
+  CSON_HashCache_clear(&array->hash);
+  CSON *slot = (CSON *)array->data.data + index;
+  CSON_clear(slot);
+  *slot = CSON_move(value);
+}
+
+// hand a removed element to out or release it
+static void CSON_give(CSON *slot, CSON *out) {
+  if (out) {
+    *out = CSON_move(slot);
+  } else {
+    CSON_clear(slot);
   }
-  free(object);
 }
 
-void CSON_Object_insert(CSON_Object *object, CSON_String *key, CSON *value) {
-  CVec_push_back(&object->keys, &key);
-  CVec_push_back(&object->data, &value);
+void CSON_Array_remove(CSON_Array *array, size_t index, CSON *out) {
+  assert(array->refcount == 1 && "attempted to modify a shared array");
+  size_t count = array->data.element_count;
+  assert(index < count && "index out of bounds");
+  CSON_HashCache_clear(&array->hash);
+  CSON *values = (CSON *)array->data.data;
+  CSON_give(&values[index], out);
+  memmove(values + index, values + index + 1,
+          (count - index - 1) * sizeof(CSON));
+  array->data.element_count--;
 }
 
-// tokenizer
-CSON_Tokenizer *CSON_Tokenizer_new(char *cstr) {
-  CSON_Tokenizer *tokenizer = malloc(sizeof(tokenizer));
-  assert(tokenizer && "No ram?");
-  CSON_SV_init(&tokenizer->sv, cstr);
-  return tokenizer;
+void CSON_Array_swap_remove(CSON_Array *array, size_t index, CSON *out) {
+  assert(array->refcount == 1 && "attempted to modify a shared array");
+  size_t count = array->data.element_count;
+  assert(index < count && "index out of bounds");
+  CSON_HashCache_clear(&array->hash);
+  CSON *values = (CSON *)array->data.data;
+  CSON_give(&values[index], out);
+  values[index] = values[count - 1];
+  array->data.element_count--;
+}
+
+// object
+CSON CSON_Object_new(void) {
+  CSON_Object *object = malloc(sizeof(CSON_Object));
+  assert(object && "No ram?");
+  atomic_init(&object->refcount, 1);
+  CSON_HashCache_init(&object->hash);
+  object->shape = NULL;
+  atomic_init(&object->index, NULL);
+  CVec_init(&object->members, sizeof(CSON_Member), 0);
+  return (CSON){.type = CSON_OBJECT, .as.object = object};
+}
+
+// the members changed, the index is rebuilt by the next lookup
+static void CSON_Object_drop_index(CSON_Object *object) {
+  free(atomic_load_explicit(&object->index, memory_order_relaxed));
+  atomic_store_explicit(&object->index, NULL, memory_order_relaxed);
+}
+
+// Edits of members keep a built index in step instead of dropping it. They
+// only happen on unshared objects, no reader can see the slots change.
+static uint32_t CSON_member_hash(const CSON_Object *object, size_t position) {
+  return ((const CSON_Member *)object->members.data)[position].key.hash;
+}
+
+static size_t CSON_Index_slot_of(const CSON_Index *index, uint32_t hash,
+                                 size_t position) {
+  size_t slot = hash & index->mask;
+  while (index->slots[slot] != position + 1) {
+    slot = (slot + 1) & index->mask;
+  }
+  return slot;
+}
+
+// index the member just pushed at position, an index that would fill past
+// half its slots is dropped and rebuilt twice as large by the next lookup
+static void CSON_Object_index_add(CSON_Object *object, size_t position) {
+  CSON_Index *index =
+      atomic_load_explicit(&object->index, memory_order_relaxed);
+  if (!index) {
+    return;
+  }
+  if ((position + 1) * 2 > index->mask + 1) {
+    CSON_Object_drop_index(object);
+    return;
+  }
+  size_t slot = CSON_member_hash(object, position) & index->mask;
+  while (index->slots[slot] != 0) {
+    slot = (slot + 1) & index->mask;
+  }
+  index->slots[slot] = (uint32_t)position + 1;
+}
+
+// Unindex the member at position with backward shift deletion: later entries
+// of the probe run move into the hole unless their home slot lies after it,
+// so every remaining key stays reachable without tombstones.
+static void CSON_Object_index_erase(CSON_Object *object, size_t position) {
+  CSON_Index *index =
+      atomic_load_explicit(&object->index, memory_order_relaxed);
+  size_t mask = index->mask;
+  size_t hole =
+      CSON_Index_slot_of(index, CSON_member_hash(object, position), position);
+  for (size_t slot = (hole + 1) & mask; index->slots[slot] != 0;
+       slot = (slot + 1) & mask) {
+    size_t home = CSON_member_hash(object, index->slots[slot] - 1) & mask;
+    if (((slot - home) & mask) >= ((slot - hole) & mask)) {
+      index->slots[hole] = index->slots[slot];
+      hole = slot;
+    }
+  }
+  index->slots[hole] = 0;
+}
+
+// releases one reference to the object
+void CSON_Object_free(CSON_Object *object) {
+  if (!CSON_release(&object->refcount)) {
+    return;
+  }
+  CSON_Object_drop_index(object);
+  if (object->shape) {
+    CSON *values = (CSON *)object->values.data;
+    for (size_t i = 0; i < object->values.element_count; i++) {
+      CSON_clear(&values[i]);
+    }
+    CVec_free(&object->values);
+    CSON_Shape_release(object->shape);
+    free(object);
+    return;
+  }
+  CSON_Member *members = (CSON_Member *)object->members.data;
+  for (size_t i = 0; i < object->members.element_count; i++) {
+    CSON_clear(&members[i].key.string);
+    CSON_clear(&members[i].value);
+  }
+  CVec_free(&object->members);
+  free(object);
+}
+
+// give the object its own copy of its shape's keys
+static void CSON_Object_to_dictionary(CSON_Object *object) {
+  CSON_Shape *shape = object->shape;
+  CVec members;
+  CVec_init(&members, sizeof(CSON_Member), shape->count);
+  for (size_t i = 0; i < shape->count; i++) {
+    CSON_Member member = {.key = shape->keys[i],
+                          .value = ((CSON *)object->values.data)[i]};
+    member.key.string = CSON_string_copy(&member.key.string);
+    CVec_push_back(&members, &member);
+  }
+  CVec_free(&object->values);
+  object->members = members;
+  object->shape = NULL;
+  CSON_Object_drop_index(object);
+  CSON_Shape_release(shape);
+}
+
+void CSON_Object_reserve(CSON_Object *object, size_t capacity) {
+  if (object->shape) {
+    CSON_Object_to_dictionary(object);
+  }
+  CVec_reserve(&object->members, capacity);
+}
+
+static void CSON_Object_push(CSON_Object *object, CSON *key, uint32_t hash,
+                             CSON *value) {
+  CSON_HashCache_clear(&object->hash);
+  if (object->shape) {
+    CSON_Object_to_dictionary(object);
+  }
+  CSON_Member member = {.key = {.hash = hash,
+                                .len = (uint32_t)CSON_string_sv(key).len,
+                                .string = *key},
+                        .value = *value};
+  CVec_push_back(&object->members, &member);
+  CSON_Object_index_add(object, object->members.element_count - 1);
+  *key = CSON_Literal_new(CSON_NULL);
+  *value = CSON_Literal_new(CSON_NULL);
+}
+
+// moves key and value into the object, both are left null
+void CSON_Object_insert(CSON_Object *object, CSON *key, CSON *value) {
+  assert(CSON_is_string(key) && "object keys must be strings");
+  assert(object->refcount == 1 && "attempted to modify a shared object");
+  CSON_SV sv = CSON_string_sv(key);
+  CSON_Object_push(object, key, CSON_hash_string(sv.str, sv.len), value);
+}
+
+size_t CSON_Object_count(CSON_Object *object) {
+  return object->shape ? object->shape->count : object->members.element_count;
+}
+
+CSON_Key *CSON_Object_key_at(CSON_Object *object, size_t index) {
+  assert(index < CSON_Object_count(object) && "index out of bounds");
+  if (object->shape) {
+    return &object->shape->keys[index];
+  }
+  return &((CSON_Member *)object->members.data)[index].key;
+}
+
+CSON *CSON_Object_value_at(CSON_Object *object, size_t index) {
+  assert(index < CSON_Object_count(object) && "index out of bounds");
+  if (object->shape) {
+    return &((CSON *)object->values.data)[index];
+  }
+  return &((CSON_Member *)object->members.data)[index].value;
+}
+
+static bool CSON_Key_eq(const CSON_Key *key, const char *str, size_t len,
+                        uint32_t hash) {
+  if (key->len == len && len > CSON_SMALL_STRING_MAX &&
+      key->string.as.string->str == str) {
+    return true; // both sides are the same interned string
+  }
+  return key->hash == hash && key->len == len &&
+         memcmp(CSON_string_sv((CSON *)&key->string).str, str, len) == 0;
+}
+
+// keys are stride bytes apart, the CSON_Key is at the start of each element
+static const CSON_Key *CSON_key_at(const void *keys, size_t stride, size_t i) {
+  return (const CSON_Key *)((const char *)keys + i * stride);
+}
+
+static size_t CSON_keys_find(const void *keys, size_t stride, size_t count,
+                             const CSON_Index *index, const char *str,
+                             size_t len, uint32_t hash) {
+  if (index && index->slots) {
+    for (size_t slot = hash & index->mask;; slot = (slot + 1) & index->mask) {
+      uint32_t position = index->slots[slot];
+      if (position == 0) {
+        return SIZE_MAX;
+      }
+      if (CSON_Key_eq(CSON_key_at(keys, stride, position - 1), str, len,
+                      hash)) {
+        return position - 1;
+      }
+    }
+  }
+  for (size_t i = 0; i < count; i++) {
+    if (CSON_Key_eq(CSON_key_at(keys, stride, i), str, len, hash)) {
+      return i;
+    }
+  }
+  return SIZE_MAX;
+}
+
+static size_t CSON_Index_capacity(size_t count);
+static void CSON_Index_fill(CSON_Index *index, uint32_t *slots,
+                            const void *keys, size_t stride, size_t count);
+
+// Readers racing on an object without index may each build one, the first
+// compare and swap publishes its index and the others free theirs.
+static CSON_Index *CSON_Object_index(CSON_Object *object) {
+  CSON_Index *index =
+      atomic_load_explicit(&object->index, memory_order_acquire);
+  if (index) {
+    return index;
+  }
+  size_t count = object->members.element_count;
+  size_t capacity = CSON_Index_capacity(count);
+  CSON_Index *built = malloc(sizeof(CSON_Index) + capacity * sizeof(uint32_t));
+  assert(built && "No ram?");
+  uint32_t *slots = (uint32_t *)(built + 1);
+  memset(slots, 0, capacity * sizeof(uint32_t));
+  CSON_Index_fill(built, slots, object->members.data, sizeof(CSON_Member),
+                  count);
+  if (!atomic_compare_exchange_strong_explicit(&object->index, &index, built,
+                                               memory_order_acq_rel,
+                                               memory_order_acquire)) {
+    free(built);
+    return index; // published by another thread
+  }
+  return built;
+}
+
+// returns the position of the key or SIZE_MAX when it is not present
+size_t CSON_Object_find(CSON_Object *object, const char *key, size_t len,
+                        uint32_t hash) {
+  if (object->shape) {
+    CSON_Shape *shape = object->shape;
+    return CSON_keys_find(shape->keys, sizeof(CSON_Key), shape->count,
+                          &shape->index, key, len, hash);
+  }
+  size_t count = object->members.element_count;
+  const CSON_Index *index =
+      count >= CSON_INDEX_THRESHOLD ? CSON_Object_index(object) : NULL;
+  return CSON_keys_find(object->members.data, sizeof(CSON_Member), count,
+                        index, key, len, hash);
+}
+
+// Like CSON_Object_insert, but the value of an existing equal key is replaced
+// and the passed key released. A shaped object keeps its shape then.
+void CSON_Object_set(CSON_Object *object, CSON *key, CSON *value) {
+  assert(CSON_is_string(key) && "object keys must be strings");
+  assert(object->refcount == 1 && "attempted to modify a shared object");
+  CSON_SV sv = CSON_string_sv(key);
+  uint32_t hash = CSON_hash_string(sv.str, sv.len);
+  size_t i = CSON_Object_find(object, sv.str, sv.len, hash);
+  if (i == SIZE_MAX) {
+    CSON_Object_push(object, key, hash, value);
+    return;
+  }
+  CSON_HashCache_clear(&object->hash);
+  CSON *slot = CSON_Object_value_at(object, i);
+  CSON_clear(slot);
+  *slot = CSON_move(value);
+  CSON_clear(key);
+}
+
+// Moves key and value in as the member at position, the members from there
+// on move up by one, in the members and in the index.
+static void CSON_Object_insert_at(CSON_Object *object, size_t position,
+                                  CSON *key, CSON *value) {
+  CSON_Object_insert(object, key, value);
+  size_t last = CSON_Object_count(object) - 1;
+  if (position == last) {
+    return;
+  }
+  CSON_Index *lookup =
+      atomic_load_explicit(&object->index, memory_order_relaxed);
+  if (lookup) {
+    for (size_t slot = 0; slot <= lookup->mask; slot++) {
+      uint32_t entry = lookup->slots[slot];
+      if (entry == last + 1) {
+        lookup->slots[slot] = (uint32_t)position + 1;
+      } else if (entry > position) {
+        lookup->slots[slot] = entry + 1;
+      }
+    }
+  }
+  CSON_Member *members = (CSON_Member *)object->members.data;
+  CSON_Member member = members[last];
+  memmove(members + position + 1, members + position,
+          (last - position) * sizeof(CSON_Member));
+  members[position] = member;
+}
+
+// positions after index shift down by one, in the members and in the index
+void CSON_Object_remove_at(CSON_Object *object, size_t index, CSON *out) {
+  assert(object->refcount == 1 && "attempted to modify a shared object");
+  assert(index < CSON_Object_count(object) && "index out of bounds");
+  CSON_HashCache_clear(&object->hash);
+  if (object->shape) {
+    CSON_Object_to_dictionary(object);
+  }
+  CSON_Index *lookup =
+      atomic_load_explicit(&object->index, memory_order_relaxed);
+  if (lookup) {
+    CSON_Object_index_erase(object, index);
+    for (size_t slot = 0; slot <= lookup->mask; slot++) {
+      if (lookup->slots[slot] > index + 1) {
+        lookup->slots[slot]--;
+      }
+    }
+  }
+  size_t count = object->members.element_count;
+  CSON_Member *members = (CSON_Member *)object->members.data;
+  CSON_clear(&members[index].key.string);
+  CSON_give(&members[index].value, out);
+  memmove(members + index, members + index + 1,
+          (count - index - 1) * sizeof(CSON_Member));
+  object->members.element_count--;
+}
+
+// the last member takes the place of the removed one
+void CSON_Object_swap_remove_at(CSON_Object *object, size_t index,
+                                CSON *out) {
+  assert(object->refcount == 1 && "attempted to modify a shared object");
+  assert(index < CSON_Object_count(object) && "index out of bounds");
+  CSON_HashCache_clear(&object->hash);
+  if (object->shape) {
+    CSON_Object_to_dictionary(object);
+  }
+  size_t last = object->members.element_count - 1;
+  CSON_Index *lookup =
+      atomic_load_explicit(&object->index, memory_order_relaxed);
+  if (lookup) {
+    CSON_Object_index_erase(object, index);
+    if (index != last) {
+      size_t slot =
+          CSON_Index_slot_of(lookup, CSON_member_hash(object, last), last);
+      lookup->slots[slot] = (uint32_t)index + 1;
+    }
+  }
+  CSON_Member *members = (CSON_Member *)object->members.data;
+  CSON_clear(&members[index].key.string);
+  CSON_give(&members[index].value, out);
+  members[index] = members[last];
+  object->members.element_count--;
+}
+
+// removes the member with the given key keeping the order of the others,
+// CSON_ERROR when there is none
+CSON_Result CSON_Object_remove(CSON_Object *object, const char *key,
+                               CSON *out) {
+  size_t len = strlen(key);
+  size_t i = CSON_Object_find(object, key, len, CSON_hash_string(key, len));
+  if (i == SIZE_MAX) {
+    return CSON_ERROR;
+  }
+  CSON_Object_remove_at(object, i, out);
+  return CSON_SUCCES;
+}
+
+// field cache
+void CSON_FieldCache_init(CSON_FieldCache *cache, const char *key) {
+  size_t len = strlen(key);
+  *cache = (CSON_FieldCache){.key = key,
+                             .len = len,
+                             .hash = CSON_hash_string(key, len),
+                             .position = SIZE_MAX};
+}
+
+CSON *CSON_get_by_key_cached(CSON *cson, CSON_FieldCache *cache) {
+  assert(CSON_is_object(cson) &&
+         "attempted to get by key from non object type");
+  CSON_Object *object = cson->as.object;
+  if (cache->position < CSON_Object_count(object) &&
+      CSON_Key_eq(CSON_Object_key_at(object, cache->position), cache->key,
+                  cache->len, cache->hash)) {
+    return CSON_Object_value_at(object, cache->position);
+  }
+  size_t i = CSON_Object_find(object, cache->key, cache->len, cache->hash);
+  if (i == SIZE_MAX) {
+    return NULL;
+  }
+  cache->position = i;
+  return CSON_Object_value_at(object, i);
+}
+
+// subtree hashing
+// splitmix64 finalizer
+static uint64_t CSON_mix64(uint64_t h) {
+  h ^= h >> 30;
+  h *= UINT64_C(0xbf58476d1ce4e5b9);
+  h ^= h >> 27;
+  h *= UINT64_C(0x94d049bb133111eb);
+  h ^= h >> 31;
+  return h;
+}
+
+// Structural hash of a value, cached in containers. Object members are
+// combined order independently, so objects holding the same members in a
+// different order hash alike.
+static uint64_t CSON_subtree_hash(CSON *cson) {
+  switch (cson->type) {
+  case CSON_NUMBER: {
+    double d = cson->as.number == 0 ? 0 : cson->as.number; // -0 equals 0
+    uint64_t bits;
+    memcpy(&bits, &d, sizeof(bits));
+    return CSON_mix64(bits ^ CSON_NUMBER);
+  }
+  case CSON_STRING: {
+    CSON_SV sv = CSON_string_sv(cson);
+    uint64_t h = UINT64_C(14695981039346656037);
+    for (size_t i = 0; i < sv.len; i++) {
+      h = (h ^ (uint8_t)sv.str[i]) * UINT64_C(1099511628211);
+    }
+    return CSON_mix64(h ^ CSON_STRING);
+  }
+  case CSON_ARRAY: {
+    CSON_Array *array = cson->as.array;
+    uint64_t cached = CSON_HashCache_get(&array->hash);
+    if (cached) {
+      return cached;
+    }
+    CSON *values = (CSON *)array->data.data;
+    uint64_t h = CSON_mix64(array->data.element_count ^ CSON_ARRAY);
+    for (size_t i = 0; i < array->data.element_count; i++) {
+      h = CSON_mix64(h ^ CSON_subtree_hash(&values[i]));
+      CSON_HashCache_adopt(&values[i], &array->hash);
+    }
+    h = h ? h : 1;
+    CSON_HashCache_set(&array->hash, h);
+    return h;
+  }
+  case CSON_OBJECT: {
+    CSON_Object *object = cson->as.object;
+    uint64_t cached = CSON_HashCache_get(&object->hash);
+    if (cached) {
+      return cached;
+    }
+    size_t count = CSON_Object_count(object);
+    uint64_t sum = 0;
+    for (size_t i = 0; i < count; i++) {
+      CSON_Key *key = CSON_Object_key_at(object, i);
+      CSON *value = CSON_Object_value_at(object, i);
+      sum += CSON_mix64(((uint64_t)key->hash << 32 | key->len) ^
+                        CSON_subtree_hash(value));
+      CSON_HashCache_adopt(value, &object->hash);
+    }
+    uint64_t h = CSON_mix64(sum ^ CSON_mix64(count ^ CSON_OBJECT));
+    h = h ? h : 1;
+    CSON_HashCache_set(&object->hash, h);
+    return h;
+  }
+  default:
+    return CSON_mix64(cson->type + 1);
+  }
+}
+
+// Structural equality. Unless ordered is set, objects compare equal when they
+// hold the same members in any order.
+static bool CSON_subtree_eq(CSON *A, CSON *B, bool ordered) {
+  if (A->type != B->type) {
+    return false;
+  }
+  switch (A->type) {
+  case CSON_NUMBER:
+    return A->as.number == B->as.number;
+  case CSON_STRING: {
+    if (A->small_len == CSON_LARGE_STRING &&
+        B->small_len == CSON_LARGE_STRING && A->as.string == B->as.string) {
+      return true;
+    }
+    CSON_SV a = CSON_string_sv(A);
+    CSON_SV b = CSON_string_sv(B);
+    return CSON_SV_eq(&a, &b);
+  }
+  case CSON_ARRAY: {
+    CSON_Array *a = A->as.array;
+    CSON_Array *b = B->as.array;
+    if (a == b) {
+      return true;
+    }
+    uint64_t ha = CSON_HashCache_get(&a->hash);
+    uint64_t hb = CSON_HashCache_get(&b->hash);
+    if (a->data.element_count != b->data.element_count ||
+        (ha && hb && ha != hb)) {
+      return false;
+    }
+    for (size_t i = 0; i < a->data.element_count; i++) {
+      if (!CSON_subtree_eq(&((CSON *)a->data.data)[i],
+                           &((CSON *)b->data.data)[i], ordered)) {
+        return false;
+      }
+    }
+    return true;
+  }
+  case CSON_OBJECT: {
+    CSON_Object *a = A->as.object;
+    CSON_Object *b = B->as.object;
+    if (a == b) {
+      return true;
+    }
+    size_t count = CSON_Object_count(a);
+    uint64_t ha = CSON_HashCache_get(&a->hash);
+    uint64_t hb = CSON_HashCache_get(&b->hash);
+    if (count != CSON_Object_count(b) || (ha && hb && ha != hb)) {
+      return false;
+    }
+    bool same_keys = a->shape && a->shape == b->shape;
+    for (size_t i = 0; i < count; i++) {
+      size_t j = i;
+      if (!same_keys) {
+        CSON_Key *key = CSON_Object_key_at(a, i);
+        CSON_SV sv = CSON_string_sv(&key->string);
+        if (!CSON_Key_eq(CSON_Object_key_at(b, i), sv.str, sv.len,
+                         key->hash)) {
+          if (ordered) {
+            return false;
+          }
+          j = CSON_Object_find(b, sv.str, sv.len, key->hash);
+          if (j == SIZE_MAX) {
+            return false;
+          }
+        }
+      }
+      if (!CSON_subtree_eq(CSON_Object_value_at(a, i),
+                           CSON_Object_value_at(b, j), ordered)) {
+        return false;
+      }
+    }
+    return true;
+  }
+  default:
+    return true;
+  }
+}
+
+// subtree table
+void CSON_SubtreeTable_init(CSON_SubtreeTable *table) {
+  *table = (CSON_SubtreeTable){0};
+}
+
+void CSON_SubtreeTable_free(CSON_SubtreeTable *table) {
+  for (size_t i = 0; i < table->capacity; i++) {
+    if (table->slots[i].as.array) {
+      CSON_clear(&table->slots[i]);
+    }
+  }
+  free(table->slots);
+  *table = (CSON_SubtreeTable){0};
+}
+
+static void CSON_SubtreeTable_place(CSON *slots, size_t capacity,
+                                    CSON *value) {
+  size_t slot = CSON_subtree_hash(value) & (capacity - 1);
+  while (slots[slot].as.array) {
+    slot = (slot + 1) & (capacity - 1);
+  }
+  slots[slot] = *value;
+}
+
+// Replace the container in value by an identical one from table, or add it to
+// table when there is none. Children are expected to be interned already, so
+// comparing two candidates mostly compares child pointers.
+void CSON_SubtreeTable_intern(CSON_SubtreeTable *table, CSON *value) {
+  assert(CSON_is_container(value) && "only containers can be interned");
+  uint64_t hash = CSON_subtree_hash(value);
+  if (table->capacity > 0) {
+    for (size_t slot = hash & (table->capacity - 1);
+         table->slots[slot].as.array;
+         slot = (slot + 1) & (table->capacity - 1)) {
+      CSON *existing = &table->slots[slot];
+      if (CSON_subtree_hash(existing) == hash &&
+          CSON_subtree_eq(existing, value, true)) {
+        CSON_clear(value);
+        *value = *existing;
+        CSON_share_container(value);
+        return;
+      }
+    }
+  }
+
+  if ((table->count + 1) * 2 > table->capacity) {
+    size_t capacity = table->capacity ? table->capacity * 2 : 64;
+    CSON *slots = calloc(capacity, sizeof(CSON));
+    assert(slots && "No ram?");
+    for (size_t i = 0; i < table->capacity; i++) {
+      if (table->slots[i].as.array) {
+        CSON_SubtreeTable_place(slots, capacity, &table->slots[i]);
+      }
+    }
+    free(table->slots);
+    table->slots = slots;
+    table->capacity = capacity;
+  }
+  CSON_SubtreeTable_place(table->slots, table->capacity, value);
+  table->count++;
+  CSON_share_container(value); // the table keeps its own reference
+}
+
+// key set
+// the seeded hash picks the bucket, count must be non zero
+static uint64_t CSON_KeySet_mix(const CSON_KeySet *keyset, uint32_t hash) {
+  return CSON_mix64(hash ^ keyset->seed);
+}
+
+// the displacement picks a slot per bucket, slots are taken modulo count
+static size_t CSON_KeySet_slot(const CSON_KeySet *keyset, uint64_t mixed,
+                               uint32_t displacement) {
+  return CSON_mix64(mixed + displacement) % keyset->count;
+}
+
+// Places the chain heads for the current seed, the largest buckets first.
+// Each bucket tries a number of displacements proportional to the key count,
+// enough for the last single key buckets to find one of few free slots.
+static bool CSON_KeySet_place(CSON_KeySet *keyset, const bool *chained,
+                              uint64_t *mixed, size_t *order, size_t *sizes,
+                              size_t *members, bool *taken) {
+  size_t n = keyset->count;
+  uint64_t limit = (uint64_t)n * 16 + 1024;
+  if (limit > UINT32_MAX) {
+    limit = UINT32_MAX;
+  }
+  memset(sizes, 0, keyset->bucket_count * sizeof(size_t));
+  memset(taken, 0, n * sizeof(bool));
+  for (size_t i = 0; i < n; i++) {
+    keyset->slots[i] = UINT32_MAX;
+    mixed[i] = CSON_KeySet_mix(keyset, keyset->entries[i].hash);
+    if (!chained[i]) {
+      sizes[mixed[i] % keyset->bucket_count]++;
+    }
+  }
+  for (size_t b = 0; b < keyset->bucket_count; b++) {
+    size_t i = b;
+    for (; i > 0 && sizes[order[i - 1]] < sizes[b]; i--) {
+      order[i] = order[i - 1];
+    }
+    order[i] = b;
+  }
+
+  for (size_t o = 0; o < keyset->bucket_count && sizes[order[o]]; o++) {
+    size_t bucket = order[o];
+    size_t count = 0;
+    for (size_t i = 0; i < n; i++) {
+      if (!chained[i] && mixed[i] % keyset->bucket_count == bucket) {
+        members[count++] = i;
+      }
+    }
+    uint32_t d = 0;
+    for (; d < limit; d++) {
+      size_t placed = 0;
+      for (; placed < count; placed++) {
+        size_t slot = CSON_KeySet_slot(keyset, mixed[members[placed]], d);
+        if (taken[slot]) {
+          break;
+        }
+        taken[slot] = true;
+      }
+      if (placed == count) {
+        break;
+      }
+      while (placed--) { // undo the partial placement
+        taken[CSON_KeySet_slot(keyset, mixed[members[placed]], d)] = false;
+      }
+    }
+    if (d == limit) {
+      return false;
+    }
+    keyset->displacements[bucket] = d;
+    for (size_t i = 0; i < count; i++) {
+      keyset->slots[CSON_KeySet_slot(keyset, mixed[members[i]], d)] =
+          (uint32_t)members[i];
+    }
+  }
+  return true;
+}
+
+// Hash and displace: keys are grouped into buckets, then the largest buckets
+// first search for a displacement that sends all of their keys to free
+// slots. Keys sharing a hash are chained behind the first of them and placed
+// as one. Returns NULL for duplicate keys or when no seed places every key.
+CSON_KeySet *CSON_KeySet_compile(const char **keys, size_t n) {
+  if (n >= UINT32_MAX) {
+    return NULL; // entries are indexed with 32 bits
+  }
+  CSON_KeySet *keyset =
+      malloc(sizeof(CSON_KeySet) + n * sizeof(CSON_KeySetEntry));
+  bool *chained = calloc(n ? n : 1, sizeof(bool));
+  assert(keyset && chained && "No ram?");
+  *keyset = (CSON_KeySet){.count = n, .bucket_count = n / 2 + 1};
+  for (size_t i = 0; i < n; i++) {
+    size_t len = strlen(keys[i]);
+    keyset->entries[i] =
+        (CSON_KeySetEntry){.key = keys[i],
+                           .len = (uint32_t)len,
+                           .hash = CSON_hash_string(keys[i], len),
+                           .next = UINT32_MAX};
+    for (size_t j = 0; j < i; j++) {
+      CSON_KeySetEntry *entry = &keyset->entries[j];
+      if (entry->hash != keyset->entries[i].hash) {
+        continue;
+      }
+      if (entry->len == len && memcmp(entry->key, keys[i], len) == 0) {
+        free(chained);
+        free(keyset);
+        return NULL;
+      }
+      if (!chained[i] && entry->next == UINT32_MAX) {
+        entry->next = (uint32_t)i; // append to the chain of this hash
+        chained[i] = true;
+      }
+    }
+  }
+  keyset->displacements = calloc(keyset->bucket_count, sizeof(uint32_t));
+  keyset->slots = malloc((n ? n : 1) * sizeof(uint32_t));
+  size_t *order = malloc(keyset->bucket_count * sizeof(size_t));
+  size_t *sizes = malloc(keyset->bucket_count * sizeof(size_t));
+  size_t *members = malloc((n ? n : 1) * sizeof(size_t));
+  uint64_t *mixed = malloc((n ? n : 1) * sizeof(uint64_t));
+  bool *taken = malloc((n ? n : 1) * sizeof(bool));
+  assert(keyset->displacements && keyset->slots && order && sizes &&
+         members && mixed && taken && "No ram?");
+
+  bool ok = false;
+  for (uint64_t attempt = 0; !ok && attempt < CSON_KEYSET_MAX_SEEDS;
+       attempt++) {
+    keyset->seed = CSON_mix64(attempt);
+    ok = CSON_KeySet_place(keyset, chained, mixed, order, sizes, members,
+                           taken);
+  }
+  free(chained);
+  free(mixed);
+  free(order);
+  free(sizes);
+  free(members);
+  free(taken);
+  if (!ok) {
+    CSON_KeySet_free(keyset);
+    return NULL;
+  }
+  return keyset;
+}
+
+void CSON_KeySet_free(CSON_KeySet *keyset) {
+  if (!keyset) {
+    return;
+  }
+  free(keyset->displacements);
+  free(keyset->slots);
+  free(keyset);
+}
+
+// returns the key set index of key or SIZE_MAX when it is not in the set
+size_t CSON_KeySet_lookup(const CSON_KeySet *keyset, const CSON_Key *key) {
+  if (keyset->count == 0) {
+    return SIZE_MAX;
+  }
+  uint64_t mixed = CSON_KeySet_mix(keyset, key->hash);
+  uint32_t d = keyset->displacements[mixed % keyset->bucket_count];
+  uint32_t i = keyset->slots[CSON_KeySet_slot(keyset, mixed, d)];
+  for (; i != UINT32_MAX; i = keyset->entries[i].next) {
+    const CSON_KeySetEntry *entry = &keyset->entries[i];
+    if (CSON_Key_eq(key, entry->key, entry->len, entry->hash)) {
+      return i;
+    }
+  }
+  return SIZE_MAX;
+}
+
+// Objects written with the key set's order hit on the first compare, others
+// fall back to a lookup with the precomputed hash.
+CSON *CSON_get_by_keyset(CSON *cson, const CSON_KeySet *keyset, size_t idx) {
+  assert(CSON_is_object(cson) &&
+         "attempted to get by key from non object type");
+  assert(idx < keyset->count && "index out of bounds");
+  CSON_Object *object = cson->as.object;
+  const CSON_KeySetEntry *entry = &keyset->entries[idx];
+  if (idx < CSON_Object_count(object) &&
+      CSON_Key_eq(CSON_Object_key_at(object, idx), entry->key, entry->len,
+                  entry->hash)) {
+    return CSON_Object_value_at(object, idx);
+  }
+  size_t i = CSON_Object_find(object, entry->key, entry->len, entry->hash);
+  return i == SIZE_MAX ? NULL : CSON_Object_value_at(object, i);
+}
+
+// Fills out[i] with the value of the i-th key of the set, or NULL when the
+// object lacks it, in one pass over the members. Returns the number found.
+size_t CSON_extract(CSON *cson, const CSON_KeySet *keyset, CSON **out) {
+  assert(CSON_is_object(cson) &&
+         "attempted to get by key from non object type");
+  CSON_Object *object = cson->as.object;
+  for (size_t i = 0; i < keyset->count; i++) {
+    out[i] = NULL;
+  }
+  size_t found = 0;
+  size_t count = CSON_Object_count(object);
+  for (size_t i = 0; i < count; i++) {
+    size_t idx = CSON_KeySet_lookup(keyset, CSON_Object_key_at(object, i));
+    if (idx != SIZE_MAX && !out[idx]) { // the first of duplicate keys wins
+      out[idx] = CSON_Object_value_at(object, i);
+      found++;
+    }
+  }
+  return found;
+}
+
+// Fills out[i] with the value of keys[i], or NULL when it is missing, walking
+// the members once. The wanted keys go into a small open addressing table
+// keyed by their hash, so each member costs one probe sequence instead of a
+// scan over all keys. Entries pack length and hash into one word that is
+// compared before the bytes. Returns the number found.
+size_t CSON_get_many(CSON *cson, const char **keys, size_t n, CSON **out) {
+  assert(CSON_is_object(cson) &&
+         "attempted to get by key from non object type");
+  CSON_Object *object = cson->as.object;
+  size_t capacity = 64;
+  while (capacity < n * 2) {
+    capacity *= 2;
+  }
+  size_t mask = capacity - 1;
+  uint64_t local_words[32];
+  uint32_t local_slots[64]; // key index + 1, zero when empty
+  uint64_t *words = n <= 32 ? local_words : malloc(n * sizeof(uint64_t));
+  uint32_t *slots = capacity == 64 ? local_slots
+                                   : malloc(capacity * sizeof(uint32_t));
+  assert(words && slots && "No ram?");
+  memset(slots, 0, capacity * sizeof(uint32_t));
+  for (size_t j = 0; j < n; j++) {
+    size_t len = strlen(keys[j]);
+    uint32_t hash = CSON_hash_string(keys[j], len);
+    words[j] = (uint64_t)len << 32 | hash;
+    out[j] = NULL;
+    size_t slot = hash & mask;
+    while (slots[slot] != 0) {
+      slot = (slot + 1) & mask;
+    }
+    slots[slot] = (uint32_t)j + 1;
+  }
+  size_t found = 0;
+  size_t count = CSON_Object_count(object);
+  for (size_t i = 0; i < count && found < n; i++) {
+    CSON_Key *key = CSON_Object_key_at(object, i);
+    uint64_t word = (uint64_t)key->len << 32 | key->hash;
+    // keep probing after a hit, the same key may be wanted more than once
+    for (size_t slot = key->hash & mask; slots[slot] != 0;
+         slot = (slot + 1) & mask) {
+      size_t j = slots[slot] - 1;
+      if (words[j] == word && !out[j] &&
+          memcmp(CSON_string_sv(&key->string).str, keys[j], key->len) == 0) {
+        out[j] = CSON_Object_value_at(object, i);
+        found++;
+      }
+    }
+  }
+  if (words != local_words) {
+    free(words);
+  }
+  if (slots != local_slots) {
+    free(slots);
+  }
+  return found;
+}
+
+// index
+// number of slots for count keys, zero below CSON_INDEX_THRESHOLD
+static size_t CSON_Index_capacity(size_t count) {
+  if (count < CSON_INDEX_THRESHOLD) {
+    return 0;
+  }
+  size_t capacity = 16;
+  while (capacity < count * 2) {
+    capacity *= 2;
+  }
+  return capacity;
+}
+
+// fills zeroed slots of CSON_Index_capacity(count) entries
+static void CSON_Index_fill(CSON_Index *index, uint32_t *slots,
+                            const void *keys, size_t stride, size_t count) {
+  *index = (CSON_Index){0};
+  size_t capacity = CSON_Index_capacity(count);
+  if (capacity == 0) {
+    return;
+  }
+  index->slots = slots;
+  index->mask = capacity - 1;
+  for (size_t i = 0; i < count; i++) {
+    size_t slot = CSON_key_at(keys, stride, i)->hash & index->mask;
+    while (index->slots[slot] != 0) {
+      slot = (slot + 1) & index->mask;
+    }
+    index->slots[slot] = (uint32_t)i + 1;
+  }
+}
+
+static void CSON_Index_build(CSON_Index *index, const void *keys,
+                             size_t stride, size_t count) {
+  size_t capacity = CSON_Index_capacity(count);
+  uint32_t *slots = capacity ? calloc(capacity, sizeof(uint32_t)) : NULL;
+  assert((slots || capacity == 0) && "No ram?");
+  CSON_Index_fill(index, slots, keys, stride, count);
+}
+
+// shapes
+static uint32_t CSON_shape_hash(const void *keys, size_t stride,
+                                size_t count) {
+  uint32_t hash = 2166136261u ^ (uint32_t)count;
+  for (size_t i = 0; i < count; i++) {
+    hash = (hash ^ CSON_key_at(keys, stride, i)->hash) * 16777619u;
+  }
+  return hash;
+}
+
+static bool CSON_Shape_matches(const CSON_Shape *shape, uint32_t hash,
+                               const void *keys, size_t stride, size_t count) {
+  if (shape->hash != hash || shape->count != count) {
+    return false;
+  }
+  for (size_t i = 0; i < count; i++) {
+    const CSON_Key *key = CSON_key_at(keys, stride, i);
+    if (!CSON_Key_eq(&shape->keys[i],
+                     CSON_string_sv((CSON *)&key->string).str, key->len,
+                     key->hash)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+void CSON_Shape_release(CSON_Shape *shape) {
+  if (!CSON_release(&shape->refcount)) {
+    return;
+  }
+  for (size_t i = 0; i < shape->count; i++) {
+    CSON_clear(&shape->keys[i].string);
+  }
+  free(shape->index.slots);
+  free(shape);
+}
+
+void CSON_ShapeTable_init(CSON_ShapeTable *table) {
+  *table = (CSON_ShapeTable){0};
+}
+
+void CSON_ShapeTable_free(CSON_ShapeTable *table) {
+  for (size_t i = 0; i < table->capacity; i++) {
+    if (table->slots[i]) {
+      CSON_Shape_release(table->slots[i]);
+    }
+  }
+  free(table->slots);
+  *table = (CSON_ShapeTable){0};
+}
+
+static void CSON_ShapeTable_place(CSON_Shape **slots, size_t capacity,
+                                  CSON_Shape *shape) {
+  size_t slot = shape->hash & (capacity - 1);
+  while (slots[slot]) {
+    slot = (slot + 1) & (capacity - 1);
+  }
+  slots[slot] = shape;
+}
+
+static void CSON_ShapeTable_add(CSON_ShapeTable *table, CSON_Shape *shape) {
+  if ((table->count + 1) * 2 > table->capacity) {
+    size_t capacity = table->capacity ? table->capacity * 2 : 16;
+    CSON_Shape **slots = calloc(capacity, sizeof(CSON_Shape *));
+    assert(slots && "No ram?");
+    for (size_t i = 0; i < table->capacity; i++) {
+      if (table->slots[i]) {
+        CSON_ShapeTable_place(slots, capacity, table->slots[i]);
+      }
+    }
+    free(table->slots);
+    table->slots = slots;
+    table->capacity = capacity;
+  }
+  CSON_ShapeTable_place(table->slots, table->capacity, shape);
+  table->count++;
+  CSON_retain(&shape->refcount); // the table keeps its own reference
+}
+
+// Replace the object's own keys by a shared shape from table. The first
+// object with a given key sequence donates its keys to the new shape.
+void CSON_Object_intern_shape(CSON_Object *object, CSON_ShapeTable *table) {
+  if (object->shape) {
+    return;
+  }
+  size_t count = object->members.element_count;
+  CSON_Member *members = (CSON_Member *)object->members.data;
+  uint32_t hash = CSON_shape_hash(members, sizeof(CSON_Member), count);
+
+  CSON_Shape *shape = NULL;
+  if (table->capacity > 0) {
+    for (size_t slot = hash & (table->capacity - 1); table->slots[slot];
+         slot = (slot + 1) & (table->capacity - 1)) {
+      if (CSON_Shape_matches(table->slots[slot], hash, members,
+                             sizeof(CSON_Member), count)) {
+        shape = table->slots[slot];
+        break;
+      }
+    }
+  }
+
+  if (shape) {
+    CSON_retain(&shape->refcount);
+    for (size_t i = 0; i < count; i++) {
+      CSON_clear(&members[i].key.string);
+    }
+  } else {
+    shape = malloc(sizeof(CSON_Shape) + count * sizeof(CSON_Key));
+    assert(shape && "No ram?");
+    atomic_init(&shape->refcount, 1);
+    shape->hash = hash;
+    shape->count = count;
+    for (size_t i = 0; i < count; i++) {
+      shape->keys[i] = members[i].key;
+    }
+    CSON_Index_build(&shape->index, shape->keys, sizeof(CSON_Key), count);
+    CSON_ShapeTable_add(table, shape);
+  }
+
+  CVec values;
+  CVec_init(&values, sizeof(CSON), count);
+  for (size_t i = 0; i < count; i++) {
+    CVec_push_back(&values, &members[i].value);
+  }
+  CVec_free(&object->members);
+  CSON_Object_drop_index(object);
+  object->values = values;
+  object->shape = shape;
+}
+
+// frozen documents
+#define CSON_FREEZE_ALIGN 16
+
+static size_t CSON_freeze_align(size_t size) {
+  return (size + CSON_FREEZE_ALIGN - 1) & ~(size_t)(CSON_FREEZE_ALIGN - 1);
+}
+
+// bytes the value's payload takes in a frozen block
+static size_t CSON_frozen_size(CSON *value) {
+  switch (value->type) {
+  case CSON_STRING:
+    if (value->small_len != CSON_LARGE_STRING) {
+      return 0;
+    }
+    return CSON_freeze_align(sizeof(CSON_String) + value->as.string->len + 1);
+  case CSON_ARRAY: {
+    CVec *data = &value->as.array->data;
+    size_t size = CSON_freeze_align(sizeof(CSON_Array)) +
+                  CSON_freeze_align(data->element_count * sizeof(CSON));
+    for (size_t i = 0; i < data->element_count; i++) {
+      size += CSON_frozen_size((CSON *)data->data + i);
+    }
+    return size;
+  }
+  case CSON_OBJECT: {
+    CSON_Object *object = value->as.object;
+    size_t count = CSON_Object_count(object);
+    size_t size =
+        CSON_freeze_align(sizeof(CSON_Object)) +
+        CSON_freeze_align(sizeof(CSON_Shape) + count * sizeof(CSON_Key)) +
+        CSON_freeze_align(CSON_Index_capacity(count) * sizeof(uint32_t)) +
+        CSON_freeze_align(count * sizeof(CSON));
+    for (size_t i = 0; i < count; i++) {
+      size += CSON_frozen_size(&CSON_Object_key_at(object, i)->string);
+      size += CSON_frozen_size(CSON_Object_value_at(object, i));
+    }
+    return size;
+  }
+  default:
+    return 0;
+  }
+}
+
+static void *CSON_freeze_take(char **cursor, size_t size) {
+  void *p = *cursor;
+  *cursor += CSON_freeze_align(size);
+  return p;
+}
+
+static CSON CSON_freeze_value(CSON *value, char **cursor) {
+  CSON copy = *value;
+  switch (value->type) {
+  case CSON_STRING:
+    if (value->small_len == CSON_LARGE_STRING) {
+      size_t len = value->as.string->len;
+      CSON_String *string =
+          CSON_freeze_take(cursor, sizeof(CSON_String) + len + 1);
+      memcpy(string, value->as.string, sizeof(CSON_String) + len + 1);
+      atomic_init(&string->refcount, CSON_REFCOUNT_FROZEN);
+      copy.as.string = string;
+    }
+    break;
+  case CSON_ARRAY: {
+    CSON_Array *array = CSON_freeze_take(cursor, sizeof(CSON_Array));
+    size_t count = value->as.array->data.element_count;
+    CSON *values = CSON_freeze_take(cursor, count * sizeof(CSON));
+    atomic_init(&array->refcount, CSON_REFCOUNT_FROZEN);
+    CSON_HashCache_init(&array->hash);
+    CSON_HashCache_set(&array->hash,
+                       CSON_HashCache_get(&value->as.array->hash));
+    array->data = (CVec){.element_count = count,
+                         .element_size = sizeof(CSON),
+                         .data = count ? (char *)values : NULL,
+                         .element_capacity = count};
+    for (size_t i = 0; i < count; i++) {
+      values[i] =
+          CSON_freeze_value((CSON *)value->as.array->data.data + i, cursor);
+    }
+    copy.as.array = array;
+  } break;
+  case CSON_OBJECT: {
+    CSON_Object *source = value->as.object;
+    size_t count = CSON_Object_count(source);
+    CSON_Object *object = CSON_freeze_take(cursor, sizeof(CSON_Object));
+    CSON_Shape *shape =
+        CSON_freeze_take(cursor, sizeof(CSON_Shape) + count * sizeof(CSON_Key));
+    size_t capacity = CSON_Index_capacity(count);
+    uint32_t *slots = CSON_freeze_take(cursor, capacity * sizeof(uint32_t));
+    CSON *values = CSON_freeze_take(cursor, count * sizeof(CSON));
+    for (size_t i = 0; i < count; i++) {
+      shape->keys[i] = *CSON_Object_key_at(source, i);
+      shape->keys[i].string =
+          CSON_freeze_value(&shape->keys[i].string, cursor);
+      values[i] = CSON_freeze_value(CSON_Object_value_at(source, i), cursor);
+    }
+    atomic_init(&shape->refcount, CSON_REFCOUNT_FROZEN);
+    shape->count = count;
+    shape->hash = CSON_shape_hash(shape->keys, sizeof(CSON_Key), count);
+    memset(slots, 0, capacity * sizeof(uint32_t));
+    CSON_Index_fill(&shape->index, slots, shape->keys, sizeof(CSON_Key),
+                    count);
+    atomic_init(&object->refcount, CSON_REFCOUNT_FROZEN);
+    CSON_HashCache_init(&object->hash);
+    CSON_HashCache_set(&object->hash,
+                       CSON_HashCache_get(&source->hash));
+    object->shape = shape;
+    atomic_init(&object->index, NULL);
+    object->values = (CVec){.element_count = count,
+                            .element_size = sizeof(CSON),
+                            .data = count ? (char *)values : NULL,
+                            .element_capacity = count};
+    copy.as.object = object;
+  } break;
+  default:
+    break;
+  }
+  return copy;
+}
+
+// The root value sits at the start of the block, so freeing the root frees
+// the block.
+CSON *CSON_freeze(CSON *root) {
+  size_t size = CSON_freeze_align(sizeof(CSON)) + CSON_frozen_size(root);
+  char *block = malloc(size);
+  assert(block && "No ram?");
+  char *cursor = block + CSON_freeze_align(sizeof(CSON));
+  CSON *frozen = (CSON *)block;
+  *frozen = CSON_freeze_value(root, &cursor);
+  assert(cursor == block + size && "frozen size mismatch");
+  CSON_free(root);
+  return frozen;
+}
+
+// arenas
+struct CSON_ArenaBlock {
+  CSON_ArenaBlock *next;
+  size_t size;
+  size_t used;
+  _Alignas(CSON_FREEZE_ALIGN) char data[];
+};
+
+void CSON_Arena_init(CSON_Arena *arena, size_t block_size) {
+  *arena = (CSON_Arena){.block_size = block_size};
+}
+
+// allocations are aligned like the nodes of frozen documents
+void *CSON_Arena_alloc(CSON_Arena *arena, size_t size) {
+  size = CSON_freeze_align(size);
+  CSON_ArenaBlock *block = arena->blocks;
+  if (!block || block->size - block->used < size) {
+    size_t block_size =
+        arena->block_size ? arena->block_size : CSON_ARENA_BLOCK_SIZE;
+    block_size = size > block_size ? size : block_size;
+    block = malloc(sizeof(CSON_ArenaBlock) + block_size);
+    assert(block && "No ram?");
+    block->next = arena->blocks;
+    block->size = block_size;
+    block->used = 0;
+    arena->blocks = block;
+  }
+  void *p = block->data + block->used;
+  block->used += size;
+  return p;
+}
+
+void CSON_Arena_reset(CSON_Arena *arena) {
+  CSON_ArenaBlock *block = arena->blocks;
+  if (!block) {
+    return;
+  }
+  CSON_ArenaBlock *next = block->next;
+  while (next) {
+    CSON_ArenaBlock *after = next->next;
+    free(next);
+    next = after;
+  }
+  block->next = NULL;
+  block->used = 0;
+}
+
+void CSON_Arena_free(CSON_Arena *arena) {
+  CSON_Arena_reset(arena);
+  free(arena->blocks);
+  arena->blocks = NULL;
+}
+
+// cloning
+// A copy of value owning its own payload: heap strings are duplicated rather
+// than shared, so cloning never writes to the source, not even a reference
+// count. Containers come back empty with room for exactly their children,
+// which the caller fills in, and take over a current cached hash.
+static CSON CSON_clone_node(CSON *value) {
+  switch (value->type) {
+  case CSON_STRING:
+    return value->small_len == CSON_LARGE_STRING
+               ? CSON_String_from_sv(CSON_string_sv(value))
+               : *value;
+  case CSON_ARRAY: {
+    CSON_Array *array = value->as.array;
+    CSON copy = CSON_Array_new();
+    CVec_reserve(&copy.as.array->data, array->data.element_count);
+    CSON_HashCache_set(&copy.as.array->hash,
+                       CSON_HashCache_get(&array->hash));
+    return copy;
+  }
+  case CSON_OBJECT: {
+    CSON_Object *object = value->as.object;
+    CSON copy = CSON_Object_new();
+    CVec_reserve(&copy.as.object->members, CSON_Object_count(object));
+    CSON_HashCache_set(&copy.as.object->hash,
+                       CSON_HashCache_get(&object->hash));
+    return copy;
+  }
+  default:
+    return *value;
+  }
+}
+
+// a source container and its copy waiting to be filled in
+typedef struct {
+  CSON *source;
+  CSON *target;
+} CSON_CloneTask;
+
+// Children are written straight into the exactly sized storage of their
+// copied container, which never grows, so pending tasks may point into it.
+static CSON *CSON_clone_heap(CSON *root) {
+  CSON *copy = CSON_root_new(CSON_clone_node(root));
+  CVec tasks;
+  CVec_init(&tasks, sizeof(CSON_CloneTask), 0);
+  CSON_CloneTask task = {.source = root, .target = copy};
+  if (CSON_is_container(root)) {
+    CVec_push_back(&tasks, &task);
+  }
+  while (CVec_pop_back(&tasks, &task)) {
+    if (CSON_is_array(task.source)) {
+      CVec *from = &task.source->as.array->data;
+      CVec *to = &task.target->as.array->data;
+      CSON *values = (CSON *)to->data;
+      for (size_t i = 0; i < from->element_count; i++) {
+        CSON *child = (CSON *)from->data + i;
+        values[i] = CSON_clone_node(child);
+        CSON_HashCache_adopt(&values[i], &task.target->as.array->hash);
+        if (CSON_is_container(child)) {
+          CSON_CloneTask next = {.source = child, .target = &values[i]};
+          CVec_push_back(&tasks, &next);
+        }
+      }
+      to->element_count = from->element_count;
+      continue;
+    }
+    CSON_Object *from = task.source->as.object;
+    CVec *to = &task.target->as.object->members;
+    CSON_Member *members = (CSON_Member *)to->data;
+    for (size_t i = 0; i < CSON_Object_count(from); i++) {
+      CSON *child = CSON_Object_value_at(from, i);
+      members[i].key = *CSON_Object_key_at(from, i);
+      members[i].key.string = CSON_clone_node(&members[i].key.string);
+      members[i].value = CSON_clone_node(child);
+      CSON_HashCache_adopt(&members[i].value, &task.target->as.object->hash);
+      if (CSON_is_container(child)) {
+        CSON_CloneTask next = {.source = child, .target = &members[i].value};
+        CVec_push_back(&tasks, &next);
+      }
+    }
+    to->element_count = CSON_Object_count(from);
+  }
+  CVec_free(&tasks);
+  return copy;
+}
+
+// the address in the copy at to of p, which points into the block at from
+static void *CSON_shift(void *p, const char *from, char *to) {
+  return to + ((char *)p - from);
+}
+
+// Move the payload pointers of a frozen subtree copied from from to to. Every
+// node of a frozen subtree, including the shapes and index slots of its
+// objects, lies in its block, so every pointer moves. The atomics were copied
+// as plain bytes and are initialized again, hashes are taken over from the
+// source nodes.
+static void CSON_relocate(CSON *root, const char *from, char *to) {
+  CVec pending;
+  CVec_init(&pending, sizeof(CSON *), 0);
+  CVec_push_back(&pending, &root);
+  CSON *value;
+  while (CVec_pop_back(&pending, &value)) {
+    switch (value->type) {
+    case CSON_STRING:
+      if (value->small_len == CSON_LARGE_STRING) {
+        value->as.string = CSON_shift(value->as.string, from, to);
+        atomic_init(&value->as.string->refcount, CSON_REFCOUNT_FROZEN);
+      }
+      break;
+    case CSON_ARRAY: {
+      CSON_Array *source = value->as.array;
+      CSON_Array *array = CSON_shift(source, from, to);
+      value->as.array = array;
+      atomic_init(&array->refcount, CSON_REFCOUNT_FROZEN);
+      CSON_HashCache_init(&array->hash);
+      CSON_HashCache_set(&array->hash, CSON_HashCache_get(&source->hash));
+      if (array->data.data) { // NULL when empty
+        array->data.data = CSON_shift(array->data.data, from, to);
+      }
+      for (size_t i = 0; i < array->data.element_count; i++) {
+        CSON *child = (CSON *)array->data.data + i;
+        CVec_push_back(&pending, &child);
+      }
+    } break;
+    case CSON_OBJECT: {
+      CSON_Object *source = value->as.object;
+      CSON_Object *object = CSON_shift(source, from, to);
+      value->as.object = object;
+      atomic_init(&object->refcount, CSON_REFCOUNT_FROZEN);
+      CSON_HashCache_init(&object->hash);
+      CSON_HashCache_set(&object->hash, CSON_HashCache_get(&source->hash));
+      atomic_init(&object->index, NULL);
+      object->shape = CSON_shift(object->shape, from, to);
+      if (object->values.data) {
+        object->values.data = CSON_shift(object->values.data, from, to);
+      }
+      CSON_Shape *shape = object->shape;
+      atomic_init(&shape->refcount, CSON_REFCOUNT_FROZEN);
+      if (shape->index.slots) { // NULL below CSON_INDEX_THRESHOLD keys
+        shape->index.slots = CSON_shift(shape->index.slots, from, to);
+      }
+      for (size_t i = 0; i < shape->count; i++) {
+        CSON *key = &shape->keys[i].string;
+        CSON *child = (CSON *)object->values.data + i;
+        CVec_push_back(&pending, &key);
+        CVec_push_back(&pending, &child);
+      }
+    } break;
+    default:
+      break;
+    }
+  }
+  CVec_free(&pending);
+}
+
+// A frozen subtree is laid out depth first from its payload on, so copying
+// it is one memcpy followed by moving its pointers.
+static CSON *CSON_clone_arena(CSON *root, CSON_Arena *arena) {
+  size_t size = CSON_frozen_size(root);
+  char *block = CSON_Arena_alloc(arena, CSON_freeze_align(sizeof(CSON)) + size);
+  char *cursor = block + CSON_freeze_align(sizeof(CSON));
+  CSON *copy = (CSON *)block;
+  if (!CSON_is_frozen(root)) {
+    *copy = CSON_freeze_value(root, &cursor);
+    assert(cursor == (char *)copy + CSON_freeze_align(sizeof(CSON)) + size &&
+           "frozen size mismatch");
+    return copy;
+  }
+  char *payload = root->type == CSON_STRING  ? (char *)root->as.string
+                  : root->type == CSON_ARRAY ? (char *)root->as.array
+                                             : (char *)root->as.object;
+  memcpy(cursor, payload, size);
+  *copy = *root;
+  CSON_relocate(copy, payload, cursor);
+  return copy;
+}
+
+CSON *CSON_clone(CSON *root, CSON_Arena *arena) {
+  return arena ? CSON_clone_arena(root, arena) : CSON_clone_heap(root);
+}
+
+// persistent updates
+// a copy of value holding its own reference to the payload
+static CSON CSON_share(CSON *value) {
+  switch (value->type) {
+  case CSON_STRING:
+    return CSON_string_copy(value);
+  case CSON_ARRAY:
+  case CSON_OBJECT:
+    CSON_share_container(value);
+    break;
+  default:
+    break;
+  }
+  return *value;
+}
+
+// index may equal the element count to append
+static CSON CSON_Array_with(CSON_Array *array, size_t index, CSON *value) {
+  size_t count = array->data.element_count;
+  CSON copy = CSON_Array_new();
+  CSON_Array_reserve(copy.as.array, index == count ? count + 1 : count);
+  for (size_t i = 0; i < count; i++) {
+    CSON element =
+        i == index ? *value : CSON_share((CSON *)array->data.data + i);
+    CVec_push_back(&copy.as.array->data, &element);
+  }
+  if (index == count) {
+    CVec_push_back(&copy.as.array->data, value);
+  }
+  *value = CSON_Literal_new(CSON_NULL);
+  return copy;
+}
+
+// A replaced member keeps the shape of a shaped object, adding a member
+// gives the copy its own keys.
+static CSON CSON_Object_with(CSON_Object *object, const char *key, size_t len,
+                             uint32_t hash, CSON *value) {
+  size_t count = CSON_Object_count(object);
+  size_t position = CSON_Object_find(object, key, len, hash);
+  CSON copy = CSON_Object_new();
+  CSON_Object *target = copy.as.object;
+  if (object->shape && position != SIZE_MAX) {
+    CSON_retain(&object->shape->refcount);
+    target->shape = object->shape;
+    CVec_init(&target->values, sizeof(CSON), count);
+    for (size_t i = 0; i < count; i++) {
+      CSON element =
+          i == position ? *value : CSON_share(CSON_Object_value_at(object, i));
+      CVec_push_back(&target->values, &element);
+    }
+  } else {
+    CVec_reserve(&target->members, count + (position == SIZE_MAX));
+    for (size_t i = 0; i < count; i++) {
+      CSON_Member member = {.key = *CSON_Object_key_at(object, i)};
+      member.key.string = CSON_string_copy(&member.key.string);
+      member.value =
+          i == position ? *value : CSON_share(CSON_Object_value_at(object, i));
+      CVec_push_back(&target->members, &member);
+    }
+    if (position == SIZE_MAX) {
+      CSON_Member member = {
+          .key = {.hash = hash,
+                  .len = (uint32_t)len,
+                  .string = CSON_String_from_sv(
+                      (CSON_SV){.str = (char *)key, .len = len})},
+          .value = *value};
+      CVec_push_back(&target->members, &member);
+    }
+  }
+  *value = CSON_Literal_new(CSON_NULL);
+  return copy;
+}
+
+// adds or replaces the member key
+CSON *CSON_with_key(CSON *object, const char *key, CSON *value) {
+  assert(CSON_is_object(object) && "attempted to set key of non object type");
+  size_t len = strlen(key);
+  return CSON_root_new(CSON_Object_with(
+      object->as.object, key, len, CSON_hash_string(key, len), value));
+}
+
+// replaces the element at index or appends when index is the element count,
+// returns NULL and leaves value untouched when index is beyond that
+CSON *CSON_with_index(CSON *array, size_t index, CSON *value) {
+  assert(CSON_is_array(array) && "attempted to set index of non array type");
+  if (index > array->as.array->data.element_count) {
+    return NULL;
+  }
+  return CSON_root_new(CSON_Array_with(array->as.array, index, value));
+}
+
+static bool CSON_with_step(CSON *node, const CSON_Path *path, size_t i,
+                           CSON *value, CSON *out) {
+  const CSON_PathStep *step = &path->steps[i];
+  bool last = i + 1 == path->count;
+  if (CSON_is_object(node)) {
+    CSON_Object *object = node->as.object;
+    if (last) {
+      *out = CSON_Object_with(object, step->key, step->len, step->hash, value);
+      return true;
+    }
+    size_t position =
+        CSON_Object_find(object, step->key, step->len, step->hash);
+    CSON child;
+    if (position == SIZE_MAX ||
+        !CSON_with_step(CSON_Object_value_at(object, position), path, i + 1,
+                        value, &child)) {
+      return false;
+    }
+    *out = CSON_Object_with(object, step->key, step->len, step->hash, &child);
+    return true;
+  }
+  if (CSON_is_array(node)) {
+    CSON_Array *array = node->as.array;
+    size_t count = array->data.element_count;
+    size_t index = step->len == 1 && step->key[0] == '-' ? count
+                   : step->index >= 0 ? (size_t)step->index
+                                      : SIZE_MAX;
+    if (index > count || (!last && index == count)) {
+      return false;
+    }
+    if (last) {
+      *out = CSON_Array_with(array, index, value);
+      return true;
+    }
+    CSON child;
+    if (!CSON_with_step((CSON *)array->data.data + index, path, i + 1, value,
+                        &child)) {
+      return false;
+    }
+    *out = CSON_Array_with(array, index, &child);
+    return true;
+  }
+  return false;
+}
+
+// Sets the location named by the JSON Pointer, the last token adds or
+// replaces an object member, replaces an array element or appends with "-".
+// Returns NULL and leaves value untouched when the parent does not exist.
+CSON *CSON_with_pointer(CSON *root, const char *pointer, CSON *value) {
+  if (pointer[0] == '$') {
+    return NULL;
+  }
+  CSON_Path *path = CSON_Path_compile(pointer);
+  if (!path) {
+    return NULL;
+  }
+  CSON result;
+  bool ok = true;
+  if (path->count == 0) {
+    result = *value;
+    *value = CSON_Literal_new(CSON_NULL);
+  } else {
+    ok = CSON_with_step(root, path, 0, value, &result);
+  }
+  CSON_Path_free(path);
+  return ok ? CSON_root_new(result) : NULL;
+}
+
+// patches
+// A string copy that outlives the source document: a string in a frozen
+// block is freed with the block, so it is duplicated instead of shared.
+static CSON CSON_string_own(CSON *string) {
+  return CSON_is_frozen(string) ? CSON_String_from_sv(CSON_string_sv(string))
+                                : CSON_string_copy(string);
+}
+
+// a copy of value owning all of its containers, strings are shared unless
+// frozen
+static CSON CSON_deep_copy(CSON *value) {
+  switch (value->type) {
+  case CSON_STRING:
+    return CSON_string_own(value);
+  case CSON_ARRAY: {
+    CSON_Array *array = value->as.array;
+    CSON copy = CSON_Array_new();
+    CSON_Array_reserve(copy.as.array, array->data.element_count);
+    for (size_t i = 0; i < array->data.element_count; i++) {
+      CSON element = CSON_deep_copy((CSON *)array->data.data + i);
+      CSON_Array_append(copy.as.array, &element);
+    }
+    return copy;
+  }
+  case CSON_OBJECT: {
+    CSON_Object *object = value->as.object;
+    size_t count = CSON_Object_count(object);
+    CSON copy = CSON_Object_new();
+    CSON_Object_reserve(copy.as.object, count);
+    for (size_t i = 0; i < count; i++) {
+      CSON_Key *key = CSON_Object_key_at(object, i);
+      CSON string = CSON_string_own(&key->string);
+      CSON member = CSON_deep_copy(CSON_Object_value_at(object, i));
+      CSON_Object_push(copy.as.object, &string, key->hash, &member);
+    }
+    return copy;
+  }
+  default:
+    return *value;
+  }
+}
+
+// What a change to the target replaced, in the order the changes were made.
+// Values placed by a move are handed back through a carry on rollback
+// instead of being released, the removal logged right before takes them.
+typedef enum {
+  CSON_UNDO_ROOT,            // value held the old root
+  CSON_UNDO_REPLACED,        // value held the old child at position
+  CSON_UNDO_MEMBER_ADDED,    // appended at position
+  CSON_UNDO_ELEMENT_ADDED,   // inserted at position
+  CSON_UNDO_MEMBER_REMOVED,  // key and value removed from position
+  CSON_UNDO_ELEMENT_REMOVED, // value removed from position
+} CSON_UndoOp;
+
+typedef struct {
+  CSON_UndoOp op;
+  bool moved;     // the placed or removed value is the one being moved
+  CSON container; // the changed array or object, a borrowed handle
+  size_t position;
+  CSON key;
+  CSON value;
+} CSON_Undo;
+
+static CSON *CSON_child_at(CSON *container, size_t position) {
+  if (CSON_is_object(container)) {
+    return CSON_Object_value_at(container->as.object, position);
+  }
+  return (CSON *)container->as.array->data.data + position;
+}
+
+// take back the value a move placed, or release it
+static void CSON_undo_placed(CSON *placed, bool moved, CSON *carry) {
+  if (moved) {
+    *carry = CSON_move(placed);
+  } else {
+    CSON_clear(placed);
+  }
+}
+
+static void CSON_patch_rollback(CSON *root, CVec *undo, CSON *carry) {
+  CSON_Undo *entries = (CSON_Undo *)undo->data;
+  for (size_t i = undo->element_count; i-- > 0;) {
+    CSON_Undo *entry = &entries[i];
+    CSON *container = &entry->container;
+    CSON *removed = entry->moved ? carry : &entry->value;
+    switch (entry->op) {
+    case CSON_UNDO_ROOT:
+      CSON_undo_placed(root, entry->moved, carry);
+      *root = entry->value;
+      break;
+    case CSON_UNDO_REPLACED: {
+      CSON *slot = CSON_child_at(container, entry->position);
+      CSON_undo_placed(slot, entry->moved, carry);
+      *slot = entry->value;
+      break;
+    }
+    case CSON_UNDO_MEMBER_ADDED: {
+      CSON placed;
+      CSON_Object_remove_at(container->as.object, entry->position, &placed);
+      CSON_undo_placed(&placed, entry->moved, carry);
+      break;
+    }
+    case CSON_UNDO_ELEMENT_ADDED: {
+      CSON placed;
+      CSON_Array_remove(container->as.array, entry->position, &placed);
+      CSON_undo_placed(&placed, entry->moved, carry);
+      break;
+    }
+    case CSON_UNDO_MEMBER_REMOVED:
+      CSON_Object_insert_at(container->as.object, entry->position,
+                            &entry->key, removed);
+      break;
+    case CSON_UNDO_ELEMENT_REMOVED:
+      CSON_Array_insert(container->as.array, entry->position, removed);
+      break;
+    }
+  }
+  undo->element_count = 0;
+}
+
+// release what the changes of an applied patch replaced
+static void CSON_patch_commit(CVec *undo) {
+  CSON_Undo *entries = (CSON_Undo *)undo->data;
+  for (size_t i = 0; i < undo->element_count; i++) {
+    CSON_clear(&entries[i].key);
+    CSON_clear(&entries[i].value);
+  }
+  undo->element_count = 0;
+}
+
+// The value reached by the first count steps, NULL when one does not
+// resolve. With modify set the cached hashes on the way and above root are
+// cleared, the caller is about to change something below them.
+static CSON *CSON_patch_walk(CSON *node, const CSON_Path *path, size_t count,
+                             bool modify) {
+  for (size_t i = 0; i < count; i++) {
+    const CSON_PathStep *step = &path->steps[i];
+    if (modify) {
+      CSON_touch(node);
+    }
+    if (CSON_is_object(node)) {
+      CSON_Object *object = node->as.object;
+      size_t position =
+          CSON_Object_find(object, step->key, step->len, step->hash);
+      if (position == SIZE_MAX) {
+        return NULL;
+      }
+      node = CSON_Object_value_at(object, position);
+    } else if (CSON_is_array(node)) {
+      CSON_Array *array = node->as.array;
+      if (step->index < 0 || (size_t)step->index >= array->data.element_count) {
+        return NULL;
+      }
+      node = (CSON *)array->data.data + step->index;
+    } else {
+      return NULL;
+    }
+  }
+  if (modify) {
+    CSON_touch(node);
+  }
+  return node;
+}
+
+// Adds value at path, replacing an existing member or the root. With replace
+// set the location must exist and array elements are replaced instead of
+// inserted before. value is moved in on success and left untouched otherwise.
+static bool CSON_patch_add(CSON *root, const CSON_Path *path, CSON *value,
+                           bool moved, bool replace, CVec *undo) {
+  CSON_Undo entry = {.moved = moved,
+                     .key = CSON_Literal_new(CSON_NULL),
+                     .value = CSON_Literal_new(CSON_NULL)};
+  if (path->count == 0) {
+    entry.op = CSON_UNDO_ROOT;
+    CSON_HashCache_leave(root);
+    entry.value = CSON_move(root);
+    *root = CSON_move(value);
+    CVec_push_back(undo, &entry);
+    return true;
+  }
+  CSON *parent = CSON_patch_walk(root, path, path->count - 1, true);
+  const CSON_PathStep *step = &path->steps[path->count - 1];
+  if (!parent || !CSON_is_container(parent)) {
+    return false;
+  }
+  entry.container = *parent;
+  if (CSON_is_object(parent)) {
+    CSON_Object *object = parent->as.object;
+    assert(object->refcount == 1 && "attempted to modify a shared object");
+    size_t position =
+        CSON_Object_find(object, step->key, step->len, step->hash);
+    if (position != SIZE_MAX) {
+      CSON *slot = CSON_Object_value_at(object, position);
+      CSON_HashCache_drop(&object->hash);
+      entry.op = CSON_UNDO_REPLACED;
+      entry.position = position;
+      entry.value = *slot;
+      *slot = CSON_move(value);
+    } else if (replace) {
+      return false;
+    } else {
+      CSON key = CSON_String_from_sv(
+          (CSON_SV){.str = step->key, .len = step->len});
+      entry.op = CSON_UNDO_MEMBER_ADDED;
+      entry.position = CSON_Object_count(object);
+      CSON_Object_push(object, &key, step->hash, value);
+    }
+  } else {
+    CSON_Array *array = parent->as.array;
+    size_t count = array->data.element_count;
+    size_t index = step->len == 1 && step->key[0] == '-' ? count
+                   : step->index >= 0 ? (size_t)step->index
+                                      : SIZE_MAX;
+    if (index > count || (replace && index == count)) {
+      return false;
+    }
+    entry.position = index;
+    if (replace) {
+      assert(array->refcount == 1 && "attempted to modify a shared array");
+      CSON *slot = (CSON *)array->data.data + index;
+      CSON_HashCache_drop(&array->hash);
+      entry.op = CSON_UNDO_REPLACED;
+      entry.value = *slot;
+      *slot = CSON_move(value);
+    } else {
+      entry.op = CSON_UNDO_ELEMENT_ADDED;
+      CSON_Array_insert(array, index, value);
+    }
+  }
+  CVec_push_back(undo, &entry);
+  return true;
+}
+
+// Removes the value at path, it is moved to out when given and kept for
+// rollback otherwise. The root cannot be removed.
+static bool CSON_patch_remove(CSON *root, const CSON_Path *path, CSON *out,
+                              CVec *undo) {
+  CSON *parent =
+      path->count ? CSON_patch_walk(root, path, path->count - 1, true) : NULL;
+  if (!parent) {
+    return false;
+  }
+  const CSON_PathStep *step = &path->steps[path->count - 1];
+  CSON_Undo entry = {.moved = out != NULL,
+                     .container = *parent,
+                     .key = CSON_Literal_new(CSON_NULL),
+                     .value = CSON_Literal_new(CSON_NULL)};
+  CSON removed;
+  if (CSON_is_object(parent)) {
+    CSON_Object *object = parent->as.object;
+    size_t position =
+        CSON_Object_find(object, step->key, step->len, step->hash);
+    if (position == SIZE_MAX) {
+      return false;
+    }
+    entry.op = CSON_UNDO_MEMBER_REMOVED;
+    entry.position = position;
+    entry.key = CSON_string_copy(&CSON_Object_key_at(object, position)->string);
+    CSON_Object_remove_at(object, position, &removed);
+  } else if (CSON_is_array(parent)) {
+    CSON_Array *array = parent->as.array;
+    if (step->index < 0 || (size_t)step->index >= array->data.element_count) {
+      return false;
+    }
+    entry.op = CSON_UNDO_ELEMENT_REMOVED;
+    entry.position = (size_t)step->index;
+    CSON_Array_remove(array, entry.position, &removed);
+  } else {
+    return false;
+  }
+  if (out) {
+    *out = removed;
+  } else {
+    entry.value = removed;
+  }
+  CVec_push_back(undo, &entry);
+  return true;
+}
+
+// the compiled JSON Pointer held by member key of an operation
+static CSON_Path *CSON_patch_pointer(CSON *operation, const char *key) {
+  CSON *pointer = CSON_get_by_key(operation, key);
+  if (!pointer || !CSON_is_string(pointer)) {
+    return NULL;
+  }
+  const char *str = CSON_get_string(pointer);
+  return str[0] == '$' ? NULL : CSON_Path_compile(str);
+}
+
+// does pointer a name a proper ancestor of pointer b
+static bool CSON_pointer_is_parent(const char *a, const char *b) {
+  size_t len = strlen(a);
+  return strncmp(a, b, len) == 0 && b[len] == '/';
+}
+
+// runs one well formed operation, value is NULL for remove, move and copy
+static bool CSON_patch_run(CSON *root, CSON *operation, const char *name,
+                           const CSON_Path *path, const CSON_Path *source,
+                           CSON *value, CVec *undo, CSON *carry) {
+  if (strcmp(name, "test") == 0) {
+    CSON *current = CSON_patch_walk(root, path, path->count, false);
+    return current && CSON_subtree_eq(current, value, false);
+  }
+  if (strcmp(name, "remove") == 0) {
+    return CSON_patch_remove(root, path, NULL, undo);
+  }
+  if (strcmp(name, "add") == 0 || strcmp(name, "replace") == 0) {
+    CSON copy = CSON_deep_copy(value);
+    bool ok = CSON_patch_add(root, path, &copy, false, name[0] == 'r', undo);
+    CSON_clear(&copy);
+    return ok;
+  }
+  if (strcmp(name, "copy") == 0) {
+    CSON *current = CSON_patch_walk(root, source, source->count, false);
+    if (!current) {
+      return false;
+    }
+    CSON copy = CSON_deep_copy(current);
+    bool ok = CSON_patch_add(root, path, &copy, false, false, undo);
+    CSON_clear(&copy);
+    return ok;
+  }
+  // move, the removed subtree stays in carry for the rollback on failure
+  const char *a = CSON_get_string(CSON_get_by_key(operation, "from"));
+  const char *b = CSON_get_string(CSON_get_by_key(operation, "path"));
+  if (strcmp(a, b) == 0) {
+    return CSON_patch_walk(root, path, path->count, false) != NULL;
+  }
+  return !CSON_pointer_is_parent(a, b) &&
+         CSON_patch_remove(root, source, carry, undo) &&
+         CSON_patch_add(root, path, carry, true, false, undo);
+}
+
+static bool CSON_patch_operation(CSON *root, CSON *operation, CVec *undo,
+                                 CSON *carry) {
+  CSON *op = CSON_is_object(operation) ? CSON_get_by_key(operation, "op")
+                                       : NULL;
+  if (!op || !CSON_is_string(op)) {
+    return false;
+  }
+  const char *name = CSON_get_string(op);
+  bool from = strcmp(name, "move") == 0 || strcmp(name, "copy") == 0;
+  bool needs_value = strcmp(name, "add") == 0 ||
+                     strcmp(name, "replace") == 0 ||
+                     strcmp(name, "test") == 0;
+  CSON *value = CSON_get_by_key(operation, "value");
+  if (!from && !needs_value && strcmp(name, "remove") != 0) {
+    return false; // unknown operation
+  }
+  if (needs_value && !value) {
+    return false;
+  }
+  CSON_Path *path = CSON_patch_pointer(operation, "path");
+  CSON_Path *source = from ? CSON_patch_pointer(operation, "from") : NULL;
+  bool ok = path && (!from || source) &&
+            CSON_patch_run(root, operation, name, path, source, value, undo,
+                           carry);
+  CSON_Path_free(path);
+  CSON_Path_free(source);
+  return ok;
+}
+
+CSON_Result CSON_apply_patch(CSON *target, CSON *patch) {
+  if (!CSON_is_array(patch)) {
+    return CSON_ERROR;
+  }
+  CVec undo;
+  CVec_init(&undo, sizeof(CSON_Undo), 0);
+  CSON carry = CSON_Literal_new(CSON_NULL);
+  CSON_Array *operations = patch->as.array;
+  for (size_t i = 0; i < operations->data.element_count; i++) {
+    if (!CSON_patch_operation(target, (CSON *)operations->data.data + i,
+                              &undo, &carry)) {
+      CSON_patch_rollback(target, &undo, &carry);
+      CVec_free(&undo);
+      return CSON_ERROR;
+    }
+  }
+  CSON_patch_commit(&undo);
+  CVec_free(&undo);
+  return CSON_SUCCES;
+}
+
+void CSON_merge_patch(CSON *target, CSON *patch) {
+  if (!CSON_is_object(patch)) {
+    CSON copy = CSON_deep_copy(patch);
+    CSON_HashCache_leave(target);
+    CSON_clear(target);
+    *target = copy;
+    return;
+  }
+  if (!CSON_is_object(target)) {
+    CSON_HashCache_leave(target);
+    CSON_clear(target);
+    *target = CSON_Object_new();
+  }
+  CSON_Object *object = target->as.object;
+  CSON_Object *changes = patch->as.object;
+  assert(object->refcount == 1 && "attempted to modify a shared object");
+  CSON_touch(target);
+  for (size_t i = 0; i < CSON_Object_count(changes); i++) {
+    CSON_Key *key = CSON_Object_key_at(changes, i);
+    CSON *value = CSON_Object_value_at(changes, i);
+    CSON_SV sv = CSON_string_sv(&key->string);
+    size_t position = CSON_Object_find(object, sv.str, sv.len, key->hash);
+    if (CSON_is_null(value)) {
+      if (position != SIZE_MAX) {
+        CSON_Object_remove_at(object, position, NULL);
+      }
+      continue;
+    }
+    if (position == SIZE_MAX) {
+      CSON string = CSON_string_own(&key->string);
+      CSON member = CSON_Literal_new(CSON_NULL);
+      position = CSON_Object_count(object);
+      CSON_Object_push(object, &string, key->hash, &member);
+    }
+    CSON_merge_patch(CSON_Object_value_at(object, position), value);
+  }
+}
+
+// structural hashing
+uint64_t CSON_hash(CSON *cson) { return CSON_subtree_hash(cson); }
+
+bool CSON_equal(CSON *a, CSON *b) {
+  return CSON_subtree_hash(a) == CSON_subtree_hash(b) &&
+         CSON_subtree_eq(a, b, false);
+}
+
+// the JSON Pointer of the location being compared, without terminator
+typedef struct {
+  CVec pointer; // char
+  CSON_Array *operations;
+} CSON_Differ;
+
+static void CSON_diff_member(CSON_Object *object, const char *key,
+                             CSON value) {
+  CSON string =
+      CSON_String_from_sv((CSON_SV){.str = (char *)key, .len = strlen(key)});
+  CSON_Object_insert(object, &string, &value);
+}
+
+// value is copied into the operation when given
+static void CSON_diff_operation(CSON_Differ *differ, const char *op,
+                                CSON *value) {
+  CSON operation = CSON_Object_new();
+  CSON_diff_member(operation.as.object, "op",
+                   CSON_String_from_sv((CSON_SV){.str = (char *)op,
+                                                 .len = strlen(op)}));
+  CSON_diff_member(operation.as.object, "path",
+                   CSON_String_from_sv(
+                       (CSON_SV){.str = differ->pointer.data,
+                                 .len = differ->pointer.element_count}));
+  if (value) {
+    CSON_diff_member(operation.as.object, "value", CSON_deep_copy(value));
+  }
+  CSON_Array_append(differ->operations, &operation);
+}
+
+// appends a reference token, returns the length to truncate back to
+static size_t CSON_diff_push_key(CSON_Differ *differ, CSON_SV key) {
+  size_t mark = differ->pointer.element_count;
+  CVec_push_back(&differ->pointer, "/");
+  for (size_t i = 0; i < key.len; i++) {
+    const char *escaped = key.str[i] == '~'   ? "~0"
+                          : key.str[i] == '/' ? "~1"
+                                              : NULL;
+    if (escaped) {
+      CVec_append(&differ->pointer, escaped, 2);
+    } else {
+      CVec_push_back(&differ->pointer, (void *)&key.str[i]);
+    }
+  }
+  return mark;
+}
+
+static size_t CSON_diff_push_index(CSON_Differ *differ, size_t index) {
+  char token[24];
+  int len = snprintf(token, sizeof(token), "/%zu", index);
+  size_t mark = differ->pointer.element_count;
+  CVec_append(&differ->pointer, token, (size_t)len);
+  return mark;
+}
+
+static void CSON_diff_value(CSON_Differ *differ, CSON *a, CSON *b) {
+  if (a->type != b->type || !CSON_is_container(a)) {
+    if (!CSON_subtree_eq(a, b, false)) {
+      CSON_diff_operation(differ, "replace", b);
+    }
+    return;
+  }
+  // Different hashes prove a change. Alike ones may collide, so they are
+  // confirmed by a comparison, which stops early at shared payloads.
+  if (a->as.array == b->as.array ||
+      (CSON_subtree_hash(a) == CSON_subtree_hash(b) &&
+       CSON_subtree_eq(a, b, false))) {
+    return;
+  }
+  if (CSON_is_array(a)) {
+    size_t n = a->as.array->data.element_count;
+    size_t m = b->as.array->data.element_count;
+    for (size_t i = 0; i < n && i < m; i++) {
+      size_t mark = CSON_diff_push_index(differ, i);
+      CSON_diff_value(differ, CSON_get_by_index(a, i), CSON_get_by_index(b, i));
+      differ->pointer.element_count = mark;
+    }
+    for (size_t i = n; i < m; i++) {
+      size_t mark = CSON_diff_push_index(differ, i);
+      CSON_diff_operation(differ, "add", CSON_get_by_index(b, i));
+      differ->pointer.element_count = mark;
+    }
+    for (size_t i = n; i-- > m;) { // back to front keeps indices valid
+      size_t mark = CSON_diff_push_index(differ, i);
+      CSON_diff_operation(differ, "remove", NULL);
+      differ->pointer.element_count = mark;
+    }
+    return;
+  }
+  CSON_Object *from = a->as.object;
+  CSON_Object *to = b->as.object;
+  for (size_t i = 0; i < CSON_Object_count(from); i++) {
+    CSON_Key *key = CSON_Object_key_at(from, i);
+    CSON_SV sv = CSON_string_sv(&key->string);
+    size_t j = CSON_Object_find(to, sv.str, sv.len, key->hash);
+    size_t mark = CSON_diff_push_key(differ, sv);
+    if (j == SIZE_MAX) {
+      CSON_diff_operation(differ, "remove", NULL);
+    } else {
+      CSON_diff_value(differ, CSON_Object_value_at(from, i),
+                      CSON_Object_value_at(to, j));
+    }
+    differ->pointer.element_count = mark;
+  }
+  for (size_t j = 0; j < CSON_Object_count(to); j++) {
+    CSON_Key *key = CSON_Object_key_at(to, j);
+    CSON_SV sv = CSON_string_sv(&key->string);
+    if (CSON_Object_find(from, sv.str, sv.len, key->hash) == SIZE_MAX) {
+      size_t mark = CSON_diff_push_key(differ, sv);
+      CSON_diff_operation(differ, "add", CSON_Object_value_at(to, j));
+      differ->pointer.element_count = mark;
+    }
+  }
+}
+
+CSON *CSON_diff(CSON *from, CSON *to) {
+  CSON operations = CSON_Array_new();
+  CSON_Differ differ = {.operations = operations.as.array};
+  CVec_init(&differ.pointer, sizeof(char), 0);
+  CSON_diff_value(&differ, from, to);
+  CVec_free(&differ.pointer);
+  return CSON_root_new(operations);
+}
+
+// 32 bit FNV-1a
+uint32_t CSON_hash_string(const char *str, size_t len) {
+  uint32_t hash = 2166136261u;
+  for (size_t i = 0; i < len; i++) {
+    hash ^= (uint8_t)str[i];
+    hash *= 16777619u;
+  }
+  return hash;
+}
+
+// tokenizer
+CSON_Tokenizer *CSON_Tokenizer_new(char *cstr) {
+  CSON_Tokenizer *tokenizer = malloc(sizeof(CSON_Tokenizer));
+  assert(tokenizer && "No ram?");
+  CSON_SV_init(&tokenizer->sv, cstr);
+  return tokenizer;
 }
 
 void CSON_Tokenizer_free(CSON_Tokenizer *tokenizer) { free(tokenizer); }
 
-CSON_TokenType CSON_Tokenizer_identify_token_type(char c) {
-  switch (c) {
-  case ' ':
-  case '\t':
-  case '\n':
-  case '\r':
-    return CSON_TOKENTYPE_WS;
-  case '{':
-    return CSON_TOKENTYPE_CURLY_OPEN;
-  case '}':
-    return CSON_TOKENTYPE_CURLY_CLOSE;
-  case '[':
-    return CSON_TOKENTYPE_SQUARE_OPEN;
-  case ']':
-    return CSON_TOKENTYPE_SQUARE_CLOSE;
-  case ',':
-    return CSON_TOKENTYPE_COMMA;
-  case ':':
-    return CSON_TOKENTYPE_COLON;
-  case '\"':
-    return CSON_TOKENTYPE_STRING;
-  case '\0':
-    return CSON_TOKENTYPE_EOF;
+CSON_TokenType CSON_Tokenizer_identify_token_type(char c) {
+  switch (c) {
+  case ' ':
+  case '\t':
+  case '\n':
+  case '\r':
+    return CSON_TOKENTYPE_WS;
+  case '{':
+    return CSON_TOKENTYPE_CURLY_OPEN;
+  case '}':
+    return CSON_TOKENTYPE_CURLY_CLOSE;
+  case '[':
+    return CSON_TOKENTYPE_SQUARE_OPEN;
+  case ']':
+    return CSON_TOKENTYPE_SQUARE_CLOSE;
+  case ',':
+    return CSON_TOKENTYPE_COMMA;
+  case ':':
+    return CSON_TOKENTYPE_COLON;
+  case '\"':
+    return CSON_TOKENTYPE_STRING;
+  case '\0':
+    return CSON_TOKENTYPE_EOF;
+  default:
+    break;
+  }
+  if ((c >= '0' && c <= '9') || c == '-') {
+    return CSON_TOKENTYPE_NUMBER;
+  } else if ((c >= 'A' && c <= 'Z') || (c >= 'a' || c <= 'z')) {
+    return CSON_TOKENTYPE_WORD;
+  }
+  return CSON_TOKENTYPE_UNKNOWN;
+}
+
+// sv.len is kept as the number of bytes left after sv.str
+static void CSON_Tokenizer_advance(CSON_Tokenizer *tokenizer, size_t n) {
+  tokenizer->sv.str += n;
+  tokenizer->sv.len -= n;
+}
+
+CSON_Token CSON_Tokenizer_consume(CSON_Tokenizer *tokenizer) {
+  CSON_Token token = CSON_Tokenizer_peek(tokenizer);
+  CSON_Tokenizer_advance(tokenizer, token.sv.len);
+  if (token.type == CSON_TOKENTYPE_STRING) {
+    // increment by two to account for quote chars of STRING type (quotes are
+    // not included in string)
+    CSON_Tokenizer_advance(tokenizer, 2);
+  }
+  return token;
+}
+
+void CSON_Tokenizer_skip_ws(CSON_Tokenizer *tokenizer) {
+  while (CSON_Tokenizer_identify_token_type(tokenizer->sv.str[0]) ==
+         CSON_TOKENTYPE_WS) {
+    CSON_Tokenizer_advance(tokenizer, 1);
+  }
+}
+
+CSON_Token CSON_Tokenizer_peek(CSON_Tokenizer *tokenizer) {
+  CSON_Token token = {0};
+  CSON_Tokenizer_skip_ws(tokenizer); // whitespace is insignificant between
+                                     // tokens
+  token.sv.str = tokenizer->sv.str;
+  token.type = CSON_Tokenizer_identify_token_type(token.sv.str[0]);
+
+  switch (token.type) {
+  case CSON_TOKENTYPE_EOF:
+    return token;
+  case CSON_TOKENTYPE_CURLY_OPEN:
+  case CSON_TOKENTYPE_CURLY_CLOSE:
+  case CSON_TOKENTYPE_SQUARE_OPEN:
+  case CSON_TOKENTYPE_SQUARE_CLOSE:
+  case CSON_TOKENTYPE_COMMA:
+  case CSON_TOKENTYPE_COLON: {
+    token.sv.len = 1;
+    return token;
+  }
+  case CSON_TOKENTYPE_WS: {
+    size_t i = 1;
+    while (CSON_Tokenizer_identify_token_type(token.sv.str[i]) ==
+           CSON_TOKENTYPE_WS) {
+      i++;
+    }
+    token.sv.len = i;
+    return token;
+  }
+  case CSON_TOKENTYPE_STRING: {
+    token.sv.str++;
+    size_t i = 0;
+    while (token.sv.str[i] != '\"') {
+      if (token.sv.str[i] == '\0') {
+        token.type = CSON_TOKENTYPE_EOF;
+        token.sv.len = 0;
+        return token;
+      }
+      if (token.sv.str[i] == '\\' && token.sv.str[i + 1] != '\0') {
+        i++; // escaped character, the token keeps the escape as written
+      }
+      i++;
+    }
+    token.sv.len = i;
+    return token;
+  }
+  case CSON_TOKENTYPE_NUMBER: {
+    // every character of the number grammar, CSON_Token_to_double checks
+    // their order
+    size_t i = 1;
+    char c = token.sv.str[i];
+    while (c != '\0' && strchr("0123456789.eE+-", c)) {
+      i++;
+      c = token.sv.str[i];
+    }
+    token.sv.len = i;
+    return token;
+  }
+  case CSON_TOKENTYPE_WORD: {
+    size_t i = 1;
+    char c = token.sv.str[i];
+    while (CSON_Tokenizer_identify_token_type(c) == CSON_TOKENTYPE_WORD) {
+      i++;
+      c = token.sv.str[i];
+    }
+    token.sv.len = i;
+    return token;
+  }
+  case CSON_TOKENTYPE_UNKNOWN:
+    break;
+  }
+  // should not ever be triggered
+  fprintf(stderr, "CSON: unkown token encountered starting with %c\n",
+          tokenizer->sv.str[0]);
+  exit(EXIT_FAILURE);
+}
+
+// value skipping
+#define CSON_SWAR_ONES UINT64_C(0x0101010101010101)
+#define CSON_SWAR_HIGHS UINT64_C(0x8080808080808080)
+
+// non zero when any byte of word equals byte
+static uint64_t CSON_swar_has(uint64_t word, uint8_t byte) {
+  uint64_t x = word ^ (CSON_SWAR_ONES * byte);
+  return (x - CSON_SWAR_ONES) & ~x & CSON_SWAR_HIGHS;
+}
+
+// p is just past the opening quote
+static const char *CSON_skip_string(const char *p, const char *end) {
+  for (;;) {
+    while (end - p >= 8) {
+      uint64_t word;
+      memcpy(&word, p, sizeof(word));
+      if (CSON_swar_has(word, '"') | CSON_swar_has(word, '\\')) {
+        break;
+      }
+      p += 8;
+    }
+    while (p < end && *p != '"' && *p != '\\') {
+      p++;
+    }
+    if (end - p < 1) {
+      return NULL;
+    }
+    if (*p == '"') {
+      return p + 1;
+    }
+    if (end - p < 2) {
+      return NULL;
+    }
+    p += 2; // escaped character
+  }
+}
+
+const char *CSON_skip_value(const char *p, const char *end) {
+  while (p < end && (*p == ' ' || *p == '\t' || *p == '\n' || *p == '\r')) {
+    p++;
+  }
+  if (p == end) {
+    return NULL;
+  }
+  switch (*p) {
+  case '"':
+    return CSON_skip_string(p + 1, end);
+  case '{':
+  case '[':
+    break;
+  case '}':
+  case ']':
+  case ',':
+  case ':':
+  case '\0':
+    return NULL;
+  default: // numbers and literals run until the next delimiter
+    while (p < end && !strchr(",:}] \t\n\r", *p)) {
+      p++;
+    }
+    return p;
+  }
+
+  // '[' and '{' only differ from ']' and '}' by 0x20, folding that bit
+  // finds all four with two compares
+  size_t depth = 0;
+  for (;;) {
+    while (end - p >= 8) {
+      uint64_t word;
+      memcpy(&word, p, sizeof(word));
+      uint64_t folded = word | (CSON_SWAR_ONES * 0x20);
+      if (CSON_swar_has(word, '"') | CSON_swar_has(folded, '{') |
+          CSON_swar_has(folded, '}')) {
+        break;
+      }
+      p += 8;
+    }
+    if (p == end) {
+      return NULL;
+    }
+    char c = *p++;
+    if (c == '"') {
+      p = CSON_skip_string(p, end);
+      if (!p) {
+        return NULL;
+      }
+    } else if (c == '{' || c == '[') {
+      depth++;
+    } else if ((c == '}' || c == ']') && --depth == 0) {
+      return p;
+    }
+  }
+}
+
+// validation
+// bytes of word below n, n at most 0x80
+static uint64_t CSON_swar_less(uint64_t word, uint8_t n) {
+  return (word - CSON_SWAR_ONES * n) & ~word & CSON_SWAR_HIGHS;
+}
+
+static bool CSON_is_hex(char c) {
+  return (c >= '0' && c <= '9') || (c >= 'a' && c <= 'f') ||
+         (c >= 'A' && c <= 'F');
+}
+
+// *pos is at the opening quote and ends past the closing one, or at the
+// offending byte
+static bool CSON_validate_string(const char *buf, size_t len, size_t *pos) {
+  size_t i = *pos + 1;
+  for (;;) {
+    while (len - i >= 8) {
+      uint64_t word;
+      memcpy(&word, buf + i, sizeof(word));
+      if (CSON_swar_has(word, '"') | CSON_swar_has(word, '\\') |
+          CSON_swar_less(word, 0x20)) {
+        break;
+      }
+      i += 8;
+    }
+    if (i == len) {
+      *pos = i;
+      return false;
+    }
+    unsigned char c = (unsigned char)buf[i];
+    if (c == '"') {
+      *pos = i + 1;
+      return true;
+    }
+    if (c < 0x20) {
+      *pos = i;
+      return false;
+    }
+    if (c == '\\') {
+      if (i + 1 == len || !strchr("\"\\/bfnrtu", buf[i + 1]) ||
+          buf[i + 1] == '\0') {
+        *pos = i + 1;
+        return false;
+      }
+      if (buf[i + 1] == 'u') {
+        for (size_t j = i + 2; j < i + 6; j++) {
+          if (j >= len || !CSON_is_hex(buf[j])) {
+            *pos = j;
+            return false;
+          }
+        }
+        i += 4;
+      }
+      i += 2;
+      continue;
+    }
+    i++;
+  }
+}
+
+static size_t CSON_validate_digits(const char *buf, size_t len, size_t i) {
+  while (i < len && buf[i] >= '0' && buf[i] <= '9') {
+    i++;
+  }
+  return i;
+}
+
+// -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)?
+static bool CSON_validate_number(const char *buf, size_t len, size_t *pos) {
+  size_t i = *pos;
+  if (buf[i] == '-') {
+    i++;
+  }
+  if (i < len && buf[i] == '0') {
+    i++;
+  } else if (i < len && buf[i] >= '1' && buf[i] <= '9') {
+    i = CSON_validate_digits(buf, len, i);
+  } else {
+    *pos = i;
+    return false;
+  }
+  if (i < len && buf[i] == '.') {
+    size_t start = ++i;
+    i = CSON_validate_digits(buf, len, i);
+    if (i == start) {
+      *pos = i;
+      return false;
+    }
+  }
+  if (i < len && (buf[i] == 'e' || buf[i] == 'E')) {
+    i++;
+    if (i < len && (buf[i] == '+' || buf[i] == '-')) {
+      i++;
+    }
+    size_t start = i;
+    i = CSON_validate_digits(buf, len, i);
+    if (i == start) {
+      *pos = i;
+      return false;
+    }
+  }
+  *pos = i;
+  return true;
+}
+
+static bool CSON_validate_literal(const char *buf, size_t len, size_t *pos) {
+  const char *literals[] = {"true", "false", "null"};
+  for (size_t l = 0; l < 3; l++) {
+    size_t n = strlen(literals[l]);
+    if (len - *pos >= n && memcmp(buf + *pos, literals[l], n) == 0) {
+      *pos += n;
+      return true;
+    }
+  }
+  return false;
+}
+
+typedef enum {
+  CSON_EXPECT_VALUE,
+  CSON_EXPECT_VALUE_OR_CLOSE,
+  CSON_EXPECT_KEY,
+  CSON_EXPECT_KEY_OR_CLOSE,
+  CSON_EXPECT_COLON,
+  CSON_EXPECT_COMMA_OR_CLOSE,
+  CSON_EXPECT_END,
+} CSON_Expect;
+
+// The nesting is kept as one bit per level, set for objects, so validation
+// runs in constant stack space up to CSON_MAX_DEPTH.
+CSON_Result CSON_validate(const char *buf, size_t len,
+                          CSON_ValidateInfo *info) {
+  uint64_t objects[CSON_MAX_DEPTH / 64] = {0};
+  CSON_ValidateInfo result = {.error_offset = SIZE_MAX};
+  CSON_Expect expect = CSON_EXPECT_VALUE;
+  size_t depth = 0;
+  size_t i = 0;
+  bool ok = true;
+  while (ok) {
+    while (i < len && (buf[i] == ' ' || buf[i] == '\t' || buf[i] == '\n' ||
+                       buf[i] == '\r')) {
+      i++;
+    }
+    if (i == len) {
+      ok = expect == CSON_EXPECT_END;
+      break;
+    }
+    char c = buf[i];
+    bool in_object =
+        depth && (objects[(depth - 1) / 64] >> ((depth - 1) % 64) & 1);
+    bool value = false;
+    bool close = false;
+    switch (expect) {
+    case CSON_EXPECT_VALUE_OR_CLOSE:
+      close = c == ']';
+      value = !close;
+      break;
+    case CSON_EXPECT_VALUE:
+      value = true;
+      break;
+    case CSON_EXPECT_KEY_OR_CLOSE:
+    case CSON_EXPECT_KEY:
+      if (c == '}' && expect == CSON_EXPECT_KEY_OR_CLOSE) {
+        close = true;
+      } else if (c == '"' && CSON_validate_string(buf, len, &i)) {
+        expect = CSON_EXPECT_COLON;
+      } else {
+        ok = false;
+      }
+      break;
+    case CSON_EXPECT_COLON:
+      ok = c == ':';
+      i += ok;
+      expect = CSON_EXPECT_VALUE;
+      break;
+    case CSON_EXPECT_COMMA_OR_CLOSE:
+      if (c == ',') {
+        i++;
+        expect = in_object ? CSON_EXPECT_KEY : CSON_EXPECT_VALUE;
+      } else {
+        close = c == (in_object ? '}' : ']');
+        ok = close;
+      }
+      break;
+    case CSON_EXPECT_END:
+      ok = false;
+      break;
+    }
+
+    if (value) {
+      result.element_count++;
+      if (c == '{' || c == '[') {
+        if (depth == CSON_MAX_DEPTH) {
+          ok = false;
+          break;
+        }
+        uint64_t bit = UINT64_C(1) << (depth % 64);
+        objects[depth / 64] =
+            c == '{' ? objects[depth / 64] | bit : objects[depth / 64] & ~bit;
+        depth++;
+        result.max_depth = depth > result.max_depth ? depth : result.max_depth;
+        i++;
+        expect =
+            c == '{' ? CSON_EXPECT_KEY_OR_CLOSE : CSON_EXPECT_VALUE_OR_CLOSE;
+        continue;
+      }
+      if (c == '"') {
+        ok = CSON_validate_string(buf, len, &i);
+      } else if (c == '-' || (c >= '0' && c <= '9')) {
+        ok = CSON_validate_number(buf, len, &i);
+      } else {
+        ok = CSON_validate_literal(buf, len, &i);
+      }
+      expect = depth ? CSON_EXPECT_COMMA_OR_CLOSE : CSON_EXPECT_END;
+    } else if (close) {
+      i++;
+      depth--;
+      expect = depth ? CSON_EXPECT_COMMA_OR_CLOSE : CSON_EXPECT_END;
+    }
+  }
+  if (!ok) {
+    result.error_offset = i;
+  }
+  result.length = i;
+  if (info) {
+    *info = result;
+  }
+  return ok ? CSON_SUCCES : CSON_ERROR;
+}
+
+// token decoding
+// number tokens must follow the grammar CSON_validate accepts and be consumed
+// by strtod exactly
+static CSON_Result CSON_Token_to_double(CSON_Token token, double *out) {
+  size_t pos = 0;
+  if (token.sv.len == 0 ||
+      !CSON_validate_number(token.sv.str, token.sv.len, &pos) ||
+      pos != token.sv.len) {
+    return CSON_ERROR;
+  }
+  char *end;
+  double d = strtod(token.sv.str, &end);
+  if (end != token.sv.str + token.sv.len) {
+    return CSON_ERROR;
+  }
+  *out = d;
+  return CSON_SUCCES;
+}
+
+// true when d has an integral value, negative zero included, the encoders
+// keep -0 a float so its sign survives
+static bool CSON_double_is_int(double d, int64_t *i) {
+  if (!(d >= -9223372036854775808.0 && d < 9223372036854775808.0)) {
+    return false;
+  }
+  *i = (int64_t)d;
+  return (double)*i == d;
+}
+
+// Integer tokens are read exactly. Tokens with a fraction or an exponent go
+// through double and must still hold an integral value.
+static CSON_Result CSON_Token_to_int64(CSON_Token token, int64_t *out) {
+  for (size_t i = 0; i < token.sv.len; i++) {
+    char c = token.sv.str[i];
+    if (c == '.' || c == 'e' || c == 'E') {
+      double d;
+      return CSON_Token_to_double(token, &d) == CSON_SUCCES &&
+                     CSON_double_is_int(d, out)
+                 ? CSON_SUCCES
+                 : CSON_ERROR;
+    }
+  }
+  size_t pos = 0;
+  if (token.sv.len == 0 ||
+      !CSON_validate_number(token.sv.str, token.sv.len, &pos) ||
+      pos != token.sv.len) {
+    return CSON_ERROR;
+  }
+  char *end;
+  errno = 0;
+  long long i = strtoll(token.sv.str, &end, 10);
+  if (errno == ERANGE || end != token.sv.str + token.sv.len) {
+    return CSON_ERROR;
+  }
+  *out = i;
+  return CSON_SUCCES;
+}
+
+static size_t CSON_utf8_encode(uint32_t code_point, char *out) {
+  if (code_point < 0x80) {
+    out[0] = (char)code_point;
+    return 1;
+  }
+  if (code_point < 0x800) {
+    out[0] = (char)(0xc0 | code_point >> 6);
+    out[1] = (char)(0x80 | (code_point & 0x3f));
+    return 2;
+  }
+  if (code_point < 0x10000) {
+    out[0] = (char)(0xe0 | code_point >> 12);
+    out[1] = (char)(0x80 | (code_point >> 6 & 0x3f));
+    out[2] = (char)(0x80 | (code_point & 0x3f));
+    return 3;
+  }
+  out[0] = (char)(0xf0 | code_point >> 18);
+  out[1] = (char)(0x80 | (code_point >> 12 & 0x3f));
+  out[2] = (char)(0x80 | (code_point >> 6 & 0x3f));
+  out[3] = (char)(0x80 | (code_point & 0x3f));
+  return 4;
+}
+
+static bool CSON_read_hex4(const char *str, size_t len, size_t i,
+                           uint32_t *out) {
+  if (len - i < 4) {
+    return false;
+  }
+  *out = 0;
+  for (size_t j = i; j < i + 4; j++) {
+    char c = str[j];
+    if (!CSON_is_hex(c)) {
+      return false;
+    }
+    *out = *out << 4 | (uint32_t)(c <= '9'   ? c - '0'
+                                  : c <= 'F' ? c - 'A' + 10
+                                             : c - 'a' + 10);
+  }
+  return true;
+}
+
+// Decodes the escapes of sv into buf, which needs sv.len bytes since decoding
+// never grows a string. Output never overtakes input, so buf may be sv.str.
+// \uXXXX escapes become UTF-8 with surrogate pairs combined, lone surrogates
+// are kept as their three byte form. Returns the decoded length or SIZE_MAX
+// for a malformed escape.
+static size_t CSON_unescape(CSON_SV sv, char *buf) {
+  size_t n = 0;
+  for (size_t i = 0; i < sv.len; i++) {
+    char c = sv.str[i];
+    if (c != '\\') {
+      buf[n++] = c;
+      continue;
+    }
+    if (++i == sv.len) {
+      return SIZE_MAX;
+    }
+    switch (sv.str[i]) {
+    case '"':
+    case '\\':
+    case '/':
+      buf[n++] = sv.str[i];
+      break;
+    case 'b':
+      buf[n++] = '\b';
+      break;
+    case 'f':
+      buf[n++] = '\f';
+      break;
+    case 'n':
+      buf[n++] = '\n';
+      break;
+    case 'r':
+      buf[n++] = '\r';
+      break;
+    case 't':
+      buf[n++] = '\t';
+      break;
+    case 'u': {
+      uint32_t code_point, low;
+      if (!CSON_read_hex4(sv.str, sv.len, i + 1, &code_point)) {
+        return SIZE_MAX;
+      }
+      i += 4;
+      if (code_point >= 0xd800 && code_point < 0xdc00 &&
+          sv.len - i >= 3 && sv.str[i + 1] == '\\' && sv.str[i + 2] == 'u' &&
+          CSON_read_hex4(sv.str, sv.len, i + 3, &low) && low >= 0xdc00 &&
+          low < 0xe000) {
+        code_point = 0x10000 + ((code_point - 0xd800) << 10) + (low - 0xdc00);
+        i += 6;
+      }
+      n += CSON_utf8_encode(code_point, buf + n);
+    } break;
+    default:
+      return SIZE_MAX;
+    }
+  }
+  return n;
+}
+
+// Points *sv at the text of a string token. Tokens without escapes are used
+// in place, others are decoded into *buf, a malloc'd buffer the caller frees.
+static CSON_Result CSON_Token_string(CSON_Token token, CSON_SV *sv,
+                                     char **buf) {
+  *sv = token.sv;
+  *buf = NULL;
+  if (!memchr(token.sv.str, '\\', token.sv.len)) {
+    return CSON_SUCCES;
+  }
+  *buf = malloc(token.sv.len ? token.sv.len : 1);
+  assert(*buf && "No ram?");
+  sv->str = *buf;
+  sv->len = CSON_unescape(token.sv, *buf);
+  if (sv->len == SIZE_MAX) {
+    free(*buf);
+    *buf = NULL;
+    return CSON_ERROR;
+  }
+  return CSON_SUCCES;
+}
+
+// parsing
+CSON_Result CSON_parse(CSON **cson, char *cstr) {
+  return CSON_parse_ex(cson, cstr, NULL);
+}
+
+CSON_Result CSON_parse_ex(CSON **cson, char *cstr,
+                          const CSON_ParseOptions *options) {
+  CSON_Parser parser = {0};
+  CSON_SV_init(&parser.tokenizer.sv, cstr);
+  if (options) {
+    parser.options = *options;
+  }
+  CVec_init(&parser.counts, sizeof(uint32_t), 0);
+  if (parser.options.prescan) {
+    CSON_prescan(cstr, &parser.counts);
+  }
+
+  CSON element;
+  CSON_Result res = CSON_parse_element(&element, &parser);
+  CVec_free(&parser.counts);
+  if (res == CSON_SUCCES) {
+    *cson = CSON_root_new(element);
+  }
+  return res;
+}
+
+// Structural pre-pass: appends the element count of every container to counts
+// in the order the containers are opened. The counts are only used as
+// capacity hints, so malformed input merely results in a poor reservation.
+void CSON_prescan(const char *cstr, CVec *counts) {
+  assert(counts->element_size == sizeof(uint32_t) &&
+         "counts must be a vector of uint32_t");
+  size_t stack[CSON_MAX_DEPTH];
+  bool empty[CSON_MAX_DEPTH];
+  size_t depth = 0;
+  uint32_t zero = 0;
+  uint32_t *count;
+  for (const char *c = cstr; *c != '\0'; c++) {
+    switch (*c) {
+    case ' ':
+    case '\t':
+    case '\n':
+    case '\r':
+      continue;
+    case '[':
+    case '{':
+      if (depth > 0) {
+        empty[depth - 1] = false;
+      }
+      if (depth == CSON_MAX_DEPTH) {
+        return;
+      }
+      stack[depth] = counts->element_count;
+      empty[depth] = true;
+      depth++;
+      CVec_push_back(counts, &zero);
+      continue;
+    case ']':
+    case '}':
+      if (depth == 0) {
+        return;
+      }
+      depth--;
+      if (!empty[depth]) {
+        count = (uint32_t *)counts->data + stack[depth];
+        (*count)++;
+      }
+      continue;
+    case ',':
+      if (depth > 0) {
+        count = (uint32_t *)counts->data + stack[depth - 1];
+        (*count)++;
+      }
+      continue;
+    case '\"':
+      c++;
+      while (*c != '\"') {
+        if (*c == '\0') {
+          return;
+        }
+        if (*c == '\\' && c[1] != '\0') {
+          c++; // escaped character
+        }
+        c++;
+      }
+      break;
+    default:
+      break;
+    }
+    if (depth > 0) {
+      empty[depth - 1] = false;
+    }
+  }
+}
+
+// reserve the capacity found by the pre-pass for the container just opened
+static size_t CSON_Parser_next_count(CSON_Parser *parser) {
+  if (parser->next_count >= parser->counts.element_count) {
+    return 0;
+  }
+  return ((uint32_t *)parser->counts.data)[parser->next_count++];
+}
+
+CSON_Result CSON_parse_element(CSON *element, CSON_Parser *parser) {
+  CSON_Token token = CSON_Tokenizer_consume(&parser->tokenizer);
+  switch (token.type) {
+  case CSON_TOKENTYPE_CURLY_OPEN: {
+    return CSON_parse_object(element, parser);
+  } break;
+  case CSON_TOKENTYPE_SQUARE_OPEN: {
+    return CSON_parse_array(element, parser);
+  } break;
+  case CSON_TOKENTYPE_STRING: {
+    CSON_SV sv;
+    char *buf;
+    if (CSON_Token_string(token, &sv, &buf) == CSON_ERROR) {
+      return CSON_ERROR;
+    }
+    *element = parser->options.strings
+                   ? CSON_String_intern(parser->options.strings, sv)
+                   : CSON_String_from_sv(sv);
+    free(buf);
+    return CSON_SUCCES;
+  } break;
+  case CSON_TOKENTYPE_NUMBER: {
+    double d;
+    if (CSON_Token_to_double(token, &d) == CSON_ERROR) {
+      return CSON_ERROR;
+    }
+    *element = CSON_Number_new(d);
+    return CSON_SUCCES;
+  } break;
+  case CSON_TOKENTYPE_WORD: {
+    CSON_SV sv_true;
+    CSON_SV_init(&sv_true, "true");
+    CSON_SV sv_false;
+    CSON_SV_init(&sv_false, "false");
+    CSON_SV sv_null;
+    CSON_SV_init(&sv_null, "null");
+
+    if (CSON_SV_eq(&token.sv, &sv_true)) {
+      *element = CSON_Literal_new(CSON_TRUE);
+    } else if (CSON_SV_eq(&token.sv, &sv_false)) {
+      *element = CSON_Literal_new(CSON_FALSE);
+    } else if (CSON_SV_eq(&token.sv, &sv_null)) {
+      *element = CSON_Literal_new(CSON_NULL);
+    } else {
+      return CSON_ERROR;
+    }
+    return CSON_SUCCES;
+  } break;
+  default:
+    break;
+  }
+  return CSON_ERROR;
+}
+
+CSON_Result CSON_parse_array(CSON *element, CSON_Parser *parser) {
+  CSON array = CSON_Array_new();
+  CSON_Array_reserve(array.as.array, CSON_Parser_next_count(parser));
+  CSON_Token token = CSON_Tokenizer_peek(&parser->tokenizer);
+  if (token.type == CSON_TOKENTYPE_SQUARE_CLOSE) {
+    CSON_Tokenizer_consume(&parser->tokenizer);
+  }
+  CSON_Result res;
+  while (token.type != CSON_TOKENTYPE_SQUARE_CLOSE) {
+
+    // parse value
+    CSON value;
+    res = CSON_parse_element(&value, parser);
+    if (res == CSON_ERROR) {
+      goto PARSE_ERROR;
+    }
+
+    CSON_Array_append(array.as.array, &value);
+
+    // check for more
+    token = CSON_Tokenizer_consume(&parser->tokenizer);
+    switch (token.type) {
+    case CSON_TOKENTYPE_COMMA:
+      // token = CSON_Tokenizer_consume(&parser->tokenizer);
+    case CSON_TOKENTYPE_SQUARE_CLOSE:
+      continue;
+    default:
+      goto PARSE_ERROR;
+    }
+  }
+  CVec_shrink_to_fit(&array.as.array->data);
+  if (parser->options.subtrees) {
+    CSON_SubtreeTable_intern(parser->options.subtrees, &array);
+  }
+  *element = array;
+  return CSON_SUCCES;
+PARSE_ERROR:
+  CSON_clear(&array);
+  return CSON_ERROR;
+}
+
+CSON_Result CSON_parse_object(CSON *element, CSON_Parser *parser) {
+  CSON object = CSON_Object_new();
+  CSON_Object_reserve(object.as.object, CSON_Parser_next_count(parser));
+  CSON_Token token = CSON_Tokenizer_peek(&parser->tokenizer);
+  if (token.type == CSON_TOKENTYPE_CURLY_CLOSE) {
+    CSON_Tokenizer_consume(&parser->tokenizer);
+  }
+  CSON_Result res;
+  while (token.type != CSON_TOKENTYPE_CURLY_CLOSE) {
+    // parse key
+    CSON key;
+    res = CSON_parse_element(&key, parser);
+    if (res == CSON_ERROR) {
+      goto PARSE_ERROR;
+    }
+    if (key.type != CSON_STRING) {
+      CSON_clear(&key);
+      goto PARSE_ERROR;
+    }
+
+    // colon seperator
+    token = CSON_Tokenizer_consume(&parser->tokenizer);
+    if (token.type != CSON_TOKENTYPE_COLON) {
+      CSON_clear(&key);
+      goto PARSE_ERROR;
+    }
+
+    // parse value
+    CSON value;
+    res = CSON_parse_element(&value, parser);
+    if (res == CSON_ERROR) {
+      CSON_clear(&key);
+      goto PARSE_ERROR;
+    }
+
+    CSON_Object_insert(object.as.object, &key, &value);
+
+    // check for more
+    token = CSON_Tokenizer_consume(&parser->tokenizer);
+    switch (token.type) {
+    case CSON_TOKENTYPE_COMMA:
+    case CSON_TOKENTYPE_CURLY_CLOSE:
+      continue;
+    default:
+      goto PARSE_ERROR;
+    }
+  }
+  if (parser->options.shapes) {
+    CSON_Object_intern_shape(object.as.object, parser->options.shapes);
+  } else {
+    CVec_shrink_to_fit(&object.as.object->members);
+  }
+  if (parser->options.subtrees) {
+    CSON_SubtreeTable_intern(parser->options.subtrees, &object);
+  }
+  *element = object;
+  return CSON_SUCCES;
+PARSE_ERROR:
+  CSON_clear(&object);
+  return CSON_ERROR;
+}
+
+// binary formats
+static void CSON_write_u8(CVec *out, uint8_t byte) { CVec_push_back(out, &byte); }
+
+// writes the lowest n bytes of value in network (big endian) order
+static void CSON_write_be(CVec *out, uint64_t value, size_t n) {
+  uint8_t bytes[8];
+  for (size_t i = 0; i < n; i++) {
+    bytes[i] = (uint8_t)(value >> (8 * (n - 1 - i)));
+  }
+  CVec_append(out, bytes, n);
+}
+
+static uint64_t CSON_double_bits(double d) {
+  uint64_t bits;
+  memcpy(&bits, &d, sizeof(bits));
+  return bits;
+}
+
+static bool CSON_Reader_read_be(CSON_Reader *reader, size_t n, uint64_t *value) {
+  if (reader->len - reader->pos < n) {
+    return false;
+  }
+  *value = 0;
+  for (size_t i = 0; i < n; i++) {
+    *value = (*value << 8) | reader->buf[reader->pos++];
+  }
+  return true;
+}
+
+static double CSON_half_to_double(uint16_t half) {
+  int exponent = (half >> 10) & 0x1f;
+  double mantissa = half & 0x3ff;
+  double value;
+  if (exponent == 0) {
+    value = mantissa / (1 << 24);
+  } else if (exponent != 31) {
+    value = (mantissa + 1024) * (exponent >= 25 ? (double)(1 << (exponent - 25))
+                                                : 1.0 / (1 << (25 - exponent)));
+  } else {
+    value = mantissa == 0 ? INFINITY : NAN;
+  }
+  return half & 0x8000 ? -value : value;
+}
+
+// every encoded element takes at least one byte, which bounds how much
+// capacity an untrusted length header may reserve
+static size_t CSON_Reader_capacity_hint(CSON_Reader *reader, uint64_t n) {
+  size_t remaining = reader->len - reader->pos;
+  return n < remaining ? (size_t)n : remaining;
+}
+
+// read a string or key payload of len bytes and wrap it in a CSON_String
+static CSON_Result CSON_Reader_read_string(CSON_Reader *reader, uint64_t len,
+                                           CSON *element) {
+  if (reader->len - reader->pos < len) {
+    return CSON_ERROR;
+  }
+  CSON_SV sv = {.str = (char *)reader->buf + reader->pos, .len = len};
+  reader->pos += len;
+  *element = CSON_String_from_sv(sv);
+  return CSON_SUCCES;
+}
+
+// msgpack
+static void CSON_msgpack_write_head(CVec *out, uint64_t n, uint8_t fix,
+                                    size_t fix_max, uint8_t tag16) {
+  if (n < fix_max) {
+    CSON_write_u8(out, fix | (uint8_t)n);
+  } else if (n <= 0xffff) {
+    CSON_write_u8(out, tag16);
+    CSON_write_be(out, n, 2);
+  } else {
+    CSON_write_u8(out, tag16 + 1);
+    CSON_write_be(out, n, 4);
+  }
+}
+
+static void CSON_msgpack_write_string(CVec *out, const char *str, size_t len) {
+  if (len < 32) {
+    CSON_write_u8(out, 0xa0 | (uint8_t)len);
+  } else if (len <= 0xff) {
+    CSON_write_u8(out, 0xd9);
+    CSON_write_be(out, len, 1);
+  } else {
+    CSON_msgpack_write_head(out, len, 0, 0, 0xda);
+  }
+  CVec_append(out, str, len);
+}
+
+static void CSON_msgpack_write_number(CVec *out, double d) {
+  int64_t i;
+  if (!CSON_double_is_int(d, &i) || (i == 0 && signbit(d))) {
+    CSON_write_u8(out, 0xcb);
+    CSON_write_be(out, CSON_double_bits(d), 8);
+  } else if (i >= -32 && i <= 127) {
+    CSON_write_u8(out, (uint8_t)i);
+  } else if (i > 0) {
+    size_t n = i <= 0xff ? 1 : i <= 0xffff ? 2 : i <= 0xffffffff ? 4 : 8;
+    CSON_write_u8(out, n == 1 ? 0xcc : n == 2 ? 0xcd : n == 4 ? 0xce : 0xcf);
+    CSON_write_be(out, (uint64_t)i, n);
+  } else {
+    size_t n = i >= INT8_MIN ? 1 : i >= INT16_MIN ? 2 : i >= INT32_MIN ? 4 : 8;
+    CSON_write_u8(out, n == 1 ? 0xd0 : n == 2 ? 0xd1 : n == 4 ? 0xd2 : 0xd3);
+    CSON_write_be(out, (uint64_t)i, n);
+  }
+}
+
+CSON_Result CSON_to_msgpack(CSON *cson, CVec *out) {
+  assert(out->element_size == 1 && "output must be a byte vector");
+  switch (cson->type) {
+  case CSON_NULL:
+    CSON_write_u8(out, 0xc0);
+    return CSON_SUCCES;
+  case CSON_FALSE:
+    CSON_write_u8(out, 0xc2);
+    return CSON_SUCCES;
+  case CSON_TRUE:
+    CSON_write_u8(out, 0xc3);
+    return CSON_SUCCES;
+  case CSON_NUMBER:
+    CSON_msgpack_write_number(out, CSON_get_number(cson));
+    return CSON_SUCCES;
+  case CSON_STRING: {
+    CSON_SV sv = CSON_string_sv(cson);
+    CSON_msgpack_write_string(out, sv.str, sv.len);
+    return CSON_SUCCES;
+  }
+  case CSON_ARRAY: {
+    CSON_Array *array = cson->as.array;
+    CSON_msgpack_write_head(out, array->data.element_count, 0x90, 16, 0xdc);
+    for (size_t i = 0; i < array->data.element_count; i++) {
+      if (CSON_to_msgpack(CSON_get_by_index(cson, i), out) == CSON_ERROR) {
+        return CSON_ERROR;
+      }
+    }
+    return CSON_SUCCES;
+  }
+  case CSON_OBJECT: {
+    CSON_Object *object = cson->as.object;
+    size_t count = CSON_Object_count(object);
+    CSON_msgpack_write_head(out, count, 0x80, 16, 0xde);
+    for (size_t i = 0; i < count; i++) {
+      if (CSON_to_msgpack(&CSON_Object_key_at(object, i)->string, out) ==
+              CSON_ERROR ||
+          CSON_to_msgpack(CSON_Object_value_at(object, i), out) ==
+              CSON_ERROR) {
+        return CSON_ERROR;
+      }
+    }
+    return CSON_SUCCES;
+  }
+  }
+  return CSON_ERROR;
+}
+
+static CSON_Result CSON_msgpack_read(CSON_Reader *reader, CSON *element);
+
+static CSON_Result CSON_msgpack_read_array(CSON_Reader *reader, uint64_t n,
+                                           CSON *element) {
+  CSON array = CSON_Array_new();
+  CSON_Array_reserve(array.as.array, CSON_Reader_capacity_hint(reader, n));
+  reader->depth++;
+  for (uint64_t i = 0; i < n; i++) {
+    CSON value;
+    if (CSON_msgpack_read(reader, &value) == CSON_ERROR) {
+      CSON_clear(&array);
+      return CSON_ERROR;
+    }
+    CSON_Array_append(array.as.array, &value);
+  }
+  reader->depth--;
+  *element = array;
+  return CSON_SUCCES;
+}
+
+static CSON_Result CSON_msgpack_read_map(CSON_Reader *reader, uint64_t n,
+                                         CSON *element) {
+  CSON object = CSON_Object_new();
+  CSON_Object_reserve(object.as.object, CSON_Reader_capacity_hint(reader, n));
+  reader->depth++;
+  for (uint64_t i = 0; i < n; i++) {
+    CSON key, value;
+    if (CSON_msgpack_read(reader, &key) == CSON_ERROR) {
+      goto DECODE_ERROR;
+    }
+    if (!CSON_is_string(&key) ||
+        CSON_msgpack_read(reader, &value) == CSON_ERROR) {
+      CSON_clear(&key);
+      goto DECODE_ERROR;
+    }
+    CSON_Object_insert(object.as.object, &key, &value);
+  }
+  reader->depth--;
+  *element = object;
+  return CSON_SUCCES;
+DECODE_ERROR:
+  CSON_clear(&object);
+  return CSON_ERROR;
+}
+
+static CSON_Result CSON_msgpack_read(CSON_Reader *reader, CSON *element) {
+  uint64_t tag, n;
+  if (!CSON_Reader_read_be(reader, 1, &tag) ||
+      reader->depth >= CSON_MAX_DEPTH) {
+    return CSON_ERROR;
+  }
+  if (tag <= 0x7f || tag >= 0xe0) {
+    *element = CSON_Number_new((int8_t)tag);
+    return CSON_SUCCES;
+  }
+  if ((tag & 0xe0) == 0xa0) {
+    return CSON_Reader_read_string(reader, tag & 0x1f, element);
+  }
+  if ((tag & 0xf0) == 0x90) {
+    return CSON_msgpack_read_array(reader, tag & 0x0f, element);
+  }
+  if ((tag & 0xf0) == 0x80) {
+    return CSON_msgpack_read_map(reader, tag & 0x0f, element);
+  }
+
+  switch (tag) {
+  case 0xc0:
+    *element = CSON_Literal_new(CSON_NULL);
+    return CSON_SUCCES;
+  case 0xc2:
+    *element = CSON_Literal_new(CSON_FALSE);
+    return CSON_SUCCES;
+  case 0xc3:
+    *element = CSON_Literal_new(CSON_TRUE);
+    return CSON_SUCCES;
+  case 0xc4: // bin 8/16/32 are decoded as strings
+  case 0xd9: // str 8
+    if (!CSON_Reader_read_be(reader, 1, &n)) {
+      return CSON_ERROR;
+    }
+    return CSON_Reader_read_string(reader, n, element);
+  case 0xc5:
+  case 0xda:
+    if (!CSON_Reader_read_be(reader, 2, &n)) {
+      return CSON_ERROR;
+    }
+    return CSON_Reader_read_string(reader, n, element);
+  case 0xc6:
+  case 0xdb:
+    if (!CSON_Reader_read_be(reader, 4, &n)) {
+      return CSON_ERROR;
+    }
+    return CSON_Reader_read_string(reader, n, element);
+  case 0xca: {
+    float f;
+    uint32_t bits;
+    if (!CSON_Reader_read_be(reader, 4, &n)) {
+      return CSON_ERROR;
+    }
+    bits = (uint32_t)n;
+    memcpy(&f, &bits, sizeof(f));
+    *element = CSON_Number_new(f);
+    return CSON_SUCCES;
+  }
+  case 0xcb: {
+    double d;
+    if (!CSON_Reader_read_be(reader, 8, &n)) {
+      return CSON_ERROR;
+    }
+    memcpy(&d, &n, sizeof(d));
+    *element = CSON_Number_new(d);
+    return CSON_SUCCES;
+  }
+  case 0xdc:
+  case 0xdd:
+    if (!CSON_Reader_read_be(reader, tag == 0xdc ? 2 : 4, &n)) {
+      return CSON_ERROR;
+    }
+    return CSON_msgpack_read_array(reader, n, element);
+  case 0xde:
+  case 0xdf:
+    if (!CSON_Reader_read_be(reader, tag == 0xde ? 2 : 4, &n)) {
+      return CSON_ERROR;
+    }
+    return CSON_msgpack_read_map(reader, n, element);
+  case 0xcc:
+  case 0xcd:
+  case 0xce:
+  case 0xcf:
+    if (!CSON_Reader_read_be(reader, (size_t)1 << (tag - 0xcc), &n)) {
+      return CSON_ERROR;
+    }
+    *element = CSON_Number_new((double)n);
+    return CSON_SUCCES;
+  case 0xd0:
+  case 0xd1:
+  case 0xd2:
+  case 0xd3: {
+    size_t size = (size_t)1 << (tag - 0xd0);
+    if (!CSON_Reader_read_be(reader, size, &n)) {
+      return CSON_ERROR;
+    }
+    // sign extend the big endian payload
+    int64_t i = size == 8 ? (int64_t)n
+                          : (int64_t)(n ^ ((uint64_t)1 << (size * 8 - 1))) -
+                                ((int64_t)1 << (size * 8 - 1));
+    *element = CSON_Number_new((double)i);
+    return CSON_SUCCES;
+  }
+  default: // extension types have no JSON equivalent
+    return CSON_ERROR;
+  }
+}
+
+CSON_Result CSON_from_msgpack(CSON **cson, const uint8_t *buf, size_t len) {
+  CSON_Reader reader = {.buf = buf, .len = len};
+  CSON element;
+  if (CSON_msgpack_read(&reader, &element) == CSON_ERROR) {
+    return CSON_ERROR;
+  }
+  if (reader.pos != len) {
+    CSON_clear(&element);
+    return CSON_ERROR;
+  }
+  *cson = CSON_root_new(element);
+  return CSON_SUCCES;
+}
+
+// json to msgpack transcoding
+// Containers are written with 32 bit length headers which are patched once
+// the closing token is reached, so no element ever has to be buffered.
+static CSON_Result CSON_json_to_msgpack_element(CSON_Tokenizer *tokenizer,
+                                                CVec *out, size_t depth);
+
+// string payloads carry the decoded text, not the JSON escapes
+static CSON_Result CSON_json_to_msgpack_string(CVec *out, CSON_Token token) {
+  CSON_SV sv;
+  char *buf;
+  if (CSON_Token_string(token, &sv, &buf) == CSON_ERROR) {
+    return CSON_ERROR;
+  }
+  CSON_msgpack_write_string(out, sv.str, sv.len);
+  free(buf);
+  return CSON_SUCCES;
+}
+
+static CSON_Result CSON_json_to_msgpack_container(CSON_Tokenizer *tokenizer,
+                                                  CVec *out, size_t depth,
+                                                  bool is_object) {
+  CSON_TokenType close =
+      is_object ? CSON_TOKENTYPE_CURLY_CLOSE : CSON_TOKENTYPE_SQUARE_CLOSE;
+  size_t head = out->element_count;
+  CSON_write_u8(out, is_object ? 0xdf : 0xdd);
+  CSON_write_be(out, 0, 4);
+
+  uint32_t count = 0;
+  CSON_Token token = CSON_Tokenizer_peek(tokenizer);
+  if (token.type == close) {
+    CSON_Tokenizer_consume(tokenizer);
+  }
+  while (token.type != close) {
+    if (is_object) {
+      token = CSON_Tokenizer_consume(tokenizer);
+      if (token.type != CSON_TOKENTYPE_STRING ||
+          CSON_json_to_msgpack_string(out, token) == CSON_ERROR ||
+          CSON_Tokenizer_consume(tokenizer).type != CSON_TOKENTYPE_COLON) {
+        return CSON_ERROR;
+      }
+    }
+    if (CSON_json_to_msgpack_element(tokenizer, out, depth + 1) ==
+        CSON_ERROR) {
+      return CSON_ERROR;
+    }
+    count++;
+
+    token = CSON_Tokenizer_consume(tokenizer);
+    if (token.type != CSON_TOKENTYPE_COMMA && token.type != close) {
+      return CSON_ERROR;
+    }
+  }
+
+  for (size_t i = 0; i < 4; i++) {
+    out->data[head + 1 + i] = (char)(count >> (8 * (3 - i)));
+  }
+  return CSON_SUCCES;
+}
+
+static CSON_Result CSON_json_to_msgpack_element(CSON_Tokenizer *tokenizer,
+                                                CVec *out, size_t depth) {
+  if (depth >= CSON_MAX_DEPTH) {
+    return CSON_ERROR;
+  }
+  CSON_Token token = CSON_Tokenizer_consume(tokenizer);
+  switch (token.type) {
+  case CSON_TOKENTYPE_CURLY_OPEN:
+    return CSON_json_to_msgpack_container(tokenizer, out, depth, true);
+  case CSON_TOKENTYPE_SQUARE_OPEN:
+    return CSON_json_to_msgpack_container(tokenizer, out, depth, false);
+  case CSON_TOKENTYPE_STRING:
+    return CSON_json_to_msgpack_string(out, token);
+  case CSON_TOKENTYPE_NUMBER: {
+    double d;
+    if (CSON_Token_to_double(token, &d) == CSON_ERROR) {
+      return CSON_ERROR;
+    }
+    CSON_msgpack_write_number(out, d);
+    return CSON_SUCCES;
+  }
+  case CSON_TOKENTYPE_WORD: {
+    if (token.sv.len == 4 && memcmp(token.sv.str, "true", 4) == 0) {
+      CSON_write_u8(out, 0xc3);
+    } else if (token.sv.len == 5 && memcmp(token.sv.str, "false", 5) == 0) {
+      CSON_write_u8(out, 0xc2);
+    } else if (token.sv.len == 4 && memcmp(token.sv.str, "null", 4) == 0) {
+      CSON_write_u8(out, 0xc0);
+    } else {
+      return CSON_ERROR;
+    }
+    return CSON_SUCCES;
+  }
+  default:
+    return CSON_ERROR;
+  }
+}
+
+CSON_Result CSON_json_to_msgpack(char *cstr, CVec *out) {
+  assert(out->element_size == 1 && "output must be a byte vector");
+  size_t start = out->element_count;
+  CSON_Tokenizer tokenizer;
+  CSON_SV_init(&tokenizer.sv, cstr);
+  if (CSON_json_to_msgpack_element(&tokenizer, out, 0) == CSON_ERROR) {
+    out->element_count = start; // drop partial output
+    return CSON_ERROR;
+  }
+  return CSON_SUCCES;
+}
+
+// cbor
+static void CSON_cbor_write_head(CVec *out, uint8_t major, uint64_t value) {
+  major <<= 5;
+  if (value < 24) {
+    CSON_write_u8(out, major | (uint8_t)value);
+  } else if (value <= 0xff) {
+    CSON_write_u8(out, major | 24);
+    CSON_write_be(out, value, 1);
+  } else if (value <= 0xffff) {
+    CSON_write_u8(out, major | 25);
+    CSON_write_be(out, value, 2);
+  } else if (value <= 0xffffffff) {
+    CSON_write_u8(out, major | 26);
+    CSON_write_be(out, value, 4);
+  } else {
+    CSON_write_u8(out, major | 27);
+    CSON_write_be(out, value, 8);
+  }
+}
+
+CSON_Result CSON_to_cbor(CSON *cson, CVec *out) {
+  assert(out->element_size == 1 && "output must be a byte vector");
+  switch (cson->type) {
+  case CSON_FALSE:
+    CSON_write_u8(out, 0xf4);
+    return CSON_SUCCES;
+  case CSON_TRUE:
+    CSON_write_u8(out, 0xf5);
+    return CSON_SUCCES;
+  case CSON_NULL:
+    CSON_write_u8(out, 0xf6);
+    return CSON_SUCCES;
+  case CSON_NUMBER: {
+    double d = CSON_get_number(cson);
+    int64_t i;
+    if (!CSON_double_is_int(d, &i) || (i == 0 && signbit(d))) {
+      CSON_write_u8(out, 0xfb);
+      CSON_write_be(out, CSON_double_bits(d), 8);
+    } else if (i >= 0) {
+      CSON_cbor_write_head(out, 0, (uint64_t)i);
+    } else {
+      CSON_cbor_write_head(out, 1, (uint64_t)(-1 - i));
+    }
+    return CSON_SUCCES;
+  }
+  case CSON_STRING: {
+    CSON_SV sv = CSON_string_sv(cson);
+    CSON_cbor_write_head(out, 3, sv.len);
+    CVec_append(out, sv.str, sv.len);
+    return CSON_SUCCES;
+  }
+  case CSON_ARRAY: {
+    CSON_Array *array = cson->as.array;
+    CSON_cbor_write_head(out, 4, array->data.element_count);
+    for (size_t i = 0; i < array->data.element_count; i++) {
+      if (CSON_to_cbor(CSON_get_by_index(cson, i), out) == CSON_ERROR) {
+        return CSON_ERROR;
+      }
+    }
+    return CSON_SUCCES;
+  }
+  case CSON_OBJECT: {
+    CSON_Object *object = cson->as.object;
+    size_t count = CSON_Object_count(object);
+    CSON_cbor_write_head(out, 5, count);
+    for (size_t i = 0; i < count; i++) {
+      if (CSON_to_cbor(&CSON_Object_key_at(object, i)->string, out) ==
+              CSON_ERROR ||
+          CSON_to_cbor(CSON_Object_value_at(object, i), out) == CSON_ERROR) {
+        return CSON_ERROR;
+      }
+    }
+    return CSON_SUCCES;
+  }
+  }
+  return CSON_ERROR;
+}
+
+#define CSON_CBOR_INDEFINITE UINT64_MAX
+
+static CSON_Result CSON_cbor_read(CSON_Reader *reader, CSON *element);
+
+// indefinite length containers are terminated by a break (0xff) byte
+static bool CSON_cbor_at_end(CSON_Reader *reader, uint64_t i, uint64_t n) {
+  if (n != CSON_CBOR_INDEFINITE) {
+    return i == n;
+  }
+  if (reader->pos < reader->len && reader->buf[reader->pos] == 0xff) {
+    reader->pos++;
+    return true;
+  }
+  return false;
+}
+
+static CSON_Result CSON_cbor_read_array(CSON_Reader *reader, uint64_t n,
+                                        CSON *element) {
+  CSON array = CSON_Array_new();
+  if (n != CSON_CBOR_INDEFINITE) {
+    CSON_Array_reserve(array.as.array, CSON_Reader_capacity_hint(reader, n));
+  }
+  reader->depth++;
+  for (uint64_t i = 0; !CSON_cbor_at_end(reader, i, n); i++) {
+    CSON value;
+    if (CSON_cbor_read(reader, &value) == CSON_ERROR) {
+      CSON_clear(&array);
+      return CSON_ERROR;
+    }
+    CSON_Array_append(array.as.array, &value);
+  }
+  reader->depth--;
+  *element = array;
+  return CSON_SUCCES;
+}
+
+static CSON_Result CSON_cbor_read_map(CSON_Reader *reader, uint64_t n,
+                                      CSON *element) {
+  CSON object = CSON_Object_new();
+  if (n != CSON_CBOR_INDEFINITE) {
+    CSON_Object_reserve(object.as.object, CSON_Reader_capacity_hint(reader, n));
+  }
+  reader->depth++;
+  for (uint64_t i = 0; !CSON_cbor_at_end(reader, i, n); i++) {
+    CSON key, value;
+    if (CSON_cbor_read(reader, &key) == CSON_ERROR) {
+      goto DECODE_ERROR;
+    }
+    if (!CSON_is_string(&key) || CSON_cbor_read(reader, &value) == CSON_ERROR) {
+      CSON_clear(&key);
+      goto DECODE_ERROR;
+    }
+    CSON_Object_insert(object.as.object, &key, &value);
+  }
+  reader->depth--;
+  *element = object;
+  return CSON_SUCCES;
+DECODE_ERROR:
+  CSON_clear(&object);
+  return CSON_ERROR;
+}
+
+static CSON_Result CSON_cbor_read(CSON_Reader *reader, CSON *element) {
+  uint64_t head, value;
+  if (!CSON_Reader_read_be(reader, 1, &head) ||
+      reader->depth >= CSON_MAX_DEPTH) {
+    return CSON_ERROR;
+  }
+  uint8_t major = head >> 5;
+  uint8_t info = head & 0x1f;
+
+  if (info < 24) {
+    value = info;
+  } else if (info <= 27) {
+    if (!CSON_Reader_read_be(reader, (size_t)1 << (info - 24), &value)) {
+      return CSON_ERROR;
+    }
+  } else if (info == 31 && (major == 4 || major == 5)) {
+    value = CSON_CBOR_INDEFINITE;
+  } else {
+    return CSON_ERROR; // reserved or unsupported indefinite string
+  }
+
+  switch (major) {
+  case 0:
+    *element = CSON_Number_new((double)value);
+    return CSON_SUCCES;
+  case 1:
+    *element = CSON_Number_new(-1.0 - (double)value);
+    return CSON_SUCCES;
+  case 2: // byte strings are decoded as strings
+  case 3:
+    return CSON_Reader_read_string(reader, value, element);
+  case 4:
+    return CSON_cbor_read_array(reader, value, element);
+  case 5:
+    return CSON_cbor_read_map(reader, value, element);
+  case 6: { // tags carry no meaning in JSON, decode the tagged item
+    reader->depth++;
+    CSON_Result res = CSON_cbor_read(reader, element);
+    reader->depth--;
+    return res;
+  }
+  case 7:
+    break;
+  }
+
+  switch (info) {
+  case 20:
+    *element = CSON_Literal_new(CSON_FALSE);
+    return CSON_SUCCES;
+  case 21:
+    *element = CSON_Literal_new(CSON_TRUE);
+    return CSON_SUCCES;
+  case 22:
+  case 23: // undefined
+    *element = CSON_Literal_new(CSON_NULL);
+    return CSON_SUCCES;
+  case 25:
+    *element = CSON_Number_new(CSON_half_to_double((uint16_t)value));
+    return CSON_SUCCES;
+  case 26: {
+    float f;
+    uint32_t bits = (uint32_t)value;
+    memcpy(&f, &bits, sizeof(f));
+    *element = CSON_Number_new(f);
+    return CSON_SUCCES;
+  }
+  case 27: {
+    double d;
+    memcpy(&d, &value, sizeof(d));
+    *element = CSON_Number_new(d);
+    return CSON_SUCCES;
+  }
   default:
+    return CSON_ERROR;
+  }
+}
+
+CSON_Result CSON_from_cbor(CSON **cson, const uint8_t *buf, size_t len) {
+  CSON_Reader reader = {.buf = buf, .len = len};
+  CSON element;
+  if (CSON_cbor_read(&reader, &element) == CSON_ERROR) {
+    return CSON_ERROR;
+  }
+  if (reader.pos != len) {
+    CSON_clear(&element);
+    return CSON_ERROR;
+  }
+  *cson = CSON_root_new(element);
+  return CSON_SUCCES;
+}
+
+// struct binding
+static CSON_Result CSON_skip_element(CSON_Tokenizer *tokenizer) {
+  CSON_Tokenizer_skip_ws(tokenizer);
+  const char *next =
+      CSON_skip_value(tokenizer->sv.str, tokenizer->sv.str + tokenizer->sv.len);
+  if (!next) {
+    return CSON_ERROR;
+  }
+  CSON_Tokenizer_advance(tokenizer, (size_t)(next - tokenizer->sv.str));
+  return CSON_SUCCES;
+}
+
+static CSON_Result CSON_decode_object(CSON_Tokenizer *tokenizer,
+                                      const CSON_FieldDesc *fields,
+                                      char *out, size_t depth);
+
+static CSON_Result CSON_decode_value(CSON_Tokenizer *tokenizer,
+                                     const CSON_FieldDesc *field, char *dst,
+                                     size_t depth) {
+  if (depth >= CSON_MAX_DEPTH) {
+    return CSON_ERROR;
+  }
+  CSON_Token token = CSON_Tokenizer_peek(tokenizer);
+  if (token.type == CSON_TOKENTYPE_WORD && token.sv.len == 4 &&
+      memcmp(token.sv.str, "null", 4) == 0) {
+    CSON_Tokenizer_consume(tokenizer);
+    return CSON_SUCCES; // null keeps the previous value
+  }
+
+  switch (field->type) {
+  case CSON_FIELD_BOOL: {
+    bool b;
+    if (CSON_read_bool(tokenizer, &b) == CSON_ERROR) {
+      return CSON_ERROR;
+    }
+    memcpy(dst, &b, sizeof(b));
+    return CSON_SUCCES;
+  }
+  case CSON_FIELD_DOUBLE: {
+    double d;
+    if (CSON_read_double(tokenizer, &d) == CSON_ERROR) {
+      return CSON_ERROR;
+    }
+    if (field->size == sizeof(float)) {
+      float f = (float)d;
+      memcpy(dst, &f, sizeof(f));
+    } else {
+      memcpy(dst, &d, sizeof(d));
+    }
+    return CSON_SUCCES;
+  }
+  case CSON_FIELD_INT: {
+    // read exactly, a double would round values beyond 2^53
+    token = CSON_Tokenizer_consume(tokenizer);
+    int64_t i;
+    if (field->size > sizeof(int64_t) || token.type != CSON_TOKENTYPE_NUMBER ||
+        CSON_Token_to_int64(token, &i) == CSON_ERROR) {
+      return CSON_ERROR;
+    }
+    if (field->size < sizeof(int64_t)) {
+      int64_t bound = INT64_C(1) << (field->size * 8 - 1);
+      if (i < -bound || i >= bound) {
+        return CSON_ERROR;
+      }
+    }
+    if (field->size == 1) {
+      int8_t v = (int8_t)i;
+      memcpy(dst, &v, 1);
+    } else if (field->size == 2) {
+      int16_t v = (int16_t)i;
+      memcpy(dst, &v, 2);
+    } else if (field->size == 4) {
+      int32_t v = (int32_t)i;
+      memcpy(dst, &v, 4);
+    } else {
+      memcpy(dst, &i, 8);
+    }
+    return CSON_SUCCES;
+  }
+  case CSON_FIELD_STRING: {
+    token = CSON_Tokenizer_consume(tokenizer);
+    CSON_SV sv;
+    char *buf;
+    if (token.type != CSON_TOKENTYPE_STRING ||
+        CSON_Token_string(token, &sv, &buf) == CSON_ERROR) {
+      return CSON_ERROR;
+    }
+    CSON_Result res = sv.len < field->size ? CSON_SUCCES : CSON_ERROR;
+    if (res == CSON_SUCCES) {
+      memcpy(dst, sv.str, sv.len);
+      dst[sv.len] = '\0';
+    }
+    free(buf);
+    return res;
+  }
+  case CSON_FIELD_STRING_DUP: {
+    token = CSON_Tokenizer_consume(tokenizer);
+    if (token.type != CSON_TOKENTYPE_STRING) {
+      return CSON_ERROR;
+    }
+    char *str = malloc(token.sv.len + 1);
+    assert(str && "No ram?");
+    size_t len = CSON_unescape(token.sv, str);
+    if (len == SIZE_MAX) {
+      free(str);
+      return CSON_ERROR;
+    }
+    str[len] = '\0';
+    char *previous;
+    memcpy(&previous, dst, sizeof(previous));
+    free(previous); // replace a value decoded earlier
+    memcpy(dst, &str, sizeof(str));
+    return CSON_SUCCES;
+  }
+  case CSON_FIELD_OBJECT:
+    if (CSON_Tokenizer_consume(tokenizer).type != CSON_TOKENTYPE_CURLY_OPEN) {
+      return CSON_ERROR;
+    }
+    return CSON_decode_object(tokenizer, field->fields, dst, depth + 1);
+  case CSON_FIELD_ARRAY: {
+    const CSON_FieldDesc *element = &field->fields[0];
+    size_t capacity = field->size / element->size;
+    size_t count = 0;
+    if (CSON_Tokenizer_consume(tokenizer).type != CSON_TOKENTYPE_SQUARE_OPEN) {
+      return CSON_ERROR;
+    }
+    token = CSON_Tokenizer_peek(tokenizer);
+    if (token.type == CSON_TOKENTYPE_SQUARE_CLOSE) {
+      CSON_Tokenizer_consume(tokenizer);
+    }
+    // the count is stored on every exit once elements may have been written,
+    // so CSON_decode_free reaches their strings after an error too
+    CSON_Result res = CSON_SUCCES;
+    while (token.type != CSON_TOKENTYPE_SQUARE_CLOSE) {
+      if (count == capacity) {
+        res = CSON_ERROR;
+        break;
+      }
+      res = CSON_decode_value(tokenizer, element,
+                              dst + count * element->size, depth + 1);
+      count++; // a failed element may hold part of its allocations
+      if (res == CSON_ERROR) {
+        break;
+      }
+      token = CSON_Tokenizer_consume(tokenizer);
+      if (token.type != CSON_TOKENTYPE_COMMA &&
+          token.type != CSON_TOKENTYPE_SQUARE_CLOSE) {
+        res = CSON_ERROR;
+        break;
+      }
+    }
+    memcpy(dst - field->offset + field->count_offset, &count, sizeof(count));
+    return res;
+  }
+  }
+  return CSON_ERROR;
+}
+
+static CSON_Result CSON_decode_object(CSON_Tokenizer *tokenizer,
+                                      const CSON_FieldDesc *fields,
+                                      char *out, size_t depth) {
+  size_t field_count = 0;
+  while (fields[field_count].name) {
+    field_count++;
+  }
+  if (field_count > CSON_MAX_FIELDS) {
+    return CSON_ERROR; // seen has one bit per field
+  }
+  uint64_t seen = 0;
+  CSON_Token token = CSON_Tokenizer_peek(tokenizer);
+  if (token.type == CSON_TOKENTYPE_CURLY_CLOSE) {
+    CSON_Tokenizer_consume(tokenizer);
+  }
+  while (token.type != CSON_TOKENTYPE_CURLY_CLOSE) {
+    CSON_Token key = CSON_Tokenizer_consume(tokenizer);
+    if (key.type != CSON_TOKENTYPE_STRING ||
+        CSON_Tokenizer_consume(tokenizer).type != CSON_TOKENTYPE_COLON) {
+      return CSON_ERROR;
+    }
+    size_t i = 0;
+    while (fields[i].name && !(strlen(fields[i].name) == key.sv.len &&
+                               memcmp(fields[i].name, key.sv.str,
+                                      key.sv.len) == 0)) {
+      i++;
+    }
+    CSON_Result res =
+        fields[i].name
+            ? CSON_decode_value(tokenizer, &fields[i],
+                                out + fields[i].offset, depth)
+            : CSON_skip_element(tokenizer); // unknown members
+    if (res == CSON_ERROR) {
+      return CSON_ERROR;
+    }
+    seen |= fields[i].name ? UINT64_C(1) << i : 0;
+
+    token = CSON_Tokenizer_consume(tokenizer);
+    if (token.type != CSON_TOKENTYPE_COMMA &&
+        token.type != CSON_TOKENTYPE_CURLY_CLOSE) {
+      return CSON_ERROR;
+    }
+  }
+  for (size_t i = 0; i < field_count; i++) {
+    if (!(seen & (UINT64_C(1) << i)) &&
+        !(fields[i].flags & CSON_FIELD_OPTIONAL)) {
+      return CSON_ERROR;
+    }
+  }
+  return CSON_SUCCES;
+}
+
+// Decode the JSON object in cstr into out, nothing is allocated unless the
+// descriptors contain CSON_FIELD_STRING_DUP fields. On error out may have been
+// partially written, CSON_decode_free releases its strings after either
+// result. The string a CSON_FIELD_STRING_DUP field already holds is
+// freed before a new one is stored, so out must be zero initialized or hold
+// the result of an earlier CSON_decode with the same descriptors.
+CSON_Result CSON_decode(char *cstr, const CSON_FieldDesc *fields, void *out) {
+  CSON_Tokenizer tokenizer;
+  CSON_SV_init(&tokenizer.sv, cstr);
+  if (CSON_Tokenizer_consume(&tokenizer).type != CSON_TOKENTYPE_CURLY_OPEN) {
+    return CSON_ERROR;
+  }
+  return CSON_decode_object(&tokenizer, fields, out, 0);
+}
+
+// release the strings of CSON_FIELD_STRING_DUP fields, they must have been
+// zero initialized before decoding
+void CSON_decode_free(const CSON_FieldDesc *fields, void *out) {
+  for (size_t i = 0; fields[i].name; i++) {
+    char *dst = (char *)out + fields[i].offset;
+    switch (fields[i].type) {
+    case CSON_FIELD_STRING_DUP: {
+      char *str;
+      memcpy(&str, dst, sizeof(str));
+      free(str);
+      str = NULL;
+      memcpy(dst, &str, sizeof(str));
+    } break;
+    case CSON_FIELD_OBJECT:
+      CSON_decode_free(fields[i].fields, dst);
+      break;
+    case CSON_FIELD_ARRAY: {
+      const CSON_FieldDesc *element = &fields[i].fields[0];
+      if (element->type != CSON_FIELD_STRING_DUP &&
+          element->type != CSON_FIELD_OBJECT) {
+        break;
+      }
+      size_t count;
+      memcpy(&count, (char *)out + fields[i].count_offset, sizeof(count));
+      for (size_t j = 0; j < count; j++) {
+        char *item = dst + j * element->size;
+        if (element->type == CSON_FIELD_OBJECT) {
+          CSON_decode_free(element->fields, item);
+        } else {
+          char *str;
+          memcpy(&str, item, sizeof(str));
+          free(str);
+          str = NULL;
+          memcpy(item, &str, sizeof(str));
+        }
+      }
+    } break;
+    default:
+      break;
+    }
+  }
+}
+
+// generated struct binding
+CSON_Result CSON_Tokenizer_skip_value(CSON_Tokenizer *tokenizer) {
+  return CSON_skip_element(tokenizer);
+}
+
+static bool CSON_Tokenizer_skip_null(CSON_Tokenizer *tokenizer) {
+  CSON_Token token = CSON_Tokenizer_peek(tokenizer);
+  if (token.type == CSON_TOKENTYPE_WORD && token.sv.len == 4 &&
+      memcmp(token.sv.str, "null", 4) == 0) {
+    CSON_Tokenizer_consume(tokenizer);
+    return true;
+  }
+  return false;
+}
+
+CSON_Result CSON_read_bool(CSON_Tokenizer *tokenizer, bool *out) {
+  if (CSON_Tokenizer_skip_null(tokenizer)) {
+    return CSON_SUCCES;
+  }
+  CSON_Token token = CSON_Tokenizer_consume(tokenizer);
+  bool b = token.sv.len == 4 && memcmp(token.sv.str, "true", 4) == 0;
+  if (token.type != CSON_TOKENTYPE_WORD ||
+      (!b && !(token.sv.len == 5 && memcmp(token.sv.str, "false", 5) == 0))) {
+    return CSON_ERROR;
+  }
+  *out = b;
+  return CSON_SUCCES;
+}
+
+CSON_Result CSON_read_double(CSON_Tokenizer *tokenizer, double *out) {
+  if (CSON_Tokenizer_skip_null(tokenizer)) {
+    return CSON_SUCCES;
+  }
+  CSON_Token token = CSON_Tokenizer_consume(tokenizer);
+  if (token.type != CSON_TOKENTYPE_NUMBER ||
+      CSON_Token_to_double(token, out) == CSON_ERROR) {
+    return CSON_ERROR;
+  }
+  return CSON_SUCCES;
+}
+
+// integers without fraction or exponent are read exactly, others go through
+// double
+CSON_Result CSON_read_int64(CSON_Tokenizer *tokenizer, int64_t *out) {
+  if (CSON_Tokenizer_skip_null(tokenizer)) {
+    return CSON_SUCCES;
+  }
+  CSON_Token token = CSON_Tokenizer_consume(tokenizer);
+  if (token.type != CSON_TOKENTYPE_NUMBER ||
+      CSON_Token_to_int64(token, out) == CSON_ERROR) {
+    return CSON_ERROR;
+  }
+  return CSON_SUCCES;
+}
+
+CSON_Result CSON_read_int32(CSON_Tokenizer *tokenizer, int32_t *out) {
+  int64_t i = *out;
+  if (CSON_read_int64(tokenizer, &i) == CSON_ERROR || i < INT32_MIN ||
+      i > INT32_MAX) {
+    return CSON_ERROR;
+  }
+  *out = (int32_t)i;
+  return CSON_SUCCES;
+}
+
+// replaces *out with a malloc'd copy with its escapes decoded, the previous
+// string is freed
+CSON_Result CSON_read_string(CSON_Tokenizer *tokenizer, char **out) {
+  if (CSON_Tokenizer_skip_null(tokenizer)) {
+    return CSON_SUCCES;
+  }
+  CSON_Token token = CSON_Tokenizer_consume(tokenizer);
+  if (token.type != CSON_TOKENTYPE_STRING) {
+    return CSON_ERROR;
+  }
+  char *str = malloc(token.sv.len + 1);
+  assert(str && "No ram?");
+  size_t len = CSON_unescape(token.sv, str);
+  if (len == SIZE_MAX) {
+    free(str);
+    return CSON_ERROR;
+  }
+  str[len] = '\0';
+  free(*out);
+  *out = str;
+  return CSON_SUCCES;
+}
+
+void CSON_write_raw(CVec *out, const char *str) {
+  CVec_append(out, str, strlen(str));
+}
+
+void CSON_write_bool(CVec *out, bool value) {
+  CSON_write_raw(out, value ? "true" : "false");
+}
+
+void CSON_write_int64(CVec *out, int64_t value) {
+  char buf[24];
+  snprintf(buf, sizeof(buf), "%lld", (long long)value);
+  CSON_write_raw(out, buf);
+}
+
+void CSON_write_int32(CVec *out, int32_t value) {
+  CSON_write_int64(out, value);
+}
+
+// integral values are written without fraction, nan and infinities as null,
+// other values with %.17g, which round trips and may use an exponent
+void CSON_write_double(CVec *out, double value) {
+  int64_t i;
+  if (CSON_double_is_int(value, &i) && !(i == 0 && signbit(value))) {
+    CSON_write_int64(out, i);
+    return;
+  }
+  if (isnan(value) || isinf(value)) {
+    CSON_write_raw(out, "null");
+    return;
+  }
+  char buf[32];
+  snprintf(buf, sizeof(buf), "%.17g", value);
+  CSON_write_raw(out, buf);
+}
+
+// a NULL string is written as null, quotes, backslashes and control
+// characters are escaped
+void CSON_write_string(CVec *out, const char *str) {
+  if (!str) {
+    CSON_write_raw(out, "null");
+    return;
+  }
+  CSON_write_raw(out, "\"");
+  const char *run = str;
+  for (; *str; str++) {
+    unsigned char c = (unsigned char)*str;
+    if (c != '"' && c != '\\' && c >= 0x20) {
+      continue;
+    }
+    CVec_append(out, run, (size_t)(str - run));
+    run = str + 1;
+    char escape[8];
+    if (c == '"' || c == '\\') {
+      snprintf(escape, sizeof(escape), "\\%c", c);
+    } else if (c == '\n') {
+      snprintf(escape, sizeof(escape), "\\n");
+    } else if (c == '\t') {
+      snprintf(escape, sizeof(escape), "\\t");
+    } else {
+      snprintf(escape, sizeof(escape), "\\u%04x", c);
+    }
+    CSON_write_raw(out, escape);
+  }
+  CVec_append(out, run, (size_t)(str - run));
+  CSON_write_raw(out, "\"");
+}
+
+// paths
+static bool CSON_Path_parse_int(const char **p, int64_t *out) {
+  char *end;
+  long long value = strtoll(*p, &end, 10);
+  if (end == *p) {
+    return false;
+  }
+  *p = end;
+  *out = value;
+  return true;
+}
+
+static bool CSON_Path_push(CVec *steps, CSON_PathStep step) {
+  if (steps->element_count == CSON_PATH_MAX_STEPS) {
+    free(step.key);
+    return false;
+  }
+  CVec_push_back(steps, &step);
+  return true;
+}
+
+static CSON_PathStep CSON_PathStep_key(const char *key, size_t len) {
+  CSON_PathStep step = {.op = CSON_PATH_KEY, .len = len, .index = -1};
+  step.key = malloc(len + 1);
+  assert(step.key && "No ram?");
+  memcpy(step.key, key, len);
+  step.key[len] = '\0';
+  step.hash = CSON_hash_string(key, len);
+  return step;
+}
+
+static bool CSON_Path_compile_pointer(const char *p, CVec *steps) {
+  while (*p == '/') {
+    p++;
+    size_t len = strcspn(p, "/");
+    CSON_PathStep step = CSON_PathStep_key(p, len);
+    size_t j = 0;
+    for (size_t i = 0; i < len; i++, j++) { // ~1 is '/' and ~0 is '~'
+      if (p[i] == '~') {
+        if (p[i + 1] != '0' && p[i + 1] != '1') {
+          free(step.key);
+          return false;
+        }
+        step.key[j] = p[++i] == '0' ? '~' : '/';
+      } else {
+        step.key[j] = p[i];
+      }
+    }
+    step.key[j] = '\0';
+    step.len = j;
+    step.hash = CSON_hash_string(step.key, j);
+    if (j > 0 && j < 19 && strspn(step.key, "0123456789") == j &&
+        (j == 1 || step.key[0] != '0')) {
+      step.index = strtoll(step.key, NULL, 10);
+    }
+    if (!CSON_Path_push(steps, step)) {
+      return false;
+    }
+    p += len;
+  }
+  return *p == '\0';
+}
+
+static bool CSON_Path_compile_query(const char *p, CVec *steps) {
+  while (*p) {
+    bool descend = p[0] == '.' && p[1] == '.';
+    if (descend) {
+      if (!CSON_Path_push(steps, (CSON_PathStep){.op = CSON_PATH_DESCEND})) {
+        return false;
+      }
+      p += 2;
+    } else if (*p == '.') {
+      p++;
+    } else if (*p != '[') {
+      return false;
+    }
+
+    CSON_PathStep step = {.op = CSON_PATH_WILDCARD};
+    if (p[0] == '*' && p[-1] == '.') {
+      p++;
+    } else if (p[0] == '[' && p[1] == '*' && p[2] == ']') {
+      p += 3;
+    } else if (p[0] == '[' && (p[1] == '\'' || p[1] == '\"')) {
+      const char *close = strchr(p + 2, p[1]);
+      if (!close || close[1] != ']') {
+        return false;
+      }
+      step = CSON_PathStep_key(p + 2, (size_t)(close - p - 2));
+      p = close + 2;
+    } else if (p[0] == '[') {
+      p++;
+      step = (CSON_PathStep){.op = CSON_PATH_INDEX,
+                             .start = CSON_PATH_NO_BOUND,
+                             .end = CSON_PATH_NO_BOUND,
+                             .step = 1};
+      bool has_index = CSON_Path_parse_int(&p, &step.index);
+      if (*p == ':') {
+        step.op = CSON_PATH_SLICE;
+        step.start = has_index ? step.index : CSON_PATH_NO_BOUND;
+        p++;
+        CSON_Path_parse_int(&p, &step.end);
+        if (*p == ':') {
+          p++;
+          if (CSON_Path_parse_int(&p, &step.step) && step.step <= 0) {
+            return false;
+          }
+        }
+      } else if (!has_index) {
+        return false;
+      }
+      if (*p++ != ']') {
+        return false;
+      }
+    } else {
+      size_t len = strcspn(p, ".[");
+      if (len == 0) {
+        return false;
+      }
+      step = CSON_PathStep_key(p, len);
+      p += len;
+    }
+    if (!CSON_Path_push(steps, step)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+// returns NULL when expr is not a valid pointer or query
+CSON_Path *CSON_Path_compile(const char *expr) {
+  CVec steps;
+  CVec_init(&steps, sizeof(CSON_PathStep), 0);
+  bool ok = expr[0] == '$' ? CSON_Path_compile_query(expr + 1, &steps)
+                           : CSON_Path_compile_pointer(expr, &steps);
+  CSON_PathStep *data = (CSON_PathStep *)steps.data;
+  size_t count = steps.element_count;
+  if (count && data[count - 1].op == CSON_PATH_DESCEND) {
+    ok = false; // descent needs a step to apply
+  }
+  CSON_Path *path = NULL;
+  if (ok) {
+    path = malloc(sizeof(CSON_Path) + count * sizeof(CSON_PathStep));
+    assert(path && "No ram?");
+    path->count = count;
+    if (count) {
+      memcpy(path->steps, data, count * sizeof(CSON_PathStep));
+    }
+  } else {
+    for (size_t i = 0; i < count; i++) {
+      free(data[i].key);
+    }
+  }
+  CVec_free(&steps);
+  return path;
+}
+
+void CSON_Path_free(CSON_Path *path) {
+  if (!path) {
+    return;
+  }
+  for (size_t i = 0; i < path->count; i++) {
+    free(path->steps[i].key);
+  }
+  free(path);
+}
+
+// resolves a possibly negative bound against count, clamped to [0, count]
+static int64_t CSON_Path_bound(int64_t bound, int64_t fallback,
+                               size_t count) {
+  int64_t n = count > INT64_MAX ? INT64_MAX : (int64_t)count;
+  if (bound == CSON_PATH_NO_BOUND) {
+    return fallback;
+  }
+  if (bound < 0) {
+    bound += n;
+  }
+  return bound < 0 ? 0 : bound > n ? n : bound;
+}
+
+// Does the step select the child at index of a container holding count
+// children? Object members pass their key, array elements a NULL key.
+static bool CSON_PathStep_match(const CSON_PathStep *step, const char *key,
+                                size_t len, size_t index, size_t count) {
+  switch (step->op) {
+  case CSON_PATH_KEY:
+    if (key) {
+      return len == step->len && memcmp(key, step->key, len) == 0;
+    }
+    return step->index >= 0 && (size_t)step->index == index;
+  case CSON_PATH_INDEX: {
+    if (key) {
+      return false;
+    }
+    int64_t i = step->index < 0 ? step->index + (int64_t)count : step->index;
+    return i >= 0 && (size_t)i == index;
+  }
+  case CSON_PATH_WILDCARD:
+    return true;
+  case CSON_PATH_SLICE: {
+    if (key) {
+      return false;
+    }
+    int64_t start = CSON_Path_bound(step->start, 0, count);
+    int64_t end = CSON_Path_bound(step->end, INT64_MAX, count);
+    int64_t i = (int64_t)index;
+    return i >= start && i < end && (i - start) % step->step == 0;
+  }
+  case CSON_PATH_DESCEND:
     break;
   }
-  if ((c >= '0' && c <= '9') || c == '-') {
-    return CSON_TOKENTYPE_NUMBER;
-  } else if ((c >= 'A' && c <= 'Z') || (c >= 'a' || c <= 'z')) {
-    return CSON_TOKENTYPE_WORD;
+  return false;
+}
+
+// Evaluation tracks the set of steps positioned at a value as a bit set, bit
+// count meaning the value is a result. Descent keeps its step active for
+// every child and also lets the following step apply to the value itself.
+static uint64_t CSON_Path_closure(const CSON_Path *path, uint64_t states) {
+  for (size_t i = 0; i < path->count; i++) {
+    if ((states >> i & 1) && path->steps[i].op == CSON_PATH_DESCEND) {
+      states |= UINT64_C(1) << (i + 1);
+    }
+  }
+  return states;
+}
+
+static uint64_t CSON_Path_child_states(const CSON_Path *path,
+                                       uint64_t states, const char *key,
+                                       size_t len, size_t index,
+                                       size_t count) {
+  uint64_t child = 0;
+  for (size_t i = 0; i < path->count; i++) {
+    if (!(states >> i & 1)) {
+      continue;
+    }
+    if (path->steps[i].op == CSON_PATH_DESCEND) {
+      child |= UINT64_C(1) << i;
+    } else if (CSON_PathStep_match(&path->steps[i], key, len, index, count)) {
+      child |= UINT64_C(1) << (i + 1);
+    }
+  }
+  return CSON_Path_closure(path, child);
+}
+
+// returns true once first is set, out collects every match when given
+static bool CSON_Path_visit(const CSON_Path *path, uint64_t states,
+                            CSON *node, CVec *out, CSON **first) {
+  uint64_t result = UINT64_C(1) << path->count;
+  if (states & result) {
+    if (!out) {
+      *first = node;
+      return true;
+    }
+    CVec_push_back(out, &node);
+  }
+  uint64_t rest = states & ~result;
+  if (!rest || (!CSON_is_array(node) && !CSON_is_object(node))) {
+    return false;
+  }
+  size_t single = SIZE_MAX; // the only active step, looked up directly
+  if ((rest & (rest - 1)) == 0) {
+    single = 0;
+    while (!(rest >> single & 1)) {
+      single++;
+    }
+  }
+  const CSON_PathStep *step = single != SIZE_MAX ? &path->steps[single] : NULL;
+
+  if (CSON_is_array(node)) {
+    CVec *data = &node->as.array->data;
+    size_t count = data->element_count;
+    if (step && (step->op == CSON_PATH_INDEX ||
+                 (step->op == CSON_PATH_KEY && step->index >= 0))) {
+      int64_t i = step->index < 0 ? step->index + (int64_t)count : step->index;
+      if (i < 0 || (size_t)i >= count) {
+        return false;
+      }
+      uint64_t child = CSON_Path_closure(path, UINT64_C(1) << (single + 1));
+      return CSON_Path_visit(path, child, (CSON *)data->data + i, out, first);
+    }
+    for (size_t i = 0; i < count; i++) {
+      uint64_t child = CSON_Path_child_states(path, rest, NULL, 0, i, count);
+      if (child &&
+          CSON_Path_visit(path, child, (CSON *)data->data + i, out, first)) {
+        return true;
+      }
+    }
+    return false;
+  }
+
+  CSON_Object *object = node->as.object;
+  size_t count = CSON_Object_count(object);
+  if (step && step->op == CSON_PATH_KEY && !out) {
+    size_t i = CSON_Object_find(object, step->key, step->len, step->hash);
+    return i != SIZE_MAX &&
+           CSON_Path_visit(path,
+                           CSON_Path_closure(path, UINT64_C(1) << (single + 1)),
+                           CSON_Object_value_at(object, i), out, first);
+  }
+  for (size_t i = 0; i < count; i++) {
+    CSON_SV key = CSON_string_sv(&CSON_Object_key_at(object, i)->string);
+    uint64_t child =
+        CSON_Path_child_states(path, rest, key.str, key.len, i, count);
+    if (child && CSON_Path_visit(path, child, CSON_Object_value_at(object, i),
+                                 out, first)) {
+      return true;
+    }
+  }
+  return false;
+}
+
+// the first match in document order or NULL
+CSON *CSON_Path_get(const CSON_Path *path, CSON *root) {
+  CSON *first = NULL;
+  CSON_Path_visit(path, CSON_Path_closure(path, 1), root, NULL, &first);
+  return first;
+}
+
+// appends every match to out, a CVec of CSON*, and returns their number
+size_t CSON_Path_eval(const CSON_Path *path, CSON *root, CVec *out) {
+  size_t before = out->element_count;
+  CSON_Path_visit(path, CSON_Path_closure(path, 1), root, out, NULL);
+  return out->element_count - before;
+}
+
+// number of elements of the array at the tokenizer, SIZE_MAX if malformed
+static size_t CSON_Path_raw_count(CSON_Tokenizer tokenizer) {
+  size_t count = 0;
+  CSON_Tokenizer_consume(&tokenizer);
+  CSON_Token token = CSON_Tokenizer_peek(&tokenizer);
+  if (token.type == CSON_TOKENTYPE_SQUARE_CLOSE) {
+    return 0;
   }
-  return CSON_TOKENTYPE_UNKNOWN;
+  while (token.type != CSON_TOKENTYPE_SQUARE_CLOSE) {
+    if (CSON_skip_element(&tokenizer) == CSON_ERROR) {
+      return SIZE_MAX;
+    }
+    count++;
+    token = CSON_Tokenizer_consume(&tokenizer);
+    if (token.type != CSON_TOKENTYPE_COMMA &&
+        token.type != CSON_TOKENTYPE_SQUARE_CLOSE) {
+      return SIZE_MAX;
+    }
+  }
+  return count;
 }
 
-CSON_Token CSON_Tokenizer_consume(CSON_Tokenizer *tokenizer) {
+static CSON_Result CSON_Path_visit_raw(const CSON_Path *path, uint64_t states,
+                                       CSON_Tokenizer *tokenizer, CVec *out,
+                                       size_t depth) {
+  if (depth >= CSON_MAX_DEPTH) {
+    return CSON_ERROR;
+  }
+  uint64_t result = UINT64_C(1) << path->count;
+  uint64_t rest = states & ~result;
+  CSON_Tokenizer_skip_ws(tokenizer);
+  char *start = tokenizer->sv.str;
+  size_t slot = SIZE_MAX;
+  if (states & result) {
+    slot = out->element_count;
+    CSON_SV sv = {.str = start, .len = 0};
+    CVec_push_back(out, &sv);
+  }
+
   CSON_Token token = CSON_Tokenizer_peek(tokenizer);
-  tokenizer->sv.str += token.sv.len;
-  if (token.type == CSON_TOKENTYPE_STRING) {
-    tokenizer->sv.str += 2; // increment by two to account for quote chars of
-                            // STRING type (quotes are not included in string)
+  bool is_object = token.type == CSON_TOKENTYPE_CURLY_OPEN;
+  if (!rest || (!is_object && token.type != CSON_TOKENTYPE_SQUARE_OPEN)) {
+    if (CSON_skip_element(tokenizer) == CSON_ERROR) {
+      return CSON_ERROR;
+    }
+  } else {
+    // negative indices and slice bounds need the length up front
+    size_t count = SIZE_MAX;
+    for (size_t i = 0; !is_object && i < path->count; i++) {
+      const CSON_PathStep *step = &path->steps[i];
+      if ((rest >> i & 1) &&
+          ((step->op == CSON_PATH_INDEX && step->index < 0) ||
+           (step->op == CSON_PATH_SLICE &&
+            ((step->start < 0 && step->start != CSON_PATH_NO_BOUND) ||
+             (step->end < 0 && step->end != CSON_PATH_NO_BOUND))))) {
+        count = CSON_Path_raw_count(*tokenizer);
+        break;
+      }
+    }
+    CSON_TokenType close =
+        is_object ? CSON_TOKENTYPE_CURLY_CLOSE : CSON_TOKENTYPE_SQUARE_CLOSE;
+    CSON_Tokenizer_consume(tokenizer);
+    token = CSON_Tokenizer_peek(tokenizer);
+    if (token.type == close) {
+      CSON_Tokenizer_consume(tokenizer);
+    }
+    for (size_t i = 0; token.type != close; i++) {
+      CSON_Token key = {0};
+      if (is_object) {
+        key = CSON_Tokenizer_consume(tokenizer);
+        if (key.type != CSON_TOKENTYPE_STRING ||
+            CSON_Tokenizer_consume(tokenizer).type != CSON_TOKENTYPE_COLON) {
+          return CSON_ERROR;
+        }
+      }
+      uint64_t child = CSON_Path_child_states(
+          path, rest, is_object ? key.sv.str : NULL, key.sv.len, i, count);
+      CSON_Result res =
+          child ? CSON_Path_visit_raw(path, child, tokenizer, out, depth + 1)
+                : CSON_skip_element(tokenizer);
+      if (res == CSON_ERROR) {
+        return CSON_ERROR;
+      }
+      token = CSON_Tokenizer_consume(tokenizer);
+      if (token.type != CSON_TOKENTYPE_COMMA && token.type != close) {
+        return CSON_ERROR;
+      }
+    }
   }
-  return token;
+  if (slot != SIZE_MAX) {
+    ((CSON_SV *)out->data)[slot].len = (size_t)(tokenizer->sv.str - start);
+  }
+  return CSON_SUCCES;
 }
 
-CSON_Token CSON_Tokenizer_peek(CSON_Tokenizer *tokenizer) {
-  CSON_Token token = {0};
-  token.sv.str = tokenizer->sv.str;
-  token.type = CSON_Tokenizer_identify_token_type(token.sv.str[0]);
+// Evaluates the path over the JSON text without building a DOM, subtrees no
+// step can select are skipped. Appends the source text of every match, as a
+// CSON_SV into cstr, to out. On error out is left as it was.
+CSON_Result CSON_Path_eval_raw(const CSON_Path *path, char *cstr, CVec *out) {
+  size_t before = out->element_count;
+  CSON_Tokenizer tokenizer;
+  CSON_SV_init(&tokenizer.sv, cstr);
+  if (CSON_Path_visit_raw(path, CSON_Path_closure(path, 1), &tokenizer, out,
+                          0) == CSON_ERROR ||
+      CSON_Tokenizer_peek(&tokenizer).type != CSON_TOKENTYPE_EOF) {
+    out->element_count = before;
+    return CSON_ERROR;
+  }
+  return CSON_SUCCES;
+}
 
-  switch (token.type) {
-  case CSON_TOKENTYPE_EOF:
-    return token;
-  case CSON_TOKENTYPE_CURLY_OPEN:
-  case CSON_TOKENTYPE_CURLY_CLOSE:
-  case CSON_TOKENTYPE_SQUARE_OPEN:
-  case CSON_TOKENTYPE_SQUARE_CLOSE:
-  case CSON_TOKENTYPE_COMMA:
-  case CSON_TOKENTYPE_COLON: {
-    token.sv.len = 1;
-    return token;
+// handles
+// Waiting threads spin for a short while, then give up their time slice so a
+// writer does not starve the readers it waits for on a busy machine.
+static void CSON_Handle_backoff(unsigned *spins) {
+  if (*spins < 64) {
+    (*spins)++;
+    return;
   }
-  case CSON_TOKENTYPE_WS: {
-    size_t i = 1;
-    while (CSON_Tokenizer_identify_token_type(token.sv.str[i]) ==
-           CSON_TOKENTYPE_WS) {
-      i++;
-    }
-    token.sv.len = i;
-    return token;
+#ifdef _WIN32
+  SwitchToThread();
+#else
+  sched_yield();
+#endif
+}
+
+void CSON_Handle_init(CSON_Handle *handle, CSON *root) {
+  atomic_init(&handle->current, root);
+  atomic_init(&handle->epoch, 0);
+  atomic_init(&handle->readers[0], 0);
+  atomic_init(&handle->readers[1], 0);
+  atomic_flag_clear(&handle->writing);
+  handle->retire = NULL;
+  handle->context = NULL;
+}
+
+static void CSON_Handle_retire(CSON_Handle *handle, CSON *root) {
+  if (!root) {
+    return;
   }
-  case CSON_TOKENTYPE_STRING: {
-    token.sv.str++;
-    size_t i = 1;
-    while (token.sv.str[i] != '\"') {
-      if (token.sv.str[i] == '\0') {
-        token.type = CSON_TOKENTYPE_EOF;
-        token.sv.len = 0;
-        return token;
-      }
-      i++;
+  if (handle->retire) {
+    handle->retire(root, handle->context);
+  } else {
+    CSON_free(root);
+  }
+}
+
+// retires the current root, no reader may be active
+void CSON_Handle_free(CSON_Handle *handle) {
+  CSON_Handle_retire(handle, atomic_exchange(&handle->current, NULL));
+}
+
+// The root stays valid until CSON_Handle_release is called with the ticket.
+CSON *CSON_Handle_acquire(CSON_Handle *handle, size_t *ticket) {
+  for (;;) {
+    size_t epoch = atomic_load(&handle->epoch);
+    atomic_fetch_add(&handle->readers[epoch & 1], 1);
+    if (atomic_load(&handle->epoch) == epoch) {
+      *ticket = epoch & 1;
+      return atomic_load(&handle->current);
     }
-    token.sv.len = i;
-    return token;
+    // a publish flipped the epoch in between, register with the new one
+    atomic_fetch_sub(&handle->readers[epoch & 1], 1);
   }
-  case CSON_TOKENTYPE_NUMBER: {
-    size_t i = 1;
-    char c = token.sv.str[i];
-    while (((c >= '0' && c <= '9') || c == '.') && c != '\0') {
-      i++;
-      c = token.sv.str[i];
+}
+
+void CSON_Handle_release(CSON_Handle *handle, size_t ticket) {
+  atomic_fetch_sub(&handle->readers[ticket], 1);
+}
+
+// Takes ownership of root. Readers registered before the epoch flip may hold
+// the old root, readers registered after it only see the new one.
+void CSON_Handle_publish(CSON_Handle *handle, CSON *root) {
+  unsigned spins = 0;
+  while (atomic_flag_test_and_set(&handle->writing)) {
+    CSON_Handle_backoff(&spins);
+  }
+  CSON *old = atomic_exchange(&handle->current, root);
+  size_t epoch = atomic_fetch_add(&handle->epoch, 1);
+  spins = 0;
+  while (atomic_load(&handle->readers[epoch & 1]) != 0) {
+    CSON_Handle_backoff(&spins);
+  }
+  atomic_flag_clear(&handle->writing);
+  CSON_Handle_retire(handle, old);
+}
+
+// tape
+static uint64_t CSON_tape_word(CSON_TapeTag tag, uint64_t payload) {
+  return ((uint64_t)tag << 56) | (payload & CSON_TAPE_PAYLOAD_MASK);
+}
+
+static CSON_Result CSON_Tape_parse_element(CSON_Tokenizer *tokenizer,
+                                           CVec *words, CVec *strings,
+                                           size_t depth);
+
+// the string buffer holds the text with its escapes decoded
+static CSON_Result CSON_Tape_push_string(CVec *words, CVec *strings,
+                                         CSON_SV sv) {
+  if (sv.len > UINT32_MAX) {
+    return CSON_ERROR;
+  }
+  size_t offset = strings->element_count;
+  uint32_t len = (uint32_t)sv.len;
+  CVec_append(strings, &len, sizeof(len));
+  CVec_append(strings, sv.str, sv.len);
+  if (memchr(sv.str, '\\', sv.len)) {
+    CSON_SV text = {.str = strings->data + offset + sizeof(len),
+                    .len = sv.len};
+    size_t decoded = CSON_unescape(text, text.str); // in place
+    if (decoded == SIZE_MAX) {
+      return CSON_ERROR;
     }
-    token.sv.len = i;
-    return token;
+    len = (uint32_t)decoded;
+    memcpy(strings->data + offset, &len, sizeof(len));
+    strings->element_count = offset + sizeof(len) + decoded;
   }
-  case CSON_TOKENTYPE_WORD: {
-    size_t i = 1;
-    char c = token.sv.str[i];
-    while (CSON_Tokenizer_identify_token_type(c) == CSON_TOKENTYPE_WORD) {
-      i++;
-      c = token.sv.str[i];
+  CVec_append(strings, "", 1);
+  uint64_t word = CSON_tape_word(CSON_TAPE_STRING, offset);
+  CVec_push_back(words, &word);
+  return CSON_SUCCES;
+}
+
+static CSON_Result CSON_Tape_parse_container(CSON_Tokenizer *tokenizer,
+                                             CVec *words, CVec *strings,
+                                             size_t depth, bool is_object) {
+  CSON_TokenType close =
+      is_object ? CSON_TOKENTYPE_CURLY_CLOSE : CSON_TOKENTYPE_SQUARE_CLOSE;
+  size_t open = words->element_count;
+  uint64_t word = 0;
+  CVec_push_back(words, &word); // patched once the close index is known
+
+  uint64_t count = 0;
+  CSON_Token token = CSON_Tokenizer_peek(tokenizer);
+  if (token.type == close) {
+    CSON_Tokenizer_consume(tokenizer);
+  }
+  while (token.type != close) {
+    if (is_object) {
+      token = CSON_Tokenizer_consume(tokenizer);
+      if (token.type != CSON_TOKENTYPE_STRING ||
+          CSON_Tokenizer_consume(tokenizer).type != CSON_TOKENTYPE_COLON ||
+          CSON_Tape_push_string(words, strings, token.sv) == CSON_ERROR) {
+        return CSON_ERROR;
+      }
+    }
+    if (CSON_Tape_parse_element(tokenizer, words, strings, depth + 1) ==
+        CSON_ERROR) {
+      return CSON_ERROR;
+    }
+    count++;
+
+    token = CSON_Tokenizer_consume(tokenizer);
+    if (token.type != CSON_TOKENTYPE_COMMA && token.type != close) {
+      return CSON_ERROR;
     }
-    token.sv.len = i;
-    return token;
   }
-  case CSON_TOKENTYPE_UNKNOWN:
-    break;
+
+  size_t close_index = words->element_count;
+  if (close_index > UINT32_MAX) {
+    return CSON_ERROR; // the open word cannot address its close
   }
-  // should not ever be triggered
-  fprintf(stderr, "CSON: unkown token encountered starting with %c\n",
-          tokenizer->sv.str[0]);
-  exit(EXIT_FAILURE);
-}
-// parsing
-CSON_Result CSON_parse(CSON **cson, char *cstr) {
-  CSON_Tokenizer *tokenizer = CSON_Tokenizer_new(cstr);
-  CSON_Result res = CSON_parse_element(cson, tokenizer);
-  CSON_Tokenizer_free(tokenizer);
-  return res;
+  if (count > CSON_TAPE_MAX_COUNT) {
+    count = CSON_TAPE_MAX_COUNT;
+  }
+  word = CSON_tape_word(is_object ? CSON_TAPE_OBJECT_CLOSE
+                                  : CSON_TAPE_ARRAY_CLOSE,
+                        open);
+  CVec_push_back(words, &word);
+  word = CSON_tape_word(is_object ? CSON_TAPE_OBJECT_OPEN
+                                  : CSON_TAPE_ARRAY_OPEN,
+                        (count << 32) | close_index);
+  memcpy(words->data + open * sizeof(uint64_t), &word, sizeof(word));
+  return CSON_SUCCES;
 }
 
-CSON_Result CSON_parse_element(CSON **element, CSON_Tokenizer *tokenizer) {
+static CSON_Result CSON_Tape_parse_element(CSON_Tokenizer *tokenizer,
+                                           CVec *words, CVec *strings,
+                                           size_t depth) {
+  if (depth >= CSON_MAX_DEPTH) {
+    return CSON_ERROR;
+  }
   CSON_Token token = CSON_Tokenizer_consume(tokenizer);
+  uint64_t word;
   switch (token.type) {
-  case CSON_TOKENTYPE_CURLY_OPEN: {
-    return CSON_parse_object(element, tokenizer);
-  } break;
-  case CSON_TOKENTYPE_SQUARE_OPEN: {
-    return CSON_parse_array(element, tokenizer);
-  } break;
-  case CSON_TOKENTYPE_STRING: {
-    *element = (CSON *)CSON_String_from_sv(token.sv);
-    return CSON_SUCCES;
-  } break;
+  case CSON_TOKENTYPE_CURLY_OPEN:
+    return CSON_Tape_parse_container(tokenizer, words, strings, depth, true);
+  case CSON_TOKENTYPE_SQUARE_OPEN:
+    return CSON_Tape_parse_container(tokenizer, words, strings, depth, false);
+  case CSON_TOKENTYPE_STRING:
+    return CSON_Tape_push_string(words, strings, token.sv);
   case CSON_TOKENTYPE_NUMBER: {
     double d;
-    sscanf(token.sv.str, "%lf", &d);
-    *element = (CSON *)CSON_Number_new(d);
+    if (CSON_Token_to_double(token, &d) == CSON_ERROR) {
+      return CSON_ERROR;
+    }
+    word = CSON_tape_word(CSON_TAPE_NUMBER, 0);
+    CVec_push_back(words, &word);
+    memcpy(&word, &d, sizeof(word));
+    CVec_push_back(words, &word);
     return CSON_SUCCES;
-  } break;
+  }
   case CSON_TOKENTYPE_WORD: {
-    CSON_SV sv_true;
-    CSON_SV_init(&sv_true, "true");
-    CSON_SV sv_false;
-    CSON_SV_init(&sv_false, "false");
-    CSON_SV sv_null;
-    CSON_SV_init(&sv_null, "null");
-
-    if (CSON_SV_eq(&token.sv, &sv_true)) {
-      *element = (CSON *)CSON_Literal_new(CSON_TRUE);
-    } else if (CSON_SV_eq(&token.sv, &sv_false)) {
-      *element = (CSON *)CSON_Literal_new(CSON_FALSE);
-    } else if (CSON_SV_eq(&token.sv, &sv_null)) {
-      *element = (CSON *)CSON_Literal_new(CSON_NULL);
+    if (token.sv.len == 4 && memcmp(token.sv.str, "true", 4) == 0) {
+      word = CSON_tape_word(CSON_TAPE_TRUE, 0);
+    } else if (token.sv.len == 5 && memcmp(token.sv.str, "false", 5) == 0) {
+      word = CSON_tape_word(CSON_TAPE_FALSE, 0);
+    } else if (token.sv.len == 4 && memcmp(token.sv.str, "null", 4) == 0) {
+      word = CSON_tape_word(CSON_TAPE_NULL, 0);
     } else {
       return CSON_ERROR;
     }
+    CVec_push_back(words, &word);
     return CSON_SUCCES;
-  } break;
+  }
   default:
-    break;
+    return CSON_ERROR;
   }
-  return CSON_ERROR;
 }
 
-CSON_Result CSON_parse_array(CSON **element, CSON_Tokenizer *tokenizer) {
-  CSON_Array *array = CSON_Array_new();
-  CSON_Token token = CSON_Tokenizer_peek(tokenizer);
-  if (token.type == CSON_TOKENTYPE_SQUARE_CLOSE) {
-    CSON_Tokenizer_consume(tokenizer);
+CSON_Result CSON_Tape_parse(CSON_Tape *tape, char *cstr) {
+  CVec words, strings;
+  CVec_init(&words, sizeof(uint64_t), CSON_DEFAULT_MEMBLOCK_SIZE);
+  CVec_init(&strings, 1, CSON_DEFAULT_MEMBLOCK_SIZE);
+  CSON_Tokenizer tokenizer;
+  CSON_SV_init(&tokenizer.sv, cstr);
+  if (CSON_Tape_parse_element(&tokenizer, &words, &strings, 0) == CSON_ERROR) {
+    CVec_free(&words);
+    CVec_free(&strings);
+    return CSON_ERROR;
   }
-  CSON_Result res;
-  while (token.type != CSON_TOKENTYPE_SQUARE_CLOSE) {
+  // leave the document as exactly two allocations
+  CVec_shrink_to_fit(&words);
+  CVec_shrink_to_fit(&strings);
+  *tape = (CSON_Tape){.words = (uint64_t *)words.data,
+                      .word_count = words.element_count,
+                      .strings = strings.data,
+                      .string_size = strings.element_count};
+  return CSON_SUCCES;
+}
 
-    // parse value
-    CSON *value = NULL;
-    res = CSON_parse_element(&value, tokenizer);
-    if (res == CSON_ERROR) {
-      goto PARSE_ERROR;
-    }
+void CSON_Tape_free(CSON_Tape *tape) {
+  free(tape->words);
+  free(tape->strings);
+  *tape = (CSON_Tape){0};
+}
 
-    CSON_Array_append(array, value);
+CSON_TapeCursor CSON_Tape_root(const CSON_Tape *tape) {
+  return (CSON_TapeCursor){.tape = tape, .index = 0};
+}
 
-    // check for more
-    token = CSON_Tokenizer_consume(tokenizer);
-    switch (token.type) {
-    case CSON_TOKENTYPE_COMMA:
-      // token = CSON_Tokenizer_consume(tokenizer);
-    case CSON_TOKENTYPE_SQUARE_CLOSE:
-      continue;
-    default:
-      goto PARSE_ERROR;
-    }
+CSON_TapeTag CSON_TapeCursor_tag(CSON_TapeCursor cursor) {
+  assert(cursor.index < cursor.tape->word_count && "cursor out of bounds");
+  return (CSON_TapeTag)(cursor.tape->words[cursor.index] >> 56);
+}
+
+CSON_Type CSON_TapeCursor_type(CSON_TapeCursor cursor) {
+  switch (CSON_TapeCursor_tag(cursor)) {
+  case CSON_TAPE_ARRAY_OPEN:
+    return CSON_ARRAY;
+  case CSON_TAPE_OBJECT_OPEN:
+    return CSON_OBJECT;
+  case CSON_TAPE_STRING:
+    return CSON_STRING;
+  case CSON_TAPE_NUMBER:
+    return CSON_NUMBER;
+  case CSON_TAPE_TRUE:
+    return CSON_TRUE;
+  case CSON_TAPE_FALSE:
+    return CSON_FALSE;
+  case CSON_TAPE_NULL:
+    return CSON_NULL;
+  default:
+    break;
   }
-  *element = (CSON *)array;
-  return CSON_SUCCES;
-PARSE_ERROR:
-  CSON_Array_free(array);
-  return CSON_ERROR;
+  assert(false && "cursor points at a container close");
+  return CSON_NULL;
 }
 
-CSON_Result CSON_parse_object(CSON **element, CSON_Tokenizer *tokenizer) {
-  CSON_Object *object = CSON_Object_new();
-  CSON_Token token = CSON_Tokenizer_peek(tokenizer);
-  if (token.type == CSON_TOKENTYPE_CURLY_CLOSE) {
-    CSON_Tokenizer_consume(tokenizer);
+
+// element count as stored in a container open, saturated
+static size_t CSON_TapeCursor_stored_count(CSON_TapeCursor cursor) {
+  return (cursor.tape->words[cursor.index] >> 32) & CSON_TAPE_MAX_COUNT;
+}
+
+// index of the word following the value under the cursor
+static size_t CSON_TapeCursor_after(CSON_TapeCursor cursor) {
+  uint64_t word = cursor.tape->words[cursor.index];
+  switch ((CSON_TapeTag)(word >> 56)) {
+  case CSON_TAPE_ARRAY_OPEN:
+  case CSON_TAPE_OBJECT_OPEN:
+    return (size_t)(word & 0xffffffff) + 1;
+  case CSON_TAPE_NUMBER:
+    return cursor.index + 2;
+  default:
+    return cursor.index + 1;
   }
-  CSON_Result res;
-  while (token.type != CSON_TOKENTYPE_CURLY_CLOSE) {
-    // parse key
-    CSON_String *key = NULL;
-    res = CSON_parse_element((CSON **)&key, tokenizer);
-    if (res == CSON_ERROR || key->cson.type != CSON_STRING) {
-      goto PARSE_ERROR;
-    }
+}
 
-    // colon seperator
-    token = CSON_Tokenizer_consume(tokenizer);
-    if (token.type != CSON_TOKENTYPE_COLON) {
-      goto PARSE_ERROR;
-    }
+// move to the first element of a container, for objects this is the first key
+bool CSON_TapeCursor_child(CSON_TapeCursor *cursor) {
+  CSON_TapeTag tag = CSON_TapeCursor_tag(*cursor);
+  assert((tag == CSON_TAPE_ARRAY_OPEN || tag == CSON_TAPE_OBJECT_OPEN) &&
+         "attempted to descend into non container type");
+  (void)tag;
+  if (CSON_TapeCursor_stored_count(*cursor) == 0) {
+    return false;
+  }
+  cursor->index++;
+  return true;
+}
 
-    // parse value
-    CSON *value = NULL;
-    res = CSON_parse_element(&value, tokenizer);
-    if (res == CSON_ERROR) {
-      goto PARSE_ERROR;
-    }
+// move to the next sibling, inside objects keys and values are siblings
+bool CSON_TapeCursor_next(CSON_TapeCursor *cursor) {
+  size_t next = CSON_TapeCursor_after(*cursor);
+  if (next >= cursor->tape->word_count) {
+    return false;
+  }
+  CSON_TapeTag tag = (CSON_TapeTag)(cursor->tape->words[next] >> 56);
+  if (tag == CSON_TAPE_ARRAY_CLOSE || tag == CSON_TAPE_OBJECT_CLOSE) {
+    return false;
+  }
+  cursor->index = next;
+  return true;
+}
 
-    CSON_Object_insert(object, key, value);
+// the stored count saturates, larger containers are counted by walking them
+size_t CSON_TapeCursor_count(CSON_TapeCursor cursor) {
+  CSON_TapeTag tag = CSON_TapeCursor_tag(cursor);
+  assert((tag == CSON_TAPE_ARRAY_OPEN || tag == CSON_TAPE_OBJECT_OPEN) &&
+         "attempted to count elements of non container type");
+  size_t count = CSON_TapeCursor_stored_count(cursor);
+  if (count < CSON_TAPE_MAX_COUNT) {
+    return count;
+  }
+  count = 0;
+  CSON_TapeCursor element = cursor;
+  bool more = CSON_TapeCursor_child(&element);
+  while (more) {
+    count++;
+    more = CSON_TapeCursor_next(&element);
+  }
+  return tag == CSON_TAPE_OBJECT_OPEN ? count / 2 : count;
+}
 
-    // check for more
-    token = CSON_Tokenizer_consume(tokenizer);
-    switch (token.type) {
-    case CSON_TOKENTYPE_COMMA:
-    case CSON_TOKENTYPE_CURLY_CLOSE:
-      continue;
-    default:
-      goto PARSE_ERROR;
+bool CSON_TapeCursor_get_bool(CSON_TapeCursor cursor) {
+  CSON_TapeTag tag = CSON_TapeCursor_tag(cursor);
+  assert((tag == CSON_TAPE_TRUE || tag == CSON_TAPE_FALSE) &&
+         "attempted to get bool from non bool type");
+  return tag == CSON_TAPE_TRUE;
+}
+
+double CSON_TapeCursor_get_double(CSON_TapeCursor cursor) {
+  assert(CSON_TapeCursor_tag(cursor) == CSON_TAPE_NUMBER &&
+         "attempted to get number from non number type");
+  double d;
+  memcpy(&d, &cursor.tape->words[cursor.index + 1], sizeof(d));
+  return d;
+}
+
+const char *CSON_TapeCursor_get_string(CSON_TapeCursor cursor, size_t *len) {
+  assert(CSON_TapeCursor_tag(cursor) == CSON_TAPE_STRING &&
+         "attempted to get string from non string type");
+  const char *entry = cursor.tape->strings +
+                      (cursor.tape->words[cursor.index] & CSON_TAPE_PAYLOAD_MASK);
+  if (len) {
+    uint32_t string_len;
+    memcpy(&string_len, entry, sizeof(string_len));
+    *len = string_len;
+  }
+  return entry + sizeof(uint32_t);
+}
+
+bool CSON_TapeCursor_get_by_index(CSON_TapeCursor *cursor, size_t index) {
+  assert(CSON_TapeCursor_tag(*cursor) == CSON_TAPE_ARRAY_OPEN &&
+         "attempted to get by index from non array type");
+  CSON_TapeCursor element = *cursor;
+  size_t count = CSON_TapeCursor_stored_count(element);
+  if ((count < CSON_TAPE_MAX_COUNT && index >= count) ||
+      !CSON_TapeCursor_child(&element)) {
+    return false; // saturated counts are bounded by walking instead
+  }
+  for (size_t i = 0; i < index; i++) {
+    if (!CSON_TapeCursor_next(&element)) {
+      return false;
     }
   }
-  *element = (CSON *)object;
-  return CSON_SUCCES;
-PARSE_ERROR:
-  CSON_Object_free(object);
-  return CSON_ERROR;
+  *cursor = element;
+  return true;
+}
+
+bool CSON_TapeCursor_get_by_key(CSON_TapeCursor *cursor, const char *key) {
+  assert(CSON_TapeCursor_tag(*cursor) == CSON_TAPE_OBJECT_OPEN &&
+         "attempted to get by key from non object type");
+  size_t key_len = strlen(key);
+  CSON_TapeCursor member = *cursor;
+  bool more = CSON_TapeCursor_child(&member);
+  while (more) {
+    size_t len;
+    const char *str = CSON_TapeCursor_get_string(member, &len);
+    CSON_TapeCursor_next(&member); // keys are always followed by a value
+    if (len == key_len && memcmp(str, key, len) == 0) {
+      *cursor = member;
+      return true;
+    }
+    more = CSON_TapeCursor_next(&member);
+  }
+  return false;
 }
 
 #endif // CSON_IMPLEMENTATION
@@ -1,6 +1,8 @@
 #define CSON_IMPLEMENTATION
 #include "cson.h"
 
+#include <pthread.h>
+
 #include "utest.h"
 
 
@@ -49,6 +51,15 @@ UTEST(CSON_Test_element, parse_null) {
 	ASSERT_EQ(cson->type, CSON_NULL);
 }
 
+UTEST(CSON_Test_element, parse_malformed_number) {
+	CSON* cson;
+	ASSERT_EQ(CSON_parse(&cson,"[1.2.3]"), CSON_ERROR);
+	ASSERT_EQ(CSON_parse(&cson,"[-]"), CSON_ERROR);
+	ASSERT_EQ(CSON_parse(&cson,"-2.5"), CSON_SUCCES);
+	ASSERT_EQ(CSON_get_number(cson), -2.5);
+	CSON_free(cson);
+}
+
 // getter tests
 UTEST(CSON_Test_getters, get_string){
 	CSON* cson;
@@ -134,3 +145,1542 @@ UTEST(CSON_Test_nested, object_elements){
 }
 
 
+// binary format tests
+UTEST(CSON_Test_binary, msgpack_roundtrip){
+	CSON* cson;
+	CSON_parse(&cson, "{\"id\":-300,\"ok\":true,\"tags\":[\"a\",null,1.5],\"empty\":{}}");
+	CVec out;
+	CVec_init(&out, 1, 16);
+	ASSERT_EQ(CSON_to_msgpack(cson, &out), CSON_SUCCES);
+	ASSERT_EQ((unsigned char)out.data[0], 0x84); // fixmap with 4 entries
+
+	CSON* decoded;
+	ASSERT_EQ(CSON_from_msgpack(&decoded, (uint8_t*)out.data, out.element_count), CSON_SUCCES);
+	ASSERT_EQ(CSON_get_number(CSON_get_by_key(decoded,"id")), -300);
+	ASSERT_TRUE(CSON_get_bool(CSON_get_by_key(decoded,"ok")));
+	CSON* tags = CSON_get_by_key(decoded,"tags");
+	ASSERT_EQ(strcmp(CSON_get_string(CSON_get_by_index(tags,0)),"a"),0);
+	ASSERT_TRUE(CSON_is_null(CSON_get_by_index(tags,1)));
+	ASSERT_EQ(CSON_get_number(CSON_get_by_index(tags,2)), 1.5);
+	ASSERT_TRUE(CSON_is_object(CSON_get_by_key(decoded,"empty")));
+	CSON_free(decoded);
+	ASSERT_EQ(CSON_from_msgpack(&decoded, (uint8_t*)out.data, out.element_count - 1), CSON_ERROR);
+	CVec_free(&out);
+	CSON_free(cson);
+}
+
+UTEST(CSON_Test_binary, cbor_roundtrip){
+	CSON* cson;
+	CSON_parse(&cson, "[0,23,24,-1,-25,100000,2.25,\"\",false]");
+	CVec out;
+	CVec_init(&out, 1, 16);
+	ASSERT_EQ(CSON_to_cbor(cson, &out), CSON_SUCCES);
+	ASSERT_EQ((unsigned char)out.data[0], 0x89); // array of 9
+
+	CSON* decoded;
+	ASSERT_EQ(CSON_from_cbor(&decoded, (uint8_t*)out.data, out.element_count), CSON_SUCCES);
+	double expected[] = {0, 23, 24, -1, -25, 100000, 2.25};
+	for(size_t i = 0; i < 7; i++){
+		ASSERT_EQ(CSON_get_number(CSON_get_by_index(decoded,i)), expected[i]);
+	}
+	ASSERT_EQ(strcmp(CSON_get_string(CSON_get_by_index(decoded,7)),""),0);
+	ASSERT_FALSE(CSON_get_bool(CSON_get_by_index(decoded,8)));
+	CVec_free(&out);
+	CSON_free(decoded);
+	CSON_free(cson);
+}
+
+UTEST(CSON_Test_binary, cbor_indefinite_and_half){
+	// {_ "a": [_ 1.5(half), true] }
+	uint8_t buf[] = {0xbf, 0x61, 'a', 0x9f, 0xf9, 0x3e, 0x00, 0xf5, 0xff, 0xff};
+	CSON* decoded;
+	ASSERT_EQ(CSON_from_cbor(&decoded, buf, sizeof(buf)), CSON_SUCCES);
+	CSON* a = CSON_get_by_key(decoded,"a");
+	ASSERT_EQ(CSON_get_number(CSON_get_by_index(a,0)), 1.5);
+	ASSERT_TRUE(CSON_get_bool(CSON_get_by_index(a,1)));
+	CSON_free(decoded);
+}
+
+UTEST(CSON_Test_binary, json_to_msgpack_stream){
+	CVec out;
+	CVec_init(&out, 1, 16);
+	ASSERT_EQ(CSON_json_to_msgpack("{ \"a\" : [1, \"x\", {}], \"b\": false }", &out), CSON_SUCCES);
+	CSON* decoded;
+	ASSERT_EQ(CSON_from_msgpack(&decoded, (uint8_t*)out.data, out.element_count), CSON_SUCCES);
+	CSON* a = CSON_get_by_key(decoded,"a");
+	ASSERT_EQ(CSON_get_number(CSON_get_by_index(a,0)), 1);
+	ASSERT_EQ(strcmp(CSON_get_string(CSON_get_by_index(a,1)),"x"),0);
+	ASSERT_TRUE(CSON_is_object(CSON_get_by_index(a,2)));
+	ASSERT_FALSE(CSON_get_bool(CSON_get_by_key(decoded,"b")));
+	CSON_free(decoded);
+
+	size_t len = out.element_count;
+	ASSERT_EQ(CSON_json_to_msgpack("[1,", &out), CSON_ERROR);
+	ASSERT_EQ(out.element_count, len);
+	ASSERT_EQ(CSON_json_to_msgpack("[1.2.3]", &out), CSON_ERROR);
+	ASSERT_EQ(CSON_json_to_msgpack("{\"a\":-}", &out), CSON_ERROR);
+	ASSERT_EQ(CSON_json_to_msgpack("[\"\\x\"]", &out), CSON_ERROR);
+	ASSERT_EQ(out.element_count, len);
+	CVec_free(&out);
+}
+
+UTEST(CSON_Test_binary, json_to_msgpack_grammar){
+	// exponents, escapes and negative zero survive the transcoding
+	CVec out;
+	CVec_init(&out, 1, 16);
+	ASSERT_EQ(CSON_json_to_msgpack("{\"n\":[1.5e3,-2E-2,-0],\"q\\\"k\":\"x\\\"y\","
+		"\"s\":\"a\\nb\\u00e9\\ud83d\\ude00\"}", &out), CSON_SUCCES);
+	CSON* decoded;
+	ASSERT_EQ(CSON_from_msgpack(&decoded, (uint8_t*)out.data, out.element_count), CSON_SUCCES);
+	CSON* n = CSON_get_by_key(decoded,"n");
+	ASSERT_EQ(CSON_get_number(CSON_get_by_index(n,0)), 1500.0);
+	ASSERT_EQ(CSON_get_number(CSON_get_by_index(n,1)), -0.02);
+	ASSERT_EQ(CSON_get_number(CSON_get_by_index(n,2)), 0.0);
+	ASSERT_TRUE(signbit(CSON_get_number(CSON_get_by_index(n,2))));
+	ASSERT_EQ(strcmp(CSON_get_string(CSON_get_by_key(decoded,"q\"k")),"x\"y"),0);
+	ASSERT_EQ(strcmp(CSON_get_string(CSON_get_by_key(decoded,"s")),"a\nb\xc3\xa9\xf0\x9f\x98\x80"),0);
+
+	CVec cbor;
+	CVec_init(&cbor, 1, 16);
+	ASSERT_EQ(CSON_to_cbor(decoded, &cbor), CSON_SUCCES);
+	CSON* from_cbor;
+	ASSERT_EQ(CSON_from_cbor(&from_cbor, (uint8_t*)cbor.data, cbor.element_count), CSON_SUCCES);
+	ASSERT_TRUE(signbit(CSON_get_number(CSON_get_by_index(CSON_get_by_key(from_cbor,"n"),2))));
+	CSON_free(from_cbor);
+	CVec_free(&cbor);
+	CSON_free(decoded);
+	CVec_free(&out);
+}
+
+// tape tests
+UTEST(CSON_Test_tape, layout){
+	CSON_Tape tape;
+	ASSERT_EQ(CSON_Tape_parse(&tape, "[1,{\"a\":null},\"s\"]"), CSON_SUCCES);
+	// [ d <double> { "a" n } "s" ]
+	ASSERT_EQ(tape.word_count, (size_t)9);
+	CSON_TapeCursor root = CSON_Tape_root(&tape);
+	ASSERT_EQ(CSON_TapeCursor_type(root), CSON_ARRAY);
+	ASSERT_EQ(CSON_TapeCursor_count(root), (size_t)3);
+	ASSERT_EQ((tape.words[0] & 0xffffffff), (uint64_t)8); // index of matching close
+	CSON_Tape_free(&tape);
+}
+
+UTEST(CSON_Test_tape, cursor_access){
+	CSON_Tape tape;
+	ASSERT_EQ(CSON_Tape_parse(&tape,
+		"{\"skip\":[[1,2],{\"x\":3}],\"name\":\"cson\",\"list\":[true,2.5,false]}"), CSON_SUCCES);
+	CSON_TapeCursor cursor = CSON_Tape_root(&tape);
+	ASSERT_TRUE(CSON_TapeCursor_get_by_key(&cursor, "name"));
+	size_t len;
+	ASSERT_EQ(strcmp(CSON_TapeCursor_get_string(cursor, &len), "cson"), 0);
+	ASSERT_EQ(len, (size_t)4);
+
+	cursor = CSON_Tape_root(&tape);
+	ASSERT_TRUE(CSON_TapeCursor_get_by_key(&cursor, "list"));
+	CSON_TapeCursor element = cursor;
+	ASSERT_TRUE(CSON_TapeCursor_get_by_index(&element, 1));
+	ASSERT_EQ(CSON_TapeCursor_get_double(element), 2.5);
+	ASSERT_TRUE(CSON_TapeCursor_next(&element));
+	ASSERT_FALSE(CSON_TapeCursor_get_bool(element));
+	ASSERT_FALSE(CSON_TapeCursor_next(&element));
+	ASSERT_FALSE(CSON_TapeCursor_get_by_index(&cursor, 3));
+
+	cursor = CSON_Tape_root(&tape);
+	ASSERT_FALSE(CSON_TapeCursor_get_by_key(&cursor, "x"));
+	CSON_Tape_free(&tape);
+}
+
+UTEST(CSON_Test_tape, escapes){
+	CSON_Tape tape;
+	ASSERT_EQ(CSON_Tape_parse(&tape, "{\"k\\\"ey\":\"a\\n\\u00e9\",\"n\":2.5e2}"), CSON_SUCCES);
+	CSON_TapeCursor cursor = CSON_Tape_root(&tape);
+	ASSERT_TRUE(CSON_TapeCursor_get_by_key(&cursor, "k\"ey"));
+	size_t len;
+	ASSERT_STREQ(CSON_TapeCursor_get_string(cursor, &len), "a\n\xc3\xa9");
+	ASSERT_EQ(len, (size_t)4);
+	cursor = CSON_Tape_root(&tape);
+	ASSERT_TRUE(CSON_TapeCursor_get_by_key(&cursor, "n"));
+	ASSERT_EQ(CSON_TapeCursor_get_double(cursor), 250.0);
+	CSON_Tape_free(&tape);
+}
+
+UTEST(CSON_Test_tape, parse_error){
+	CSON_Tape tape;
+	ASSERT_EQ(CSON_Tape_parse(&tape, "{\"a\" 1}"), CSON_ERROR);
+	ASSERT_EQ(CSON_Tape_parse(&tape, "[1,2"), CSON_ERROR);
+	ASSERT_EQ(CSON_Tape_parse(&tape, "[\"\\q\"]"), CSON_ERROR);
+	ASSERT_EQ(CSON_Tape_parse(&tape, "[1.2.3]"), CSON_ERROR);
+	ASSERT_EQ(CSON_Tape_parse(&tape, "{\"a\":-}"), CSON_ERROR);
+}
+
+UTEST(CSON_Test_tape, saturated_count){
+	// counts beyond 2^24-1 are stored saturated, cursors walk the container
+	uint64_t words[] = {
+		((uint64_t)CSON_TAPE_ARRAY_OPEN << 56) | (CSON_TAPE_MAX_COUNT << 32) | 4,
+		(uint64_t)CSON_TAPE_TRUE << 56,
+		(uint64_t)CSON_TAPE_FALSE << 56,
+		(uint64_t)CSON_TAPE_NULL << 56,
+		(uint64_t)CSON_TAPE_ARRAY_CLOSE << 56,
+	};
+	CSON_Tape tape = {.words = words, .word_count = 5};
+	CSON_TapeCursor cursor = CSON_Tape_root(&tape);
+	ASSERT_EQ(CSON_TapeCursor_count(cursor), (size_t)3);
+	ASSERT_TRUE(CSON_TapeCursor_get_by_index(&cursor, 2));
+	ASSERT_EQ(CSON_TapeCursor_type(cursor), CSON_NULL);
+	cursor = CSON_Tape_root(&tape);
+	ASSERT_FALSE(CSON_TapeCursor_get_by_index(&cursor, 3));
+}
+
+// value representation tests
+UTEST(CSON_Test_values, inline_slots){
+	ASSERT_EQ(sizeof(CSON), (size_t)16);
+	CSON* cson;
+	CSON_parse(&cson, "[1,true,null,2.5]");
+	// elements are stored inline and consecutively inside the array
+	ASSERT_TRUE(CSON_get_by_index(cson,1) == CSON_get_by_index(cson,0) + 1);
+	ASSERT_EQ(CSON_get_by_index(cson,3)->as.number, 2.5);
+	ASSERT_TRUE(CSON_get_by_index(cson,4) == NULL);
+	CSON_free(cson);
+}
+
+UTEST(CSON_Test_values, build_and_clear){
+	CSON array = CSON_Array_new();
+	CSON value = CSON_Number_new(7);
+	CSON_Array_append(array.as.array, &value);
+	ASSERT_TRUE(CSON_is_null(&value));
+	CSON object = CSON_Object_new();
+	CSON key = CSON_String_from_sv((CSON_SV){.str = "n", .len = 1});
+	CSON_Object_insert(object.as.object, &key, &array);
+	ASSERT_EQ(CSON_get_double(CSON_get_by_index(CSON_get_by_key(&object,"n"),0)), 7);
+	CSON_clear(&object);
+	ASSERT_TRUE(CSON_is_null(&object));
+}
+
+UTEST(CSON_Test_values, small_strings){
+	CSON* cson;
+	CSON_parse(&cson, "{\"short key\":\"abcdefghijklm\",\"a much longer key\":\"abcdefghijklmn\"}");
+	CSON* small = CSON_get_by_key(cson,"short key");
+	CSON* large = CSON_get_by_key(cson,"a much longer key");
+	// 13 bytes fit inside the value, 14 need a heap block
+	ASSERT_TRUE(CSON_get_string(small) > (const char*)small);
+	ASSERT_TRUE(CSON_get_string(small) < (const char*)(small + 1));
+	ASSERT_EQ(strcmp(CSON_get_string(small),"abcdefghijklm"),0);
+	ASSERT_EQ(large->small_len, CSON_LARGE_STRING);
+	ASSERT_EQ(strcmp(CSON_get_string(large),"abcdefghijklmn"),0);
+	CSON_free(cson);
+}
+
+// container storage tests
+UTEST(CSON_Test_storage, empty_containers_do_not_allocate){
+	CSON* cson;
+	CSON_parse(&cson, "[{},[]]");
+	ASSERT_TRUE(CSON_get_by_index(cson,0)->as.object->members.data == NULL);
+	ASSERT_TRUE(CSON_get_by_index(cson,1)->as.array->data.data == NULL);
+	ASSERT_EQ(cson->as.array->data.element_capacity, (size_t)2);
+	CSON_free(cson);
+}
+
+UTEST(CSON_Test_storage, prescan_counts){
+	CVec counts;
+	CVec_init(&counts, sizeof(uint32_t), 0);
+	CSON_prescan("[1, {\"a\":[], \"b\":\"x,]\"}, [ ], [[3]]]", &counts);
+	uint32_t expected[] = {4, 2, 0, 0, 1, 1};
+	ASSERT_EQ(counts.element_count, (size_t)6);
+	for(size_t i = 0; i < 6; i++){
+		ASSERT_EQ(((uint32_t*)counts.data)[i], expected[i]);
+	}
+	CVec_free(&counts);
+}
+
+UTEST(CSON_Test_storage, prescan_reserves_exact_capacity){
+	CSON* cson;
+	CSON_ParseOptions options = {.prescan = true};
+	ASSERT_EQ(CSON_parse_ex(&cson, "{\"a\":[1,2,3,4,5],\"b\":{\"c\":null}}", &options), CSON_SUCCES);
+	ASSERT_EQ(cson->as.object->members.element_capacity, (size_t)2);
+	ASSERT_EQ(CSON_get_by_key(cson,"a")->as.array->data.element_capacity, (size_t)5);
+	ASSERT_TRUE(CSON_is_null(CSON_get_by_key(CSON_get_by_key(cson,"b"),"c")));
+	CSON_free(cson);
+}
+
+UTEST(CSON_Test_storage, interleaved_members){
+	CSON* cson;
+	CSON_parse(&cson, "{\"id\":1,\"a longer key name\":2}");
+	CSON_Member* members = (CSON_Member*)cson->as.object->members.data;
+	ASSERT_EQ(members[1].key.len, (uint32_t)17);
+	ASSERT_EQ(members[1].key.hash, CSON_hash_string("a longer key name", 17));
+	// the value found by key lives right next to its key
+	ASSERT_TRUE(CSON_get_by_key(cson,"id") == &members[0].value);
+	ASSERT_EQ(CSON_get_number(CSON_get_by_key(cson,"a longer key name")), 2);
+	ASSERT_TRUE(CSON_get_by_key(cson,"missing") == NULL);
+	CSON_free(cson);
+}
+
+UTEST(CSON_Test_storage, shared_shapes){
+	CSON_ShapeTable shapes;
+	CSON_ShapeTable_init(&shapes);
+	CSON_ParseOptions options = {.shapes = &shapes};
+	CSON* cson;
+	ASSERT_EQ(CSON_parse_ex(&cson, "[{\"id\":1,\"name\":\"a\"},{\"id\":2,\"name\":\"b\"},{\"name\":\"c\",\"id\":3}]", &options), CSON_SUCCES);
+	CSON_Object* first = CSON_get_by_index(cson,0)->as.object;
+	CSON_Object* second = CSON_get_by_index(cson,1)->as.object;
+	CSON_Object* third = CSON_get_by_index(cson,2)->as.object;
+	ASSERT_TRUE(first->shape != NULL);
+	ASSERT_TRUE(first->shape == second->shape);
+	ASSERT_TRUE(first->shape != third->shape);
+	ASSERT_EQ(CSON_get_number(CSON_get_by_key(CSON_get_by_index(cson,1),"id")), 2);
+	ASSERT_EQ(strcmp(CSON_get_string(CSON_get_by_key(CSON_get_by_index(cson,2),"name")),"c"),0);
+	// the table may be released before the documents using its shapes
+	CSON_ShapeTable_free(&shapes);
+
+	// inserting into a shaped object gives it its own keys
+	CSON key = CSON_String_from_sv((CSON_SV){.str = "extra", .len = 5});
+	CSON value = CSON_Literal_new(CSON_TRUE);
+	CSON_Object_insert(second, &key, &value);
+	ASSERT_TRUE(second->shape == NULL);
+	ASSERT_EQ(CSON_Object_count(second), (size_t)3);
+	ASSERT_EQ(strcmp(CSON_get_string(CSON_get_by_key(CSON_get_by_index(cson,1),"name")),"b"),0);
+	ASSERT_EQ(first->shape->refcount, (size_t)1);
+	CSON_free(cson);
+}
+
+UTEST(CSON_Test_storage, shape_index){
+	CSON_ShapeTable shapes;
+	CSON_ShapeTable_init(&shapes);
+	CSON_ParseOptions options = {.shapes = &shapes};
+	CSON* cson;
+	ASSERT_EQ(CSON_parse_ex(&cson, "{\"a\":0,\"b\":1,\"c\":2,\"d\":3,\"e\":4,\"f\":5,\"g\":6,\"h\":7,\"i\":8}", &options), CSON_SUCCES);
+	ASSERT_TRUE(cson->as.object->shape->index.slots != NULL);
+	const char* keys[] = {"a","b","c","d","e","f","g","h","i"};
+	for(size_t i = 0; i < 9; i++){
+		ASSERT_EQ(CSON_get_number(CSON_get_by_key(cson,keys[i])), (double)i);
+	}
+	ASSERT_TRUE(CSON_get_by_key(cson,"j") == NULL);
+	CSON_free(cson);
+	CSON_ShapeTable_free(&shapes);
+}
+
+// lookup tests
+UTEST(CSON_Test_lookup, field_cache){
+	CSON* cson;
+	CSON_parse(&cson, "[{\"id\":1,\"ts\":10},{\"id\":2,\"ts\":20},{\"ts\":30},{\"id\":4}]");
+	CSON_FieldCache cache;
+	CSON_FieldCache_init(&cache, "ts");
+	ASSERT_EQ(CSON_get_number(CSON_get_by_key_cached(CSON_get_by_index(cson,0), &cache)), 10);
+	ASSERT_EQ(cache.position, (size_t)1);
+	ASSERT_EQ(CSON_get_number(CSON_get_by_key_cached(CSON_get_by_index(cson,1), &cache)), 20);
+	// a different layout falls back to a full lookup and updates the cache
+	ASSERT_EQ(CSON_get_number(CSON_get_by_key_cached(CSON_get_by_index(cson,2), &cache)), 30);
+	ASSERT_EQ(cache.position, (size_t)0);
+	ASSERT_TRUE(CSON_get_by_key_cached(CSON_get_by_index(cson,3), &cache) == NULL);
+	CSON_free(cson);
+}
+
+UTEST(CSON_Test_lookup, keyset_extract){
+	const char *keys[] = {"id", "name", "email", "created_at", "updated_at",
+		"a_long_interned_field_name", "score", "tags", "missing", "flag"};
+	size_t n = sizeof(keys) / sizeof(keys[0]);
+	CSON_KeySet *keyset = CSON_KeySet_compile(keys, n);
+	ASSERT_TRUE(keyset != NULL);
+	for (size_t i = 0; i < n; i++) {
+		size_t len = strlen(keys[i]);
+		CSON_Key key = {.hash = CSON_hash_string(keys[i], len), .len = (uint32_t)len,
+			.string = CSON_String_from_sv((CSON_SV){.str = (char *)keys[i], .len = len})};
+		ASSERT_EQ(CSON_KeySet_lookup(keyset, &key), i); // one slot per key
+		CSON_clear(&key.string);
+	}
+
+	CSON_StringTable strings;
+	CSON_StringTable_init(&strings);
+	CSON_ParseOptions options = {.strings = &strings};
+	CSON *cson;
+	ASSERT_EQ(CSON_parse_ex(&cson, "{\"flag\":true,\"id\":1,\"extra\":0,\"name\":\"ada\","
+		"\"email\":\"a@b\",\"created_at\":2,\"updated_at\":3,"
+		"\"a_long_interned_field_name\":4,\"score\":5,\"tags\":[]}",
+		&options), CSON_SUCCES);
+	CSON *out[10];
+	ASSERT_EQ(CSON_extract(cson, keyset, out), (size_t)9);
+	ASSERT_EQ(CSON_get_number(out[0]), 1.0);
+	ASSERT_EQ(CSON_get_number(out[6]), 5.0);
+	ASSERT_TRUE(out[8] == NULL);
+	ASSERT_TRUE(CSON_get_bool(out[9]));
+	for (size_t i = 0; i < n; i++) {
+		ASSERT_TRUE(CSON_get_by_keyset(cson, keyset, i) == out[i]);
+	}
+	CSON_free(cson);
+	CSON_StringTable_free(&strings);
+	CSON_KeySet_free(keyset);
+
+	const char *duplicates[] = {"a", "b", "a"};
+	ASSERT_TRUE(CSON_KeySet_compile(duplicates, 3) == NULL);
+}
+
+UTEST(CSON_Test_lookup, keyset_collisions){
+	// distinct keys with the same 32 bit hash share a slot
+	const char *keys[] = {"x", "k32728", "y", "k261234"};
+	ASSERT_EQ(CSON_hash_string("k32728", 6), CSON_hash_string("k261234", 7));
+	CSON_KeySet *keyset = CSON_KeySet_compile(keys, 4);
+	ASSERT_TRUE(keyset != NULL);
+	CSON *cson;
+	ASSERT_EQ(CSON_parse(&cson, "{\"k261234\":2,\"y\":3,\"k32728\":1}"), CSON_SUCCES);
+	CSON *out[4];
+	ASSERT_EQ(CSON_extract(cson, keyset, out), (size_t)3);
+	ASSERT_EQ(CSON_get_number(out[1]), 1.0);
+	ASSERT_EQ(CSON_get_number(out[3]), 2.0);
+	ASSERT_TRUE(out[0] == NULL);
+	CSON_free(cson);
+	CSON_KeySet_free(keyset);
+
+	const char *duplicates[] = {"k32728", "k261234", "k261234"};
+	ASSERT_TRUE(CSON_KeySet_compile(duplicates, 3) == NULL);
+
+	// large sets are placed within the bounded search
+	static char names[2000][8];
+	const char *many[2000];
+	for (size_t i = 0; i < 2000; i++) {
+		snprintf(names[i], sizeof(names[i]), "m%zu", i);
+		many[i] = names[i];
+	}
+	keyset = CSON_KeySet_compile(many, 2000);
+	ASSERT_TRUE(keyset != NULL);
+	for (size_t i = 0; i < 2000; i++) {
+		size_t len = strlen(many[i]);
+		CSON_Key key = {.hash = CSON_hash_string(many[i], len), .len = (uint32_t)len,
+			.string = CSON_String_from_sv((CSON_SV){.str = (char *)many[i], .len = len})};
+		ASSERT_EQ(CSON_KeySet_lookup(keyset, &key), i);
+		CSON_clear(&key.string);
+	}
+	CSON_KeySet_free(keyset);
+}
+
+UTEST(CSON_Test_lookup, get_many){
+	CSON *cson;
+	ASSERT_EQ(CSON_parse(&cson, "{\"a\":1,\"b\":2,\"a_key_longer_than_inline\":3,\"c\":4,\"a\":5}"), CSON_SUCCES);
+	const char *keys[] = {"c", "a", "missing", "a_key_longer_than_inline", "a"};
+	CSON *out[5];
+	ASSERT_EQ(CSON_get_many(cson, keys, 5, out), (size_t)4);
+	ASSERT_EQ(CSON_get_number(out[0]), 4.0);
+	ASSERT_EQ(CSON_get_number(out[1]), 1.0); // first of duplicate members
+	ASSERT_TRUE(out[2] == NULL);
+	ASSERT_EQ(CSON_get_number(out[3]), 3.0);
+	ASSERT_TRUE(out[4] == out[1]);
+	CSON_free(cson);
+
+	// more keys than fit the inline table
+	CSON object = CSON_Object_new();
+	static char names[100][8];
+	const char *many[100];
+	for (size_t i = 0; i < 100; i++) {
+		snprintf(names[i], sizeof(names[i]), "k%zu", i);
+		many[i] = names[i];
+		if (i % 2 == 0) {
+			CSON key = CSON_String_from_sv((CSON_SV){.str = names[i], .len = strlen(names[i])});
+			CSON value = CSON_Number_new((double)i);
+			CSON_Object_insert(object.as.object, &key, &value);
+		}
+	}
+	CSON *found[100];
+	ASSERT_EQ(CSON_get_many(&object, many, 100, found), (size_t)50);
+	for (size_t i = 0; i < 100; i++) {
+		if (i % 2 == 0) {
+			ASSERT_EQ(CSON_get_number(found[i]), (double)i);
+		} else {
+			ASSERT_TRUE(found[i] == NULL);
+		}
+	}
+	CSON_clear(&object);
+}
+
+UTEST(CSON_Test_storage, interned_strings){
+	CSON_StringTable strings;
+	CSON_StringTable_init(&strings);
+	CSON_ShapeTable shapes;
+	CSON_ShapeTable_init(&shapes);
+	CSON_ParseOptions options = {.strings = &strings};
+	CSON* cson;
+	ASSERT_EQ(CSON_parse_ex(&cson, "[{\"a rather long key\":\"a rather long value\"},"
+		"{\"a rather long key\":\"a rather long value\",\"ok\":\"ok\"}]", &options), CSON_SUCCES);
+	CSON_Member* first = (CSON_Member*)CSON_get_by_index(cson,0)->as.object->members.data;
+	CSON_Member* second = (CSON_Member*)CSON_get_by_index(cson,1)->as.object->members.data;
+	ASSERT_TRUE(first[0].key.string.as.string == second[0].key.string.as.string);
+	ASSERT_TRUE(CSON_get_string(&first[0].value) == CSON_get_string(&second[0].value));
+	ASSERT_EQ(first[0].value.as.string->refcount, (size_t)3); // two values and the table
+	ASSERT_EQ(strings.count, (size_t)2);
+	CSON_StringTable_free(&strings);
+	ASSERT_EQ(strcmp(CSON_get_string(CSON_get_by_key(CSON_get_by_index(cson,1),"a rather long key")),"a rather long value"),0);
+	CSON_free(cson);
+
+	// interned keys let shapes match by pointer
+	CSON_StringTable_init(&strings);
+	options.shapes = &shapes;
+	ASSERT_EQ(CSON_parse_ex(&cson, "[{\"a rather long key\":1},{\"a rather long key\":2}]", &options), CSON_SUCCES);
+	ASSERT_TRUE(CSON_get_by_index(cson,0)->as.object->shape == CSON_get_by_index(cson,1)->as.object->shape);
+	CSON_free(cson);
+	CSON_ShapeTable_free(&shapes);
+	CSON_StringTable_free(&strings);
+}
+
+UTEST(CSON_Test_storage, shared_subtrees){
+	CSON_SubtreeTable subtrees;
+	CSON_SubtreeTable_init(&subtrees);
+	CSON_ParseOptions options = {.subtrees = &subtrees};
+	CSON* cson;
+	ASSERT_EQ(CSON_parse_ex(&cson, "[{\"city\":\"Delft\",\"geo\":[52,4]},"
+		"{\"city\":\"Delft\",\"geo\":[52,4]},"
+		"{\"geo\":[52,4],\"city\":\"Delft\"},"
+		"[52,4]]", &options), CSON_SUCCES);
+	CSON* first = CSON_get_by_index(cson,0);
+	CSON* second = CSON_get_by_index(cson,1);
+	CSON* reordered = CSON_get_by_index(cson,2);
+	ASSERT_TRUE(first->as.object == second->as.object);
+	// key order is observable, so reordered objects are not merged
+	ASSERT_TRUE(first->as.object != reordered->as.object);
+	ASSERT_TRUE(CSON_get_by_key(first,"geo")->as.array == CSON_get_by_index(cson,3)->as.array);
+	ASSERT_TRUE(CSON_get_by_key(reordered,"geo")->as.array == CSON_get_by_index(cson,3)->as.array);
+	ASSERT_EQ(first->as.object->refcount, (size_t)3); // two uses and the table
+	CSON_SubtreeTable_free(&subtrees);
+	ASSERT_EQ(first->as.object->refcount, (size_t)2);
+	ASSERT_EQ(CSON_get_number(CSON_get_by_index(CSON_get_by_key(second,"geo"),1)), 4);
+	CSON_free(cson);
+}
+
+// struct binding tests
+typedef struct {
+	double lat;
+	float lon;
+} Test_Point;
+
+typedef struct {
+	int64_t id;
+	int8_t level;
+	bool active;
+	char name[16];
+	char* bio;
+	Test_Point home;
+	Test_Point trail[4];
+	size_t trail_count;
+	int32_t score;
+} Test_User;
+
+static const CSON_FieldDesc test_point_fields[] = {
+	{CSON_FIELD_DESC(Test_Point, lat, CSON_FIELD_DOUBLE)},
+	{CSON_FIELD_DESC(Test_Point, lon, CSON_FIELD_DOUBLE)},
+	{0},
+};
+
+static const CSON_FieldDesc test_point_element[] = {
+	{.name = "point", .type = CSON_FIELD_OBJECT, .size = sizeof(Test_Point), .fields = test_point_fields},
+};
+
+static const CSON_FieldDesc test_user_fields[] = {
+	{CSON_FIELD_DESC(Test_User, id, CSON_FIELD_INT)},
+	{CSON_FIELD_DESC(Test_User, level, CSON_FIELD_INT)},
+	{CSON_FIELD_DESC(Test_User, active, CSON_FIELD_BOOL)},
+	{CSON_FIELD_DESC(Test_User, name, CSON_FIELD_STRING)},
+	{CSON_FIELD_DESC(Test_User, bio, CSON_FIELD_STRING_DUP), .flags = CSON_FIELD_OPTIONAL},
+	{CSON_FIELD_DESC(Test_User, home, CSON_FIELD_OBJECT), .fields = test_point_fields},
+	{CSON_FIELD_DESC(Test_User, trail, CSON_FIELD_ARRAY), .fields = test_point_element,
+		.count_offset = offsetof(Test_User, trail_count)},
+	{CSON_FIELD_DESC(Test_User, score, CSON_FIELD_INT), .flags = CSON_FIELD_OPTIONAL},
+	{0},
+};
+
+UTEST(CSON_Test_binding, decode_struct){
+	Test_User user = {.score = -1};
+	ASSERT_EQ(CSON_decode("{\"id\":9007199254740991,\"level\":-3,\"active\":true,"
+		"\"name\":\"ada\",\"unknown\":{\"x\":[1,{}]},\"bio\":\"writes programs\","
+		"\"home\":{\"lat\":52.5,\"lon\":4.25},"
+		"\"trail\":[{\"lat\":1,\"lon\":2},{\"lon\":4,\"lat\":3}]}",
+		test_user_fields, &user), CSON_SUCCES);
+	ASSERT_EQ(user.id, (int64_t)9007199254740991);
+	ASSERT_EQ(user.level, (int8_t)-3);
+	ASSERT_TRUE(user.active);
+	ASSERT_EQ(strcmp(user.name, "ada"), 0);
+	ASSERT_EQ(strcmp(user.bio, "writes programs"), 0);
+	ASSERT_EQ(user.home.lat, 52.5);
+	ASSERT_EQ(user.home.lon, 4.25f);
+	ASSERT_EQ(user.trail_count, (size_t)2);
+	ASSERT_EQ(user.trail[1].lat, 3.0);
+	ASSERT_EQ(user.score, -1); // optional field left untouched
+
+	// escapes are decoded, the decoded length has to fit the inline buffer
+	const CSON_FieldDesc texts[] = {test_user_fields[3], test_user_fields[4], {0}};
+	ASSERT_EQ(CSON_decode("{\"name\":\"\\u0061\\u0062\\u0063\\u0064\\\"\",\"bio\":\"x\\ty\"}",
+		texts, &user), CSON_SUCCES);
+	ASSERT_STREQ(user.name, "abcd\"");
+	ASSERT_STREQ(user.bio, "x\ty");
+	CSON_decode_free(test_user_fields, &user);
+	ASSERT_TRUE(user.bio == NULL);
+}
+
+UTEST(CSON_Test_binding, decode_errors){
+	Test_User user = {0};
+	// missing required field
+	ASSERT_EQ(CSON_decode("{\"id\":1}", test_user_fields, &user), CSON_ERROR);
+	// out of range for int8_t
+	ASSERT_EQ(CSON_decode("{\"level\":300}", test_user_fields, &user), CSON_ERROR);
+	// string does not fit the inline buffer
+	ASSERT_EQ(CSON_decode("{\"name\":\"a name that is far too long\"}", test_user_fields, &user), CSON_ERROR);
+	// more elements than the inline array holds
+	ASSERT_EQ(CSON_decode("{\"trail\":[{\"lat\":1,\"lon\":1},{\"lat\":1,\"lon\":1},"
+		"{\"lat\":1,\"lon\":1},{\"lat\":1,\"lon\":1},{\"lat\":1,\"lon\":1}]}", test_user_fields, &user), CSON_ERROR);
+	ASSERT_EQ(user.trail[3].lat, 1.0);
+	CSON_decode_free(test_user_fields, &user);
+}
+
+typedef struct {
+	char *tags[4];
+	size_t tag_count;
+} Test_Tags;
+
+static const CSON_FieldDesc test_tag_element[] = {
+	{.name = "tag", .type = CSON_FIELD_STRING_DUP, .size = sizeof(char *)},
+};
+
+static const CSON_FieldDesc test_tags_fields[] = {
+	{CSON_FIELD_DESC(Test_Tags, tags, CSON_FIELD_ARRAY), .fields = test_tag_element,
+		.count_offset = offsetof(Test_Tags, tag_count)},
+	{0},
+};
+
+UTEST(CSON_Test_binding, decode_array_error_frees){
+	// strings decoded before a failing element stay reachable for the free
+	Test_Tags tags = {0};
+	ASSERT_EQ(CSON_decode("{\"tags\":[\"a\",\"b\",1]}", test_tags_fields, &tags), CSON_ERROR);
+	ASSERT_EQ(tags.tag_count, (size_t)3);
+	ASSERT_STREQ(tags.tags[0], "a");
+	ASSERT_STREQ(tags.tags[1], "b");
+	ASSERT_TRUE(tags.tags[2] == NULL);
+	CSON_decode_free(test_tags_fields, &tags);
+	ASSERT_TRUE(tags.tags[0] == NULL && tags.tags[1] == NULL);
+
+	ASSERT_EQ(CSON_decode("{\"tags\":[\"a\",\"b\",\"c\",\"d\",\"e\"]}", test_tags_fields, &tags), CSON_ERROR);
+	ASSERT_EQ(tags.tag_count, (size_t)4);
+	CSON_decode_free(test_tags_fields, &tags);
+	ASSERT_TRUE(tags.tags[3] == NULL);
+}
+
+UTEST(CSON_Test_binding, decode_exact_int){
+	Test_User user = {0};
+	const CSON_FieldDesc ids[] = {test_user_fields[0], {0}};
+	const CSON_FieldDesc level[] = {test_user_fields[1], {0}};
+	ASSERT_EQ(CSON_decode("{\"id\":9007199254740993}", ids, &user), CSON_SUCCES);
+	ASSERT_EQ(user.id, (int64_t)9007199254740993); // beyond 2^53
+	ASSERT_EQ(CSON_decode("{\"id\":-9223372036854775808}", ids, &user), CSON_SUCCES);
+	ASSERT_EQ(user.id, INT64_MIN);
+	ASSERT_EQ(CSON_decode("{\"id\":9223372036854775808}", ids, &user), CSON_ERROR);
+	ASSERT_EQ(CSON_decode("{\"id\":1.5}", ids, &user), CSON_ERROR);
+	ASSERT_EQ(CSON_decode("{\"id\":2.5e1}", ids, &user), CSON_SUCCES);
+	ASSERT_EQ(user.id, (int64_t)25);
+	ASSERT_EQ(CSON_decode("{\"level\":1e2}", level, &user), CSON_SUCCES);
+	ASSERT_EQ(user.level, (int8_t)100);
+	ASSERT_EQ(CSON_decode("{\"level\":-128}", level, &user), CSON_SUCCES);
+	ASSERT_EQ(user.level, (int8_t)-128);
+	ASSERT_EQ(CSON_decode("{\"level\":128}", level, &user), CSON_ERROR);
+}
+
+UTEST(CSON_Test_binding, decode_field_limit){
+	// nested descriptors are limited to CSON_MAX_FIELDS fields as well
+	char names[CSON_MAX_FIELDS + 1][8];
+	CSON_FieldDesc wide[CSON_MAX_FIELDS + 2] = {0};
+	for (size_t i = 0; i <= CSON_MAX_FIELDS; i++) {
+		snprintf(names[i], sizeof(names[i]), "f%zu", i);
+		wide[i] = (CSON_FieldDesc){.name = names[i], .type = CSON_FIELD_INT,
+			.size = sizeof(int64_t), .flags = CSON_FIELD_OPTIONAL};
+	}
+	CSON_FieldDesc outer[] = {
+		{.name = "inner", .type = CSON_FIELD_OBJECT, .fields = wide},
+		{0},
+	};
+	int64_t value = 0;
+	ASSERT_EQ(CSON_decode("{\"inner\":{\"f64\":1}}", outer, &value), CSON_ERROR);
+	wide[CSON_MAX_FIELDS].name = NULL;
+	ASSERT_EQ(CSON_decode("{\"inner\":{\"f63\":2}}", outer, &value), CSON_SUCCES);
+	ASSERT_EQ(value, (int64_t)2);
+}
+
+#define TEST_ACCOUNT_FIELDS(FIELD) \
+	FIELD(int64, id) \
+	FIELD(string, name) \
+	FIELD(double, balance) \
+	FIELD(int32, age) \
+	FIELD(bool, admin)
+CSON_STRUCT(Test_Account, TEST_ACCOUNT_FIELDS)
+
+UTEST(CSON_Test_binding, generated_decode){
+	Test_Account account = {.age = 7};
+	ASSERT_EQ(Test_Account_decode("{\"id\":9007199254740993,\"name\":\"ada\",\"nope\":[1,{\"a\":2}],"
+		"\"balance\":12.5,\"admin\":true,\"age\":null}", &account), CSON_SUCCES);
+	ASSERT_EQ(account.id, (int64_t)9007199254740993); // exact beyond 2^53
+	ASSERT_EQ(strcmp(account.name, "ada"), 0);
+	ASSERT_EQ(account.balance, 12.5);
+	ASSERT_EQ(account.age, 7); // null keeps the previous value
+	ASSERT_TRUE(account.admin);
+	ASSERT_EQ(Test_Account_decode("{\"age\":3000000000}", &account), CSON_ERROR);
+	ASSERT_EQ(Test_Account_decode("{\"admin\":1}", &account), CSON_ERROR);
+	ASSERT_EQ(Test_Account_decode("{\"id\":99999999999999999999}", &account), CSON_ERROR);
+	ASSERT_EQ(Test_Account_decode("{\"id\":-}", &account), CSON_ERROR);
+	ASSERT_EQ(Test_Account_decode("{\"balance\":1.2.3}", &account), CSON_ERROR);
+	ASSERT_EQ(account.balance, 12.5);
+	Test_Account_free(&account);
+	ASSERT_TRUE(account.name == NULL);
+}
+
+UTEST(CSON_Test_binding, generated_encode){
+	Test_Account account = {.id = -4, .name = "a \"b\"\n", .balance = 0.5, .age = 30};
+	CVec out;
+	CVec_init(&out, sizeof(char), 0);
+	Test_Account_encode(&account, &out);
+	char nul = '\0';
+	CVec_push_back(&out, &nul);
+	ASSERT_STREQ(out.data, "{\"id\":-4,\"name\":\"a \\\"b\\\"\\n\",\"balance\":0.5,\"age\":30,\"admin\":false}");
+	CVec_free(&out);
+
+	// whatever the encoder writes decodes back to the same values
+	const char *names[] = {"round trip", "a \"quoted\" name", "line\nbreak\tand \\ \x01",
+		"caf\xc3\xa9"};
+	double balances[] = {0.5, 1e20, 1e-7, -0.0};
+	for (size_t i = 0; i < 4; i++) {
+		account.name = (char *)names[i];
+		account.balance = balances[i];
+		account.id = i % 2 ? INT64_MIN : INT64_MAX;
+		CVec_init(&out, sizeof(char), 0);
+		Test_Account_encode(&account, &out);
+		CVec_push_back(&out, &nul);
+		Test_Account decoded = {0};
+		ASSERT_EQ(Test_Account_decode(out.data, &decoded), CSON_SUCCES);
+		ASSERT_EQ(decoded.id, account.id);
+		ASSERT_STREQ(decoded.name, account.name);
+		ASSERT_EQ(decoded.balance, account.balance);
+		ASSERT_EQ(signbit(decoded.balance), signbit(account.balance));
+		Test_Account_free(&decoded);
+		CVec_free(&out);
+	}
+
+	// escapes written by hand are decoded too
+	Test_Account decoded = {0};
+	ASSERT_EQ(Test_Account_decode("{\"name\":\"a\\nb\\u00e9\\/\",\"balance\":2.5E+2,\"id\":1e3}",
+		&decoded), CSON_SUCCES);
+	ASSERT_STREQ(decoded.name, "a\nb\xc3\xa9/");
+	ASSERT_EQ(decoded.balance, 250.0);
+	ASSERT_EQ(decoded.id, (int64_t)1000);
+	ASSERT_EQ(Test_Account_decode("{\"name\":\"\\q\"}", &decoded), CSON_ERROR);
+	Test_Account_free(&decoded);
+}
+
+UTEST(CSON_Test_lookup, json_pointer){
+	CSON *cson;
+	ASSERT_EQ(CSON_parse(&cson, "{\"a\":{\"b\":[10,20,{\"c\":true}]},\"m/n\":1,\"t~\":2,\"7\":3}"), CSON_SUCCES);
+	CSON_Path *path = CSON_Path_compile("/a/b/2/c");
+	ASSERT_TRUE(path != NULL);
+	ASSERT_TRUE(CSON_get_bool(CSON_Path_get(path, cson)));
+	CSON_Path_free(path);
+
+	path = CSON_Path_compile("/m~1n");
+	ASSERT_EQ(CSON_get_number(CSON_Path_get(path, cson)), 1.0);
+	CSON_Path_free(path);
+	path = CSON_Path_compile("/t~0");
+	ASSERT_EQ(CSON_get_number(CSON_Path_get(path, cson)), 2.0);
+	CSON_Path_free(path);
+	path = CSON_Path_compile("/7"); // index tokens still name members
+	ASSERT_EQ(CSON_get_number(CSON_Path_get(path, cson)), 3.0);
+	CSON_Path_free(path);
+	path = CSON_Path_compile("");
+	ASSERT_TRUE(CSON_Path_get(path, cson) == cson);
+	CSON_Path_free(path);
+	path = CSON_Path_compile("/a/b/01");
+	ASSERT_TRUE(CSON_Path_get(path, cson) == NULL); // leading zero is no index
+	CSON_Path_free(path);
+
+	ASSERT_TRUE(CSON_Path_compile("a/b") == NULL);
+	ASSERT_TRUE(CSON_Path_compile("/a~2") == NULL);
+	CSON_free(cson);
+}
+
+UTEST(CSON_Test_lookup, json_path){
+	char json[] = "{\"store\":{\"book\":[{\"price\":8,\"tags\":[\"a\"]},{\"price\":12},"
+		"{\"price\":9},{\"price\":22}],\"bike\":{\"price\":19}},\"price\":1}";
+	CSON *cson;
+	ASSERT_EQ(CSON_parse(&cson, json), CSON_SUCCES);
+	const char *exprs[] = {"$.store.book[*].price", "$..price", "$.store.book[1:3].price",
+		"$.store.book[-1]['price']", "$.store.book[::2].price", "$.store.*.price", "$..book[0].tags[0]"};
+	double expected[][6] = {{8, 12, 9, 22}, {8, 12, 9, 22, 19, 1}, {12, 9}, {22}, {8, 9}, {19}, {0}};
+	size_t counts[] = {4, 6, 2, 1, 2, 1, 1};
+	for (size_t e = 0; e < sizeof(exprs) / sizeof(exprs[0]); e++) {
+		CSON_Path *path = CSON_Path_compile(exprs[e]);
+		ASSERT_TRUE(path != NULL);
+		CVec nodes, spans;
+		CVec_init(&nodes, sizeof(CSON *), 0);
+		CVec_init(&spans, sizeof(CSON_SV), 0);
+		ASSERT_EQ(CSON_Path_eval(path, cson, &nodes), counts[e]);
+		ASSERT_EQ(CSON_Path_eval_raw(path, json, &spans), CSON_SUCCES);
+		ASSERT_EQ(spans.element_count, counts[e]);
+		for (size_t i = 0; i < counts[e]; i++) {
+			CSON *node = ((CSON **)nodes.data)[i];
+			CSON_SV span = ((CSON_SV *)spans.data)[i];
+			if (CSON_is_number(node)) {
+				ASSERT_EQ(CSON_get_number(node), expected[e][i]);
+				ASSERT_EQ(strtod(span.str, NULL), expected[e][i]);
+			} else {
+				ASSERT_EQ(span.len, (size_t)3); // "a" with its quotes
+			}
+		}
+		CVec_free(&nodes);
+		CVec_free(&spans);
+		CSON_Path_free(path);
+	}
+
+	// objects are returned as their source text
+	CSON_Path *path = CSON_Path_compile("$.store.bike");
+	CVec spans;
+	CVec_init(&spans, sizeof(CSON_SV), 0);
+	ASSERT_EQ(CSON_Path_eval_raw(path, json, &spans), CSON_SUCCES);
+	ASSERT_EQ(strncmp(((CSON_SV *)spans.data)[0].str, "{\"price\":19}", ((CSON_SV *)spans.data)[0].len), 0);
+	ASSERT_EQ(CSON_Path_eval_raw(path, "{\"store\":{\"bike\":[1,}}", &spans), CSON_ERROR);
+	ASSERT_EQ(spans.element_count, (size_t)1);
+	CVec_free(&spans);
+	CSON_Path_free(path);
+
+	ASSERT_TRUE(CSON_Path_compile("$..") == NULL);
+	ASSERT_TRUE(CSON_Path_compile("$.a[1:2:0]") == NULL);
+	ASSERT_TRUE(CSON_Path_compile("$.a[") == NULL);
+	CSON_free(cson);
+}
+
+UTEST(CSON_Test_element, skip_value){
+	const char *json = " {\"a\":[1,2,{\"b\":\"}]\\\"[\"}],\"long string without brackets\":\"x\"} ,next";
+	const char *end = json + strlen(json);
+	const char *next = CSON_skip_value(json, end);
+	ASSERT_TRUE(next != NULL);
+	ASSERT_STREQ(next, " ,next");
+
+	const char *str = "\"ab\\\\\" tail";
+	ASSERT_STREQ(CSON_skip_value(str, str + strlen(str)), " tail");
+	const char *num = "-12.5]";
+	ASSERT_STREQ(CSON_skip_value(num, num + strlen(num)), "]");
+	const char *word = "true";
+	ASSERT_TRUE(CSON_skip_value(word, word + 4) == word + 4);
+
+	// unterminated values and values cut off by end
+	const char *open = "[[1,2],[3";
+	ASSERT_TRUE(CSON_skip_value(open, open + strlen(open)) == NULL);
+	ASSERT_TRUE(CSON_skip_value(json, json + 20) == NULL);
+	ASSERT_TRUE(CSON_skip_value(str, str + 4) == NULL);
+	const char *comma = ",1";
+	ASSERT_TRUE(CSON_skip_value(comma, comma + 2) == NULL);
+}
+
+UTEST(CSON_Test_element, validate){
+	const char *valid = " {\"a\":[1,-2.5e+3,true,null,{}],\"b\\u00e9\\n\":\"long string value\",\"c\":[[]]} ";
+	CSON_ValidateInfo info;
+	ASSERT_EQ(CSON_validate(valid, strlen(valid), &info), CSON_SUCCES);
+	ASSERT_EQ(info.length, strlen(valid));
+	ASSERT_EQ(info.max_depth, (size_t)3);
+	ASSERT_EQ(info.element_count, (size_t)10);
+	ASSERT_EQ(info.error_offset, SIZE_MAX);
+	ASSERT_EQ(CSON_validate("0", 1, NULL), CSON_SUCCES);
+
+	const char *invalid[] = {"", "[1,]", "{\"a\" 1}", "[01]", "[1.]", "\"a\\x\"", "[\"\x01\"]",
+		"{\"a\":1,}", "[1] 2", "[1}", "tru", "{1:2}", "[\"abc"};
+	size_t offsets[] = {0, 3, 5, 2, 3, 3, 2, 7, 4, 2, 0, 1, 5};
+	for (size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++) {
+		ASSERT_EQ(CSON_validate(invalid[i], strlen(invalid[i]), &info), CSON_ERROR);
+		ASSERT_EQ(info.error_offset, offsets[i]);
+	}
+
+	// nesting beyond CSON_MAX_DEPTH is rejected without recursion
+	char deep[CSON_MAX_DEPTH + 2];
+	memset(deep, '[', sizeof(deep));
+	ASSERT_EQ(CSON_validate(deep, sizeof(deep), &info), CSON_ERROR);
+	ASSERT_EQ(info.error_offset, (size_t)CSON_MAX_DEPTH);
+}
+
+UTEST(CSON_Test_element, validate_implies_parse){
+	// whatever validates is accepted by the parsers and the transcoder
+	const char *documents[] = {"[1e5]", "[\"a\\\"b\"]", "-0", "0.5E-3", "[-1.25e+2,0,-0.0]",
+		"{\"k\\\"\\\\\\/\\b\\f\\n\\r\\t\\u00e9\":\"\\ud83d\\ude00\"}", "\"\\\\\"",
+		"{\"a\":[{\"b\":[]},{}],\"\":\"\"}", " \t\r\n[ true , false , null ] "};
+	for (size_t i = 0; i < sizeof(documents) / sizeof(documents[0]); i++) {
+		char *text = (char *)documents[i];
+		ASSERT_EQ(CSON_validate(text, strlen(text), NULL), CSON_SUCCES);
+		CSON *cson;
+		ASSERT_EQ(CSON_parse(&cson, text), CSON_SUCCES);
+		CSON_free(cson);
+		CSON_Tape tape;
+		ASSERT_EQ(CSON_Tape_parse(&tape, text), CSON_SUCCES);
+		CSON_Tape_free(&tape);
+		CVec out;
+		CVec_init(&out, 1, 16);
+		ASSERT_EQ(CSON_json_to_msgpack(text, &out), CSON_SUCCES);
+		CVec_free(&out);
+	}
+
+	// parsed strings hold the decoded text
+	CSON *cson;
+	ASSERT_EQ(CSON_parse(&cson, "{\"q\\\"k\":[\"a\\\"b\\n\\u00e9\",1e5]}"), CSON_SUCCES);
+	CSON *list = CSON_get_by_key(cson, "q\"k");
+	ASSERT_TRUE(list != NULL);
+	ASSERT_STREQ(CSON_get_string(CSON_get_by_index(list, 0)), "a\"b\n\xc3\xa9");
+	ASSERT_EQ(CSON_get_number(CSON_get_by_index(list, 1)), 1e5);
+	CSON_free(cson);
+}
+
+UTEST(CSON_Test_storage, freeze){
+	CSON_ShapeTable shapes;
+	CSON_SubtreeTable subtrees;
+	CSON_ShapeTable_init(&shapes);
+	CSON_SubtreeTable_init(&subtrees);
+	CSON_ParseOptions options = {.shapes = &shapes, .subtrees = &subtrees};
+	CSON *cson;
+	ASSERT_EQ(CSON_parse_ex(&cson, "{\"routes\":[{\"path\":\"/a/rather/long/route\",\"id\":1},"
+		"{\"path\":\"/a/rather/long/route\",\"id\":1}],\"flags\":{\"a\":1,\"b\":2,\"c\":3,\"d\":4,"
+		"\"e\":5,\"f\":6,\"g\":7,\"h\":8,\"i\":9},\"name\":\"short\",\"n\":null}", &options), CSON_SUCCES);
+	CSON_ShapeTable_free(&shapes);
+	CSON_SubtreeTable_free(&subtrees);
+
+	CSON *frozen = CSON_freeze(cson);
+	ASSERT_TRUE(CSON_is_frozen(frozen));
+	CSON *routes = CSON_get_by_key(frozen, "routes");
+	CSON *route = CSON_get_by_index(routes, 1);
+	ASSERT_TRUE(CSON_is_frozen(route));
+	ASSERT_STREQ(CSON_get_string(CSON_get_by_key(route, "path")), "/a/rather/long/route");
+	ASSERT_EQ(CSON_get_number(CSON_get_by_key(CSON_get_by_key(frozen, "flags"), "i")), 9.0);
+	ASSERT_TRUE(CSON_get_by_key(frozen, "flags")->as.object->shape->index.slots != NULL);
+	ASSERT_TRUE(CSON_is_null(CSON_get_by_key(frozen, "n")));
+
+	// everything lives in one block after the root, laid out depth first
+	char *block = (char *)frozen;
+	char *first = (char *)CSON_get_by_index(routes, 0)->as.object;
+	char *second = (char *)route->as.object;
+	char *flags = (char *)CSON_get_by_key(frozen, "flags")->as.object;
+	ASSERT_TRUE(block < (char *)frozen->as.object);
+	ASSERT_TRUE((char *)routes->as.array < first && first < second && second < flags);
+	CSON_free(frozen);
+}
+
+typedef struct {
+	CSON *object;
+	atomic_bool *start;
+	size_t found;
+} Test_Reader;
+
+static void *test_reader(void *arg) {
+	Test_Reader *reader = arg;
+	while (!atomic_load(reader->start)) {
+	}
+	char key[8];
+	for (size_t round = 0; round < 100; round++) {
+		for (size_t i = 0; i < 64; i++) {
+			snprintf(key, sizeof(key), "k%zu", i);
+			CSON *value = CSON_get_by_key(reader->object, key);
+			reader->found += value && CSON_get_number(value) == (double)i;
+		}
+	}
+	return NULL;
+}
+
+UTEST(CSON_Test_lookup, concurrent_reads){
+	CSON *cson = malloc(sizeof(CSON));
+	*cson = CSON_Object_new();
+	char key[8];
+	for (size_t i = 0; i < 64; i++) {
+		snprintf(key, sizeof(key), "k%zu", i);
+		CSON k = CSON_String_from_sv((CSON_SV){.str = key, .len = strlen(key)});
+		CSON v = CSON_Number_new((double)i);
+		CSON_Object_insert(cson->as.object, &k, &v);
+	}
+	ASSERT_TRUE(atomic_load(&cson->as.object->index) == NULL);
+
+	// all readers hit the object before it has an index and race to build it
+	atomic_bool start = false;
+	pthread_t threads[8];
+	Test_Reader readers[8];
+	for (size_t t = 0; t < 8; t++) {
+		readers[t] = (Test_Reader){.object = cson, .start = &start};
+		ASSERT_EQ(pthread_create(&threads[t], NULL, test_reader, &readers[t]), 0);
+	}
+	atomic_store(&start, true);
+	for (size_t t = 0; t < 8; t++) {
+		pthread_join(threads[t], NULL);
+		ASSERT_EQ(readers[t].found, (size_t)6400);
+	}
+	ASSERT_TRUE(atomic_load(&cson->as.object->index) != NULL);
+	CSON_free(cson);
+}
+
+typedef struct {
+	CSON_Handle *handle;
+	atomic_bool *done;
+	size_t reads;
+	size_t torn;
+} Test_HandleReader;
+
+static void *test_handle_reader(void *arg) {
+	Test_HandleReader *reader = arg;
+	while (!atomic_load(reader->done)) {
+		size_t ticket;
+		CSON *root = CSON_Handle_acquire(reader->handle, &ticket);
+		double a = CSON_get_number(CSON_get_by_key(root, "a"));
+		const char *b = CSON_get_string(CSON_get_by_key(root, "b"));
+		reader->torn += strtod(b, NULL) != a;
+		reader->reads++;
+		CSON_Handle_release(reader->handle, ticket);
+	}
+	return NULL;
+}
+
+UTEST(CSON_Test_handle, publish){
+	CSON *root;
+	ASSERT_EQ(CSON_parse(&root, "{\"a\":0,\"b\":\"0 as a heap string\"}"), CSON_SUCCES);
+	CSON_Handle handle;
+	CSON_Handle_init(&handle, root);
+
+	atomic_bool done = false;
+	pthread_t threads[4];
+	Test_HandleReader readers[4];
+	for (size_t t = 0; t < 4; t++) {
+		readers[t] = (Test_HandleReader){.handle = &handle, .done = &done};
+		ASSERT_EQ(pthread_create(&threads[t], NULL, test_handle_reader, &readers[t]), 0);
+	}
+	char json[64];
+	for (size_t version = 1; version <= 200; version++) {
+		snprintf(json, sizeof(json), "{\"a\":%zu,\"b\":\"%zu as a heap string\"}", version, version);
+		ASSERT_EQ(CSON_parse(&root, json), CSON_SUCCES);
+		CSON_Handle_publish(&handle, root); // frees the previous version
+	}
+	atomic_store(&done, true);
+	for (size_t t = 0; t < 4; t++) {
+		pthread_join(threads[t], NULL);
+		ASSERT_EQ(readers[t].torn, (size_t)0);
+	}
+
+	size_t ticket;
+	root = CSON_Handle_acquire(&handle, &ticket);
+	ASSERT_EQ(CSON_get_number(CSON_get_by_key(root, "a")), 200.0);
+	CSON_Handle_release(&handle, ticket);
+	CSON_Handle_free(&handle);
+}
+
+typedef struct {
+	CSON_Handle *handle;
+	atomic_size_t *finished;
+	size_t kept;
+} Test_SubtreeReader;
+
+static void *test_subtree_reader(void *arg) {
+	Test_SubtreeReader *reader = arg;
+	for (size_t i = 0; i < 2000; i++) {
+		size_t ticket;
+		CSON *root = CSON_Handle_acquire(reader->handle, &ticket);
+		CSON value = CSON_Literal_new(CSON_TRUE);
+		CSON *copy = CSON_with_key(CSON_get_by_key(root, "shared"), "seen", &value);
+		CSON_Handle_release(reader->handle, ticket);
+		// the writer may retire the root now, copy still holds the subtree
+		CSON *list = CSON_get_by_key(copy, "list");
+		reader->kept += CSON_get_number(CSON_get_by_index(list, 2)) == 3.0 &&
+			strcmp(CSON_get_string(CSON_get_by_key(copy, "name")), "a name long enough") == 0;
+		CSON_free(copy);
+	}
+	atomic_fetch_add(reader->finished, 1);
+	return NULL;
+}
+
+UTEST(CSON_Test_handle, shared_subtrees){
+	CSON *root;
+	ASSERT_EQ(CSON_parse(&root, "{\"a\":0,\"shared\":{\"list\":[1,2,3],\"name\":\"a name long enough\"}}"), CSON_SUCCES);
+	CSON_Handle handle;
+	CSON_Handle_init(&handle, root);
+
+	atomic_size_t finished = 0;
+	pthread_t threads[4];
+	Test_SubtreeReader readers[4];
+	for (size_t t = 0; t < 4; t++) {
+		readers[t] = (Test_SubtreeReader){.handle = &handle, .finished = &finished};
+		ASSERT_EQ(pthread_create(&threads[t], NULL, test_subtree_reader, &readers[t]), 0);
+	}
+	// every version shares "shared" with the one it replaces
+	for (size_t version = 1; atomic_load(&finished) < 4; version++) {
+		size_t ticket;
+		CSON *current = CSON_Handle_acquire(&handle, &ticket);
+		CSON value = CSON_Number_new((double)version);
+		CSON *next = CSON_with_key(current, "a", &value);
+		CSON_Handle_release(&handle, ticket);
+		CSON_Handle_publish(&handle, next);
+	}
+	for (size_t t = 0; t < 4; t++) {
+		pthread_join(threads[t], NULL);
+		ASSERT_EQ(readers[t].kept, (size_t)2000);
+	}
+
+	size_t ticket;
+	root = CSON_Handle_acquire(&handle, &ticket);
+	ASSERT_EQ(CSON_get_by_key(root, "shared")->as.object->refcount, (size_t)1);
+	CSON_Handle_release(&handle, ticket);
+	CSON_Handle_free(&handle);
+}
+
+UTEST(CSON_Test_persistent, updates){
+	CSON *v1;
+	ASSERT_EQ(CSON_parse(&v1, "{\"config\":{\"limits\":[1,2,3],\"name\":\"a name long enough\"},"
+		"\"other\":{\"big\":[1,2,3,4]}}"), CSON_SUCCES);
+
+	CSON value = CSON_Number_new(20);
+	CSON *v2 = CSON_with_pointer(v1, "/config/limits/1", &value);
+	ASSERT_TRUE(v2 != NULL);
+	ASSERT_TRUE(CSON_is_null(&value)); // moved in
+	ASSERT_EQ(CSON_get_number(CSON_get_by_index(CSON_get_by_key(CSON_get_by_key(v2, "config"), "limits"), 1)), 20.0);
+	ASSERT_EQ(CSON_get_number(CSON_get_by_index(CSON_get_by_key(CSON_get_by_key(v1, "config"), "limits"), 1)), 2.0);
+	// untouched subtrees are shared, not copied
+	ASSERT_TRUE(CSON_get_by_key(v1, "other")->as.object == CSON_get_by_key(v2, "other")->as.object);
+	ASSERT_TRUE(CSON_get_by_key(CSON_get_by_key(v1, "config"), "name")->as.string ==
+		CSON_get_by_key(CSON_get_by_key(v2, "config"), "name")->as.string);
+
+	value = CSON_Literal_new(CSON_TRUE);
+	CSON *v3 = CSON_with_pointer(v2, "/config/limits/-", &value);
+	ASSERT_EQ(CSON_get_by_key(CSON_get_by_key(v3, "config"), "limits")->as.array->data.element_count, (size_t)4);
+	value = CSON_Number_new(1);
+	ASSERT_TRUE(CSON_with_pointer(v2, "/missing/key", &value) == NULL);
+	ASSERT_TRUE(CSON_with_pointer(v2, "/config/limits/7", &value) == NULL);
+	ASSERT_EQ(CSON_get_number(&value), 1.0); // untouched on failure
+
+	CSON *v4 = CSON_with_key(v3, "added", &value);
+	ASSERT_EQ(CSON_get_number(CSON_get_by_key(v4, "added")), 1.0);
+	ASSERT_TRUE(CSON_get_by_key(v3, "added") == NULL);
+	value = CSON_Number_new(0);
+	CSON *v5 = CSON_with_index(CSON_get_by_key(CSON_get_by_key(v4, "other"), "big"), 0, &value);
+	ASSERT_EQ(CSON_get_number(CSON_get_by_index(v5, 0)), 0.0);
+
+	// versions are freed independently in any order
+	CSON_free(v2);
+	CSON_free(v1);
+	CSON_free(v4);
+	ASSERT_TRUE(CSON_get_bool(CSON_get_by_index(CSON_get_by_key(CSON_get_by_key(v3, "config"), "limits"), 3)));
+	CSON_free(v3);
+	CSON_free(v5);
+}
+
+typedef struct {
+	CSON *base;
+	atomic_bool *start;
+	size_t derived;
+} Test_Deriver;
+
+static void *test_deriver(void *arg) {
+	Test_Deriver *deriver = arg;
+	while (!atomic_load(deriver->start)) {
+	}
+	for (size_t i = 0; i < 1000; i++) {
+		CSON value = CSON_Number_new((double)i);
+		CSON *version = CSON_with_key(deriver->base, "n", &value);
+		deriver->derived += CSON_get_number(CSON_get_by_key(version, "n")) == (double)i;
+		CSON_free(version);
+	}
+	return NULL;
+}
+
+UTEST(CSON_Test_persistent, concurrent_versions){
+	CSON *base;
+	ASSERT_EQ(CSON_parse(&base, "{\"n\":0,\"shared\":{\"list\":[1,2,3]},\"name\":\"a name long enough\"}"), CSON_SUCCES);
+
+	// every version takes and drops references to the same subtrees
+	atomic_bool start = false;
+	pthread_t threads[4];
+	Test_Deriver derivers[4];
+	for (size_t t = 0; t < 4; t++) {
+		derivers[t] = (Test_Deriver){.base = base, .start = &start};
+		ASSERT_EQ(pthread_create(&threads[t], NULL, test_deriver, &derivers[t]), 0);
+	}
+	atomic_store(&start, true);
+	for (size_t t = 0; t < 4; t++) {
+		pthread_join(threads[t], NULL);
+		ASSERT_EQ(derivers[t].derived, (size_t)1000);
+	}
+	ASSERT_EQ(CSON_get_by_key(base, "shared")->as.object->refcount, (size_t)1);
+	ASSERT_EQ(CSON_get_by_key(base, "name")->as.string->refcount, (size_t)1);
+	CSON_free(base);
+}
+
+UTEST(CSON_Test_edit, editing){
+	CSON *cson;
+	ASSERT_EQ(CSON_parse(&cson, "{\"a\":[1,2,3,4],\"b\":{\"x\":\"a string long enough\"},\"c\":null}"), CSON_SUCCES);
+	CSON_set_string(CSON_get_by_key(cson, "c"), "another long string");
+	ASSERT_EQ(strcmp(CSON_get_string(CSON_get_by_key(cson, "c")), "another long string"), 0);
+	CSON_set_bool(CSON_get_by_key(cson, "c"), true);
+	ASSERT_TRUE(CSON_get_bool(CSON_get_by_key(cson, "c")));
+	CSON_set_number(CSON_get_by_key(cson, "c"), 3);
+	ASSERT_EQ(CSON_get_number(CSON_get_by_key(cson, "c")), 3.0);
+	CSON_set_null(CSON_get_by_key(cson, "c"));
+	ASSERT_TRUE(CSON_is_null(CSON_get_by_key(cson, "c")));
+
+	CSON_Array *array = CSON_get_by_key(cson, "a")->as.array;
+	CSON value = CSON_Number_new(0);
+	CSON_Array_insert(array, 0, &value);
+	value = CSON_Number_new(5);
+	CSON_Array_insert(array, 5, &value);
+	CSON removed;
+	CSON_Array_remove(array, 2, &removed);
+	ASSERT_EQ(CSON_get_number(&removed), 2.0);
+	CSON_Array_swap_remove(array, 0, NULL);
+	value = CSON_Number_new(9);
+	CSON_Array_set(array, 1, &value);
+	double expected[] = {5, 9, 3, 4};
+	ASSERT_EQ(array->data.element_count, (size_t)4);
+	for(size_t i = 0; i < 4; i++){
+		ASSERT_EQ(CSON_get_number(CSON_get_by_index(CSON_get_by_key(cson, "a"), i)), expected[i]);
+	}
+
+	// a subtree moves between containers without being copied
+	CSON_Object *object = cson->as.object;
+	CSON_Object *inner = CSON_get_by_key(cson, "b")->as.object;
+	CSON moved;
+	ASSERT_EQ(CSON_Object_remove(object, "b", &moved), CSON_SUCCES);
+	ASSERT_TRUE(moved.as.object == inner);
+	ASSERT_EQ(CSON_Object_remove(object, "b", NULL), CSON_ERROR);
+	CSON_Array_append(array, &moved);
+	ASSERT_EQ(strcmp(CSON_get_string(CSON_get_by_key(CSON_get_by_index(CSON_get_by_key(cson, "a"), 4), "x")), "a string long enough"), 0);
+
+	CSON key = CSON_String_from_sv((CSON_SV){.str = "c", .len = 1});
+	value = CSON_Number_new(7);
+	CSON_Object_set(object, &key, &value);
+	ASSERT_EQ(CSON_Object_count(object), (size_t)2);
+	ASSERT_EQ(CSON_get_number(CSON_get_by_key(cson, "c")), 7.0);
+	CSON_free(cson);
+}
+
+UTEST(CSON_Test_edit, editing_keeps_index){
+	CSON cson = CSON_Object_new();
+	CSON_Object *object = cson.as.object;
+	char name[8];
+	for(int i = 0; i < 20; i++){
+		snprintf(name, sizeof(name), "k%d", i);
+		CSON key = CSON_String_from_sv((CSON_SV){.str = name, .len = strlen(name)});
+		CSON value = CSON_Number_new(i);
+		CSON_Object_insert(object, &key, &value);
+	}
+	ASSERT_TRUE(CSON_get_by_key(&cson, "k0") != NULL); // builds the index
+	CSON_Index *index = atomic_load(&object->index);
+	ASSERT_TRUE(index != NULL);
+
+	CSON_Object_remove(object, "k3", NULL);
+	CSON_Object_swap_remove_at(object, 0, NULL); // k0, k19 takes its place
+	CSON_Object_remove_at(object, 5, NULL);      // k6
+	CSON key = CSON_String_from_sv((CSON_SV){.str = "k5", .len = 2});
+	CSON value = CSON_Number_new(50);
+	CSON_Object_set(object, &key, &value);
+	key = CSON_String_from_sv((CSON_SV){.str = "new", .len = 3});
+	value = CSON_Number_new(100);
+	CSON_Object_set(object, &key, &value);
+	ASSERT_TRUE(atomic_load(&object->index) == index); // kept, not rebuilt
+
+	ASSERT_EQ(CSON_Object_count(object), (size_t)18);
+	for(int i = 0; i < 20; i++){
+		snprintf(name, sizeof(name), "k%d", i);
+		CSON *found = CSON_get_by_key(&cson, name);
+		if(i == 0 || i == 3 || i == 6){
+			ASSERT_TRUE(found == NULL);
+		} else {
+			ASSERT_TRUE(found != NULL);
+			ASSERT_EQ(CSON_get_number(found), i == 5 ? 50.0 : (double)i);
+		}
+	}
+	ASSERT_EQ(CSON_get_number(CSON_get_by_key(&cson, "new")), 100.0);
+	CSON_clear(&cson);
+}
+
+UTEST(CSON_Test_patch, json_patch){
+	CSON *doc, *patch;
+	ASSERT_EQ(CSON_parse(&doc, "{\"a\":{\"b\":[1,2,3]},\"c\":\"a string long enough\",\"d\":null}"), CSON_SUCCES);
+	CSON_Object *inner = CSON_get_by_key(doc, "a")->as.object;
+	ASSERT_EQ(CSON_parse(&patch, "["
+		"{\"op\":\"add\",\"path\":\"/a/b/1\",\"value\":10},"
+		"{\"op\":\"remove\",\"path\":\"/d\"},"
+		"{\"op\":\"replace\",\"path\":\"/a/b/0\",\"value\":{\"x\":[true]}},"
+		"{\"op\":\"move\",\"from\":\"/a\",\"path\":\"/moved\"},"
+		"{\"op\":\"copy\",\"from\":\"/c\",\"path\":\"/moved/b/-\"},"
+		"{\"op\":\"test\",\"path\":\"/moved/b/1\",\"value\":10}]"), CSON_SUCCES);
+	ASSERT_EQ(CSON_apply_patch(doc, patch), CSON_SUCCES);
+	CSON_free(patch);
+
+	ASSERT_TRUE(CSON_get_by_key(doc, "a") == NULL);
+	ASSERT_TRUE(CSON_get_by_key(doc, "d") == NULL);
+	CSON *moved = CSON_get_by_key(doc, "moved");
+	ASSERT_TRUE(moved->as.object == inner); // moved, not copied
+	CSON *b = CSON_get_by_key(moved, "b");
+	ASSERT_EQ(b->as.array->data.element_count, (size_t)5);
+	ASSERT_TRUE(CSON_get_bool(CSON_get_by_index(CSON_get_by_key(CSON_get_by_index(b, 0), "x"), 0)));
+	ASSERT_EQ(CSON_get_number(CSON_get_by_index(b, 1)), 10.0);
+	ASSERT_EQ(CSON_get_number(CSON_get_by_index(b, 3)), 3.0);
+	ASSERT_EQ(strcmp(CSON_get_string(CSON_get_by_index(b, 4)), "a string long enough"), 0);
+
+	// a failing operation rolls back the ones before it
+	CSON *before;
+	ASSERT_EQ(CSON_parse(&before, "{\"c\":\"a string long enough\",\"moved\":{\"b\":[{\"x\":[true]},10,2,3,\"a string long enough\"]}}"), CSON_SUCCES);
+	ASSERT_EQ(CSON_parse(&patch, "["
+		"{\"op\":\"remove\",\"path\":\"/c\"},"
+		"{\"op\":\"move\",\"from\":\"/moved/b/2\",\"path\":\"/moved/b/0\"},"
+		"{\"op\":\"replace\",\"path\":\"/moved\",\"value\":1},"
+		"{\"op\":\"add\",\"path\":\"/new\",\"value\":[1]},"
+		"{\"op\":\"move\",\"from\":\"/new\",\"path\":\"/missing/x\"}]"), CSON_SUCCES);
+	ASSERT_EQ(CSON_apply_patch(doc, patch), CSON_ERROR);
+	CSON_free(patch);
+	ASSERT_TRUE(CSON_subtree_eq(doc, before, true));
+	ASSERT_TRUE(CSON_get_by_key(doc, "moved")->as.object == inner);
+
+	const char *invalid[] = {
+		"[{\"op\":\"test\",\"path\":\"/c\",\"value\":\"other\"}]",
+		"[{\"op\":\"move\",\"from\":\"/moved\",\"path\":\"/moved/b/0\"}]",
+		"[{\"op\":\"add\",\"path\":\"/moved/b/9\",\"value\":1}]",
+		"[{\"op\":\"replace\",\"path\":\"/nope\",\"value\":1}]",
+		"[{\"op\":\"remove\",\"path\":\"\"}]",
+		"[{\"op\":\"add\",\"path\":\"/x\"}]",
+		"[{\"op\":\"frobnicate\",\"path\":\"/c\"}]",
+	};
+	for(size_t i = 0; i < sizeof(invalid) / sizeof(invalid[0]); i++){
+		ASSERT_EQ(CSON_parse(&patch, (char*)invalid[i]), CSON_SUCCES);
+		ASSERT_EQ(CSON_apply_patch(doc, patch), CSON_ERROR);
+		CSON_free(patch);
+	}
+	ASSERT_TRUE(CSON_subtree_eq(doc, before, true));
+	CSON_free(before);
+
+	ASSERT_EQ(CSON_parse(&patch, "[{\"op\":\"replace\",\"path\":\"\",\"value\":[1,2]}]"), CSON_SUCCES);
+	ASSERT_EQ(CSON_apply_patch(doc, patch), CSON_SUCCES);
+	ASSERT_TRUE(CSON_is_array(doc));
+	CSON_free(patch);
+	CSON_free(doc);
+	// removals keep the order of the remaining members, a rollback puts the
+	// removed ones back where they were, index included
+	const char *json = "{\"k0\":0,\"k1\":1,\"k2\":2,\"k3\":3,\"k4\":4,\"k5\":5,\"k6\":6,\"k7\":7,\"k8\":8}";
+	ASSERT_EQ(CSON_parse(&doc, (char*)json), CSON_SUCCES);
+	ASSERT_EQ(CSON_parse(&before, (char*)json), CSON_SUCCES);
+	ASSERT_EQ(CSON_get_number(CSON_get_by_key(doc, "k8")), 8.0); // builds the index
+	ASSERT_EQ(CSON_parse(&patch, "[{\"op\":\"remove\",\"path\":\"/k2\"},{\"op\":\"remove\",\"path\":\"/k5\"},"
+		"{\"op\":\"test\",\"path\":\"/k0\",\"value\":1}]"), CSON_SUCCES);
+	ASSERT_EQ(CSON_apply_patch(doc, patch), CSON_ERROR);
+	CSON_free(patch);
+	ASSERT_TRUE(CSON_subtree_eq(doc, before, true));
+	for (size_t i = 0; i < 9; i++) {
+		char key[4];
+		snprintf(key, sizeof(key), "k%zu", i);
+		ASSERT_EQ(CSON_get_number(CSON_get_by_key(doc, key)), (double)i);
+	}
+	ASSERT_EQ(CSON_parse(&patch, "[{\"op\":\"remove\",\"path\":\"/k2\"}]"), CSON_SUCCES);
+	ASSERT_EQ(CSON_apply_patch(doc, patch), CSON_SUCCES);
+	CSON_free(patch);
+	ASSERT_EQ(strcmp(CSON_get_string(&CSON_Object_key_at(doc->as.object, 2)->string), "k3"), 0);
+	ASSERT_EQ(strcmp(CSON_get_string(&CSON_Object_key_at(doc->as.object, 7)->string), "k8"), 0);
+	CSON_free(before);
+	CSON_free(doc);
+}
+
+UTEST(CSON_Test_patch, merge_patch){
+	CSON *doc, *patch, *expected;
+	ASSERT_EQ(CSON_parse(&doc, "{\"title\":\"Goodbye!\",\"author\":{\"givenName\":\"John\",\"familyName\":\"Doe\"},"
+		"\"tags\":[\"example\",\"sample\"],\"content\":\"This will be unchanged\"}"), CSON_SUCCES);
+	ASSERT_EQ(CSON_parse(&patch, "{\"title\":\"Hello!\",\"phoneNumber\":\"+01-123-456-7890\","
+		"\"author\":{\"familyName\":null},\"tags\":[\"example\"],\"extra\":{\"a\":{\"b\":null,\"c\":1}}}"), CSON_SUCCES);
+	ASSERT_EQ(CSON_parse(&expected, "{\"title\":\"Hello!\",\"author\":{\"givenName\":\"John\"},"
+		"\"tags\":[\"example\"],\"content\":\"This will be unchanged\",\"phoneNumber\":\"+01-123-456-7890\","
+		"\"extra\":{\"a\":{\"c\":1}}}"), CSON_SUCCES);
+	CSON_merge_patch(doc, patch);
+	ASSERT_TRUE(CSON_subtree_eq(doc, expected, false));
+	// values are copied, the patch can be released on its own
+	ASSERT_TRUE(CSON_get_by_key(doc, "tags")->as.array != CSON_get_by_key(patch, "tags")->as.array);
+	CSON_free(patch);
+	CSON_free(expected);
+
+	// deleting a member keeps the order of the others
+	ASSERT_EQ(CSON_parse(&patch, "{\"title\":null}"), CSON_SUCCES);
+	ASSERT_EQ(CSON_parse(&expected, "{\"author\":{\"givenName\":\"John\"},\"tags\":[\"example\"],"
+		"\"content\":\"This will be unchanged\",\"phoneNumber\":\"+01-123-456-7890\",\"extra\":{\"a\":{\"c\":1}}}"), CSON_SUCCES);
+	CSON_merge_patch(doc, patch);
+	ASSERT_TRUE(CSON_subtree_eq(doc, expected, true));
+	CSON_free(patch);
+	CSON_free(expected);
+
+	ASSERT_EQ(CSON_parse(&patch, "[1]"), CSON_SUCCES);
+	CSON_merge_patch(doc, patch);
+	ASSERT_TRUE(CSON_subtree_eq(doc, patch, true));
+	CSON_free(patch);
+	CSON_free(doc);
+
+	// nothing is borrowed from a frozen patch, it can be freed right away
+	ASSERT_EQ(CSON_parse(&doc, "{\"list\":[]}"), CSON_SUCCES);
+	ASSERT_EQ(CSON_parse(&patch, "{\"a key longer than inline\":\"a value longer than inline\"}"), CSON_SUCCES);
+	patch = CSON_freeze(patch);
+	CSON_merge_patch(doc, patch);
+	CSON_free(patch);
+	ASSERT_EQ(strcmp(CSON_get_string(CSON_get_by_key(doc, "a key longer than inline")), "a value longer than inline"), 0);
+	ASSERT_EQ(CSON_parse(&patch, "[{\"op\":\"add\",\"path\":\"/list/-\",\"value\":{\"another long key\":\"another long value\"}}]"), CSON_SUCCES);
+	patch = CSON_freeze(patch);
+	ASSERT_EQ(CSON_apply_patch(doc, patch), CSON_SUCCES);
+	CSON_free(patch);
+	ASSERT_EQ(strcmp(CSON_get_string(CSON_get_by_key(CSON_get_by_index(CSON_get_by_key(doc, "list"), 0), "another long key")), "another long value"), 0);
+	CSON_free(doc);
+}
+
+UTEST(CSON_Test_hash, structural_hash){
+	CSON *a, *b;
+	ASSERT_EQ(CSON_parse(&a, "{\"x\":[1,2,{\"y\":true}],\"z\":\"a string long enough\",\"n\":null}"), CSON_SUCCES);
+	ASSERT_EQ(CSON_parse(&b, "{\"n\":null,\"z\":\"a string long enough\",\"x\":[1,2,{\"y\":true}]}"), CSON_SUCCES);
+	ASSERT_EQ(CSON_hash(a), CSON_hash(b));
+	ASSERT_TRUE(CSON_equal(a, b));
+
+	// a change below a hashed container clears the containers above it, the
+	// hashes of other documents stay
+	uint64_t before = CSON_hash(a);
+	CSON *inner = CSON_get_by_index(CSON_get_by_key(a, "x"), 2);
+	CSON_set_bool(CSON_get_by_key(inner, "y"), false);
+	CSON_touch(inner);
+	ASSERT_TRUE(CSON_HashCache_get(&a->as.object->hash) == 0);
+	ASSERT_TRUE(CSON_HashCache_get(&b->as.object->hash) == before);
+	ASSERT_NE(CSON_hash(a), before);
+	ASSERT_FALSE(CSON_equal(a, b));
+	CSON_set_bool(CSON_get_by_key(inner, "y"), true);
+	CSON_touch(inner);
+	ASSERT_EQ(CSON_hash(a), before);
+	CSON_Object *below = inner->as.object;
+	CSON value = CSON_Number_new(3);
+	CSON_Array_append(CSON_get_by_key(a, "x")->as.array, &value);
+	ASSERT_TRUE(CSON_HashCache_get(&below->hash) != 0);
+	ASSERT_NE(CSON_hash(a), before);
+	CSON_Array_remove(CSON_get_by_key(a, "x")->as.array, 3, NULL);
+	ASSERT_EQ(CSON_hash(a), before);
+
+	// a container taken out clears the document it leaves and no longer
+	// reaches it
+	CSON x = CSON_take(CSON_get_by_key(a, "x"));
+	ASSERT_TRUE(CSON_HashCache_get(&a->as.object->hash) == 0);
+	uint64_t without = CSON_hash(a);
+	value = CSON_Number_new(3);
+	CSON_Array_append(x.as.array, &value);
+	ASSERT_EQ(CSON_hash(a), without);
+	CSON_Array_remove(x.as.array, 3, NULL);
+	CSON key = CSON_String_from_sv((CSON_SV){.str = "x", .len = 1});
+	CSON_Object_set(a->as.object, &key, &x);
+	ASSERT_EQ(CSON_hash(a), before);
+
+	// patches only clear the hashes on the paths they change
+	CSON *patch;
+	ASSERT_EQ(CSON_parse(&patch, "[{\"op\":\"replace\",\"path\":\"/x/0\",\"value\":5}]"), CSON_SUCCES);
+	CSON_Object *third = CSON_get_by_index(CSON_get_by_key(a, "x"), 2)->as.object;
+	ASSERT_EQ(CSON_apply_patch(a, patch), CSON_SUCCES);
+	ASSERT_TRUE(CSON_HashCache_get(&third->hash) != 0);
+	ASSERT_TRUE(CSON_HashCache_get(&a->as.object->hash) == 0);
+	ASSERT_NE(CSON_hash(a), before);
+	ASSERT_FALSE(CSON_equal(CSON_get_by_key(a, "x"), CSON_get_by_key(b, "x")));
+	ASSERT_TRUE(CSON_equal(CSON_get_by_key(a, "z"), CSON_get_by_key(b, "z")));
+	CSON_free(patch);
+	CSON_free(a);
+	CSON_free(b);
+}
+
+UTEST(CSON_Test_hash, diff){
+	CSON *from, *to;
+	ASSERT_EQ(CSON_parse(&from, "{\"keep\":{\"deep\":[1,2,3]},\"change\":[1,2,3,4],\"gone\":1,\"a/b~\":{\"c\":1},\"type\":[]}"), CSON_SUCCES);
+	ASSERT_EQ(CSON_parse(&to, "{\"keep\":{\"deep\":[1,2,3]},\"change\":[1,9],\"a/b~\":{\"c\":2},\"type\":{},\"new\":{\"x\":null}}"), CSON_SUCCES);
+	CSON *patch = CSON_diff(from, to);
+	// change/1, change/3, change/2, gone, a~1b~0/c, type, new
+	ASSERT_EQ(patch->as.array->data.element_count, (size_t)7);
+	ASSERT_EQ(strcmp(CSON_get_string(CSON_get_by_key(CSON_get_by_index(patch, 4), "path")), "/a~1b~0/c"), 0);
+	ASSERT_EQ(CSON_apply_patch(from, patch), CSON_SUCCES);
+	ASSERT_TRUE(CSON_equal(from, to));
+	CSON_free(patch);
+
+	patch = CSON_diff(from, to);
+	ASSERT_EQ(patch->as.array->data.element_count, (size_t)0);
+	CSON_free(patch);
+
+	// a hash collision does not hide a change
+	CSON *deep = CSON_get_by_key(CSON_get_by_key(to, "keep"), "deep");
+	CSON_set_number(CSON_get_by_index(deep, 0), 7);
+	CSON_touch(deep);
+	CSON_HashCache_set(&CSON_get_by_key(from, "keep")->as.object->hash, 42);
+	CSON_HashCache_set(&CSON_get_by_key(to, "keep")->as.object->hash, 42);
+	patch = CSON_diff(from, to);
+	ASSERT_EQ(patch->as.array->data.element_count, (size_t)1);
+	ASSERT_EQ(strcmp(CSON_get_string(CSON_get_by_key(CSON_get_by_index(patch, 0), "path")), "/keep/deep/0"), 0);
+	CSON_free(patch);
+	CSON_free(from);
+	CSON_free(to);
+}
+
+UTEST(CSON_Test_clone, clone){
+	CSON *doc;
+	ASSERT_EQ(CSON_parse(&doc, "{\"name\":\"a string well past the inline limit\",\"list\":[1,{\"k\":[]},\"another long string value\"],\"empty\":{},\"a\":1,\"b\":2,\"c\":3,\"d\":4,\"e\":5,\"f\":6,\"g\":7}"), CSON_SUCCES);
+	uint64_t hash = CSON_hash(doc);
+
+	CSON *copy = CSON_clone(doc, NULL);
+	ASSERT_TRUE(CSON_equal(doc, copy));
+	ASSERT_TRUE(CSON_get_by_key(doc, "name")->as.string != CSON_get_by_key(copy, "name")->as.string);
+	CSON_set_string(CSON_get_by_key(copy, "name"), "changed");
+	CSON_set_number(CSON_get_by_index(CSON_get_by_key(copy, "list"), 0), 2);
+	ASSERT_FALSE(CSON_equal(doc, copy));
+	ASSERT_EQ(CSON_hash(doc), hash);
+	ASSERT_EQ(CSON_get_number(CSON_get_by_key(copy, "g")), 7.0);
+	CSON_free(copy);
+
+	CSON_Arena arena;
+	CSON_Arena_init(&arena, 256);
+	copy = CSON_clone(doc, &arena);
+	ASSERT_TRUE(CSON_is_frozen(copy));
+	ASSERT_TRUE(CSON_equal(doc, copy));
+	CSON *frozen = CSON_freeze(CSON_clone(doc, NULL));
+	CSON *twin = CSON_clone(frozen, &arena);
+	ASSERT_TRUE(CSON_equal(frozen, twin));
+	ASSERT_EQ(CSON_hash(twin), hash);
+	ASSERT_EQ(CSON_get_number(CSON_get_by_key(twin, "g")), 7.0);
+	ASSERT_EQ(strcmp(CSON_get_string(CSON_get_by_index(CSON_get_by_key(twin, "list"), 2)), "another long string value"), 0);
+	CSON_free(frozen);
+	ASSERT_EQ(CSON_get_number(CSON_get_by_key(twin, "a")), 1.0);
+
+	CSON_Arena_reset(&arena);
+	copy = CSON_clone(CSON_get_by_key(doc, "list"), &arena);
+	ASSERT_TRUE(CSON_equal(CSON_get_by_key(doc, "list"), copy));
+	CSON_Arena_free(&arena);
+	CSON_free(doc);
+}
+
+typedef struct {
+	CSON *source;
+	atomic_bool *start;
+	size_t equal;
+} Test_Cloner;
+
+static void *test_cloner(void *arg) {
+	Test_Cloner *cloner = arg;
+	while (!atomic_load(cloner->start)) {
+	}
+	for (size_t i = 0; i < 200; i++) {
+		CSON *copy = CSON_clone(cloner->source, NULL);
+		cloner->equal += CSON_equal(cloner->source, copy);
+		CSON_free(copy);
+	}
+	return NULL;
+}
+
+UTEST(CSON_Test_clone, concurrent_clone){
+	CSON *doc;
+	ASSERT_EQ(CSON_parse(&doc, "[{\"name\":\"a string well past the inline limit\",\"id\":1},{\"name\":\"another string past the limit\",\"id\":2}]"), CSON_SUCCES);
+	CSON_ShapeTable shapes;
+	CSON_ShapeTable_init(&shapes);
+	for (size_t i = 0; i < 2; i++) {
+		CSON_Object_intern_shape(CSON_get_by_index(doc, i)->as.object, &shapes);
+	}
+
+	// copies own their strings and keys, the source is only read
+	atomic_bool start = false;
+	pthread_t threads[4];
+	Test_Cloner cloners[4];
+	for (size_t t = 0; t < 4; t++) {
+		cloners[t] = (Test_Cloner){.source = doc, .start = &start};
+		ASSERT_EQ(pthread_create(&threads[t], NULL, test_cloner, &cloners[t]), 0);
+	}
+	atomic_store(&start, true);
+	for (size_t t = 0; t < 4; t++) {
+		pthread_join(threads[t], NULL);
+		ASSERT_EQ(cloners[t].equal, (size_t)200);
+	}
+	ASSERT_EQ(CSON_get_by_key(CSON_get_by_index(doc, 0), "name")->as.string->refcount, (size_t)1);
+	CSON_free(doc);
+	CSON_ShapeTable_free(&shapes);
+}